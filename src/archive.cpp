@@ -0,0 +1,146 @@
+/**
+ * @file archive.cpp
+ * @brief Block level access to PAQMan archives without decoding.
+ *
+ * Offsets are the Decompresser's position in the mapping. Skipping the
+ * coded data of a segment is a search for the four zero bytes that end it
+ * (memchr() over the mapping), without copying it.
+ */
+
+#include "archive.h"
+#include "libzpaq.h"
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace archive {
+
+Mapping::Mapping(const std::string& path) : name(path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        throw std::runtime_error("Cannot open input file: " + path);
+    }
+    length = uint64_t(st.st_size);
+    if (length > 0) {
+        void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        const int e = errno;
+        ::close(fd);
+        if (p == MAP_FAILED) throw std::runtime_error("Cannot map " + path + ": " + std::strerror(e));
+        madvise(p, length, MADV_SEQUENTIAL);
+        begin = static_cast<const char*>(p);
+    } else {
+        ::close(fd);
+    }
+}
+
+Mapping::~Mapping() {
+    if (begin) munmap(const_cast<char*>(begin), length);
+}
+
+std::vector<Block> scan(const Mapping& archive) {
+    libzpaq::Decompresser d;
+    d.setInput(archive.data(), archive.data() + archive.size());
+    auto offset = [&] { return uint64_t(d.position() - archive.data()); };
+    std::vector<Block> blocks;
+    std::string file;
+    uint64_t end = 0;
+    while (d.findBlock()) {
+        Block b;
+        b.start = end;
+        libzpaq::StringBuffer name, comment;
+        while (d.findFilename(&name)) {
+            Segment s;
+            s.named = name.size() > 0;
+            if (s.named) file.assign(name.c_str(), name.size());
+            s.file = file;
+            d.readComment(&comment);
+            s.comment.assign(comment.c_str(), comment.size());
+            if (b.segments.empty()) {
+                b.comment = s.comment;
+                b.commentEnd = offset() - 2;  // before the comment's NUL and the reserved byte
+            }
+            d.readSegmentEnd();
+            b.segments.push_back(s);
+            name.reset();
+            comment.reset();
+        }
+        b.end = end = offset();
+        blocks.push_back(b);
+    }
+    if (blocks.empty()) throw std::runtime_error("No valid ZPAQ block found in " + archive.path());
+    return blocks;
+}
+
+std::vector<Block> scan(const std::string& path) {
+    return scan(Mapping(path));
+}
+
+std::vector<uint64_t> findTags(const Mapping& archive) {
+    std::vector<uint64_t> tags;
+    const char* end = archive.data() + archive.size();
+    for (const char* p = archive.data(); (p = libzpaq::findTag(p, end)) != end; ++p) {
+        tags.push_back(uint64_t(p - archive.data()));
+    }
+    return tags;
+}
+
+void decodeSegment(libzpaq::Decompresser& d, const std::string& comment, const std::string& what) {
+    const uint64_t size = std::isdigit(static_cast<unsigned char>(comment.c_str()[0]))
+                              ? std::strtoull(comment.c_str(), nullptr, 10)
+                              : UINT64_MAX;
+    libzpaq::SHA1 sha1;
+    d.setSHA1(&sha1);
+    while (d.decompress(1000000)) {
+        if (sha1.usize() > size) break;
+    }
+    d.setSHA1(nullptr);
+    if (sha1.usize() > size) throw std::runtime_error("Checksum error in " + what + ": more data than its size");
+    char stored[21];
+    d.readSegmentEnd(stored);
+    if (stored[0] && std::memcmp(stored + 1, sha1.result(), 20) != 0) {
+        throw std::runtime_error("Checksum error in " + what);
+    }
+}
+
+bool selected(const std::string& file, const std::vector<std::string>& names) {
+    for (std::string n : names) {
+        while (n.size() > 1 && n.back() == '/') n.pop_back();
+        if (file == n || (file.size() > n.size() && file.compare(0, n.size(), n) == 0 && file[n.size()] == '/')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string readRange(const std::string& path, uint64_t start, uint64_t end) {
+    std::ifstream in(path, std::ios::binary);
+    std::string s(end - start, '\0');
+    if (!in.seekg(start) || !in.read(&s[0], s.size())) throw std::runtime_error("Cannot read " + path);
+    return s;
+}
+
+Snapshot snapshot(const std::string& path) {
+    return {fs::file_size(path), fs::last_write_time(path)};
+}
+
+void replace(const std::string& tmp, const std::string& path, const Snapshot& before) {
+    Snapshot now = snapshot(path);
+    if (now.size != before.size || now.time != before.time) {
+        fs::remove(tmp);
+        throw std::runtime_error(path + " changed while it was rewritten, nothing was replaced");
+    }
+    fs::rename(tmp, path);
+}
+
+}  // namespace archive
@@ -0,0 +1,94 @@
+/**
+ * @file archive.h
+ * @brief Block level access to PAQMan archives without decoding.
+ *
+ * ZPAQ blocks are self-contained, so tools that rewrite an archive
+ * (`paqman optimize`, `merge`, `delete`, `subset`) find the byte range of
+ * every block with scan() and copy the blocks they do not change as raw
+ * bytes. Only the segment headers are parsed; the coded data is skipped.
+ *
+ * scan() reads the archive through a Mapping, so the Decompresser parses
+ * it in place instead of copying it into its input buffer, and a caller
+ * that needs only some blocks points a Decompresser at their ranges of
+ * the same mapping (`paqman l`, `paqman d <archive> <dir> <file...>`).
+ */
+
+#ifndef PAQMAN_ARCHIVE_H
+#define PAQMAN_ARCHIVE_H
+
+#include "libzpaq.h"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace archive {
+
+struct Segment {
+    std::string file;    // file it belongs to: its own name, or the last named segment's
+    bool named = false;  // false for a continuation of the previous file
+    std::string comment; // "<size>" and the zero runs left out (see sparse.h)
+};
+
+struct Block {
+    uint64_t start = 0, end = 0;    // byte range in the archive
+    std::vector<Segment> segments;
+    std::string comment;            // of the first segment
+    uint64_t commentEnd = 0;        // archive offset just past that comment
+};
+
+// A whole file mapped read-only. An empty file has no data.
+class Mapping {
+public:
+    explicit Mapping(const std::string& path);  // throws if it cannot be mapped
+    ~Mapping();
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+
+    const char* data() const { return begin; }
+    uint64_t size() const { return length; }
+    const std::string& path() const { return name; }
+
+private:
+    std::string name;
+    const char* begin = nullptr;
+    uint64_t length = 0;
+};
+
+// Finds the blocks of an archive. Bytes before a block (normally none)
+// are part of its range. Throws if there are no blocks.
+std::vector<Block> scan(const Mapping& archive);
+std::vector<Block> scan(const std::string& path);
+
+// Offsets of the block tags in archive, found without parsing the blocks,
+// so also in damaged archives or other files with archives inside. A tag
+// in the stored data of a block counts too.
+std::vector<uint64_t> findTags(const Mapping& archive);
+
+// Decodes the segment whose comment d has just read to d's output, and
+// checks it against the segment's stored SHA-1, if it has one. Throws
+// "Checksum error in <what>" if it differs, or as soon as more bytes come
+// out than the size that starts comment, so that a damaged block cannot
+// write unbounded garbage.
+void decodeSegment(libzpaq::Decompresser& d, const std::string& comment, const std::string& what);
+
+// True if file is one of names or below one of them.
+bool selected(const std::string& file, const std::vector<std::string>& names);
+
+// Returns bytes [start, end) of a file. Throws on I/O errors.
+std::string readRange(const std::string& path, uint64_t start, uint64_t end);
+
+// Size and mtime of a file, to detect writers that ran during a rewrite.
+struct Snapshot {
+    uintmax_t size;
+    std::filesystem::file_time_type time;
+};
+Snapshot snapshot(const std::string& path);
+
+// Renames tmp over path if path still matches before, else removes tmp
+// and throws.
+void replace(const std::string& tmp, const std::string& path, const Snapshot& before);
+
+}  // namespace archive
+
+#endif  // PAQMAN_ARCHIVE_H
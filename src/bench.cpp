@@ -0,0 +1,273 @@
+/**
+ * @file bench.cpp
+ * @brief In-memory end-to-end benchmark for PAQMan (`paqman bench`).
+ *
+ * The input (user files or a corpus from corpus.h) is loaded once, split into
+ * blocks of the requested size, and each block is compressed with
+ * libzpaq::compressBlock() and decompressed with libzpaq::decompress()
+ * between in-memory StringBuffers. No disk I/O happens while timing.
+ *
+ * Every combination of level x threads x block size is reported with
+ * compress and decompress throughput, compression ratio, peak RSS and
+ * per-block latency percentiles, as a table or as JSON (--json) for
+ * tracking regressions across releases.
+ */
+
+#include "bench.h"
+#include "benchutil.h"
+#include "corpus.h"
+#include "libzpaq.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+using namespace benchutil;
+
+namespace {
+
+const char* const kVersion = "1.0.1";
+
+// --- Options ---
+
+struct BenchOptions {
+    std::vector<int> levels{0, 1, 2, 3, 4, 5};
+    std::vector<int> threads{1};
+    std::vector<size_t> blockSizes{1u << 20, 16u << 20};  // bytes
+    size_t syntheticSize = 8u << 20;                      // bytes
+    corpus::Kind corpusKind = corpus::MIXED;
+    uint64_t seed = 1;
+    bool json = false;
+    std::vector<std::string> files;
+};
+
+BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 0; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--levels") {
+            o.levels = parseList(optionValue(argc, argv, i), 0, 5, "level");
+        } else if (a == "--threads") {
+            o.threads = parseList(optionValue(argc, argv, i), 1, 256, "thread");
+        } else if (a == "--block-sizes") {
+            o.blockSizes.clear();
+            for (int mb : parseList(optionValue(argc, argv, i), 1, 1024, "block size")) {
+                o.blockSizes.push_back(size_t(mb) << 20);
+            }
+        } else if (a == "--size") {
+            o.syntheticSize = size_t(parseInt(optionValue(argc, argv, i), 1, 4096, "size")) << 20;
+        } else if (a == "--corpus") {
+            std::string kind = optionValue(argc, argv, i);
+            if (!corpus::parseKind(kind, o.corpusKind)) {
+                throw std::runtime_error("Unknown corpus '" + kind + "', use one of " + corpus::kindList());
+            }
+        } else if (a == "--seed") {
+            o.seed = parseInt(optionValue(argc, argv, i), 0, 0x7fffffff, "seed");
+        } else if (a == "--json") {
+            o.json = true;
+        } else if (a.size() > 1 && a[0] == '-') {
+            throw std::runtime_error("Unknown bench option: " + a);
+        } else {
+            o.files.push_back(a);
+        }
+    }
+    return o;
+}
+
+// --- Inputs ---
+
+std::string loadFile(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) throw std::runtime_error("Cannot open input file: " + filename);
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// --- Measurement helpers ---
+
+// Resets the kernel's peak RSS counter (Linux 4.0+) so each run reports
+// its own peak rather than the process lifetime maximum.
+void resetPeakRss() {
+    std::ofstream f("/proc/self/clear_refs");
+    if (f.is_open()) f << "5";
+}
+
+// Returns peak resident set size in bytes.
+size_t peakRss() {
+    std::ifstream f("/proc/self/status");
+    std::string line;
+    while (std::getline(f, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return size_t(std::atol(line.c_str() + 6)) << 10;
+    }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return size_t(ru.ru_maxrss) << 10;
+}
+
+// --- Benchmark ---
+
+struct RunResult {
+    int level;
+    int threads;
+    size_t blockSize;
+    size_t blocks;
+    size_t inBytes;
+    size_t outBytes;
+    double compSeconds;
+    double decompSeconds;
+    size_t peakRssBytes;
+    std::vector<double> compLatency;    // seconds per block, sorted
+    std::vector<double> decompLatency;  // seconds per block, sorted
+};
+
+RunResult runOne(const std::string& data, int level, int threads, size_t blockSize) {
+    RunResult r;
+    r.level = level;
+    r.threads = threads;
+    r.blockSize = blockSize;
+    r.inBytes = data.size();
+    r.blocks = (data.size() + blockSize - 1) / blockSize;
+    r.compLatency.assign(r.blocks, 0);
+    r.decompLatency.assign(r.blocks, 0);
+
+    const std::string method(1, char('0' + level));
+    std::vector<std::unique_ptr<libzpaq::StringBuffer>> packed(r.blocks);
+
+    resetPeakRss();
+    Clock::time_point t0 = Clock::now();
+    parallelFor(r.blocks, threads, [&](size_t i) {
+        const size_t off = i * blockSize;
+        const size_t len = std::min(blockSize, data.size() - off);
+        libzpaq::StringBuffer in(len);
+        in.write(data.data() + off, int(len));
+        std::unique_ptr<libzpaq::StringBuffer> out(new libzpaq::StringBuffer(len / 2));
+        Clock::time_point tb = Clock::now();
+        trace::setBlock(int(i));
+        libzpaq::compressBlock(&in, out.get(), method.c_str());
+        r.compLatency[i] = secondsSince(tb);
+        packed[i] = std::move(out);
+    });
+    r.compSeconds = secondsSince(t0);
+
+    r.outBytes = 0;
+    for (const auto& p : packed) r.outBytes += p->size();
+
+    std::atomic<bool> mismatch(false);
+    t0 = Clock::now();
+    parallelFor(r.blocks, threads, [&](size_t i) {
+        const size_t off = i * blockSize;
+        const size_t len = std::min(blockSize, data.size() - off);
+        libzpaq::StringBuffer out(len);
+        Clock::time_point tb = Clock::now();
+        trace::setBlock(int(i));
+        libzpaq::decompress(packed[i].get(), &out);
+        r.decompLatency[i] = secondsSince(tb);
+        if (out.size() != len || std::memcmp(out.c_str(), data.data() + off, len) != 0) mismatch = true;
+    });
+    r.decompSeconds = secondsSince(t0);
+    r.peakRssBytes = peakRss();
+
+    if (mismatch) {
+        throw std::runtime_error("Round trip mismatch at level " + std::to_string(level) +
+                                 ", block size " + std::to_string(blockSize >> 20) + " MiB");
+    }
+    std::sort(r.compLatency.begin(), r.compLatency.end());
+    std::sort(r.decompLatency.begin(), r.decompLatency.end());
+    return r;
+}
+
+double mbps(size_t bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / 1e6 : 0;
+}
+
+// --- Reporting ---
+
+void printTableHeader() {
+    std::printf("%5s %7s %6s %6s %8s %9s %9s %7s %8s %8s %8s %8s %8s %8s\n",
+                "level", "threads", "blk_MB", "blocks", "ratio", "comp_MB/s", "dec_MB/s", "rss_MB",
+                "c_p50ms", "c_p90ms", "c_p99ms", "d_p50ms", "d_p90ms", "d_p99ms");
+}
+
+void printTableRow(const RunResult& r) {
+    std::printf("%5d %7d %6zu %6zu %8.4f %9.3f %9.3f %7.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+                r.level, r.threads, r.blockSize >> 20, r.blocks,
+                r.inBytes ? double(r.outBytes) / r.inBytes : 0.0,
+                mbps(r.inBytes, r.compSeconds), mbps(r.inBytes, r.decompSeconds),
+                r.peakRssBytes / 1048576.0,
+                percentile(r.compLatency, 50), percentile(r.compLatency, 90), percentile(r.compLatency, 99),
+                percentile(r.decompLatency, 50), percentile(r.decompLatency, 90),
+                percentile(r.decompLatency, 99));
+    std::fflush(stdout);
+}
+
+void printJson(const std::string& corpus, size_t corpusBytes, const std::vector<RunResult>& results) {
+    std::printf("{\n  \"paqman\": \"%s\",\n  \"corpus\": \"%s\",\n  \"corpus_bytes\": %zu,\n"
+                "  \"hardware_threads\": %u,\n  \"results\": [",
+                kVersion, jsonEscape(corpus).c_str(), corpusBytes, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < results.size(); ++i) {
+        const RunResult& r = results[i];
+        std::printf("%s\n    {\"level\": %d, \"threads\": %d, \"block_bytes\": %zu, \"blocks\": %zu, "
+                    "\"in_bytes\": %zu, \"out_bytes\": %zu, \"ratio\": %.6f, "
+                    "\"compress_mbps\": %.3f, \"decompress_mbps\": %.3f, \"peak_rss_bytes\": %zu, "
+                    "\"compress_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}, "
+                    "\"decompress_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}}",
+                    i ? "," : "", r.level, r.threads, r.blockSize, r.blocks, r.inBytes, r.outBytes,
+                    r.inBytes ? double(r.outBytes) / r.inBytes : 0.0,
+                    mbps(r.inBytes, r.compSeconds), mbps(r.inBytes, r.decompSeconds), r.peakRssBytes,
+                    percentile(r.compLatency, 50), percentile(r.compLatency, 90),
+                    percentile(r.compLatency, 99), percentile(r.compLatency, 100),
+                    percentile(r.decompLatency, 50), percentile(r.decompLatency, 90),
+                    percentile(r.decompLatency, 99), percentile(r.decompLatency, 100));
+    }
+    std::printf("\n  ]\n}\n");
+}
+
+}  // namespace
+
+// --- Entry Point ---
+
+int runBench(int argc, char** argv) {
+    BenchOptions o = parseOptions(argc, argv);
+
+    std::string data, name;
+    if (o.files.empty()) {
+        data = corpus::generate(o.corpusKind, o.syntheticSize, o.seed);
+        name = std::string(corpus::kindName(o.corpusKind)) + ":seed=" + std::to_string(o.seed);
+    } else {
+        for (const auto& f : o.files) {
+            data += loadFile(f);
+            name += (name.empty() ? "" : ",") + f;
+        }
+    }
+    if (data.empty()) throw std::runtime_error("Benchmark input is empty");
+
+    if (!o.json) {
+        std::cout << "Benchmarking " << name << " (" << data.size() << " bytes, in memory)\n";
+        printTableHeader();
+    }
+
+    std::vector<RunResult> results;
+    for (int level : o.levels) {
+        for (size_t bs : o.blockSizes) {
+            for (int t : o.threads) {
+                results.push_back(runOne(data, level, t, bs));
+                if (!o.json) printTableRow(results.back());
+            }
+        }
+    }
+
+    if (o.json) printJson(name, data.size(), results);
+    return 0;
+}
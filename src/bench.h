@@ -0,0 +1,30 @@
+/**
+ * @file bench.h
+ * @brief Benchmark modes for PAQMan (`paqman bench`, `bench-model`, `bench-jit`).
+ *
+ * `bench` runs compression levels through libzpaq::compressBlock() and
+ * libzpaq::Decompresser entirely in memory (no disk I/O after the inputs
+ * are loaded), sweeping thread counts and block sizes.
+ *
+ * `bench-model` times single ZPAQ components and small component chains
+ * through libzpaq::Predictor, with JIT and with the interpreter.
+ *
+ * `bench-jit` compresses with JIT and with the interpreter, checks that the
+ * outputs are identical and reports the speedup per config.
+ */
+
+#ifndef PAQMAN_BENCH_H
+#define PAQMAN_BENCH_H
+
+// Entry point for `paqman bench [options] [files...]`.
+// argv[0] is the first argument after "bench". Returns a process exit code.
+int runBench(int argc, char** argv);
+
+// Entry point for `paqman bench-model [options] [file]`.
+int runModelBench(int argc, char** argv);
+
+// Entry point for `paqman bench-jit [options] [files...]`.
+// Returns 1 if any config differs between JIT and interpreter.
+int runJitBench(int argc, char** argv);
+
+#endif  // PAQMAN_BENCH_H
@@ -0,0 +1,147 @@
+/**
+ * @file benchutil.h
+ * @brief Helpers shared by the PAQMan benchmark modes (bench*.cpp, loadtest).
+ *
+ * Timing, option value and list parsing, latency percentiles, a simple parallel
+ * loop, a portable PRNG and JSON string escaping.
+ */
+
+#ifndef PAQMAN_BENCHUTIL_H
+#define PAQMAN_BENCHUTIL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace benchutil {
+
+typedef std::chrono::steady_clock Clock;
+
+inline double secondsSince(Clock::time_point t0) {
+    return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+// Parses "1,4,16" or "0-5" into a list of integers in [lo, hi].
+inline std::vector<int> parseList(const std::string& arg, int lo, int hi, const char* what) {
+    std::vector<int> r;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t dash = item.find('-', 1);
+        int a, b;
+        try {
+            a = std::stoi(item.substr(0, dash));
+            b = dash == std::string::npos ? a : std::stoi(item.substr(dash + 1));
+        } catch (const std::exception&) {
+            throw std::runtime_error(std::string("Invalid ") + what + " list: " + arg);
+        }
+        if (a < lo || b > hi || a > b) {
+            throw std::runtime_error(std::string("Invalid ") + what + " list: " + arg +
+                                     " (allowed " + std::to_string(lo) + "-" + std::to_string(hi) + ")");
+        }
+        for (int i = a; i <= b; ++i) r.push_back(i);
+    }
+    if (r.empty()) throw std::runtime_error(std::string("Empty ") + what + " list");
+    return r;
+}
+
+// Parses a single integer in [lo, hi]. Lists and ranges are errors.
+inline int parseInt(const std::string& arg, int lo, int hi, const char* what) {
+    size_t end = 0;
+    int v = 0;
+    try {
+        v = std::stoi(arg, &end);
+    } catch (const std::exception&) {
+        end = 0;
+    }
+    if (end == 0 || end != arg.size()) throw std::runtime_error(std::string("Invalid ") + what + ": " + arg);
+    if (v < lo || v > hi) {
+        throw std::runtime_error(std::string("Invalid ") + what + ": " + arg +
+                                 " (allowed " + std::to_string(lo) + "-" + std::to_string(hi) + ")");
+    }
+    return v;
+}
+
+// Returns the value that follows option argv[i] and moves i to it.
+inline std::string optionValue(int argc, char** argv, int& i) {
+    if (i + 1 >= argc) throw std::runtime_error(std::string("Missing value for ") + argv[i]);
+    return argv[++i];
+}
+
+// Nearest-rank percentile of sorted latencies in seconds, in milliseconds.
+inline double percentile(const std::vector<double>& sorted, double pct) {
+    if (sorted.empty()) return 0;
+    size_t k = size_t(pct / 100.0 * sorted.size() + 0.999999);
+    if (k < 1) k = 1;
+    if (k > sorted.size()) k = sorted.size();
+    return sorted[k - 1] * 1000.0;
+}
+
+// Runs job(i) for i in [0, n) on up to nthreads threads. Every job runs,
+// as others may wait for it; if any throw, the first exception is rethrown
+// once all threads have joined.
+template <typename F>
+void parallelFor(size_t n, int nthreads, F job) {
+    std::atomic<size_t> next(0);
+    std::mutex m;
+    std::exception_ptr error;
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < n;) {
+            try {
+                job(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m);
+                if (!error) error = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < nthreads && size_t(t) < n; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& th : pool) th.join();
+    if (error) std::rethrow_exception(error);
+}
+
+// Small deterministic PRNG (splitmix64), identical on every platform and
+// standard library, for reproducible benchmark inputs and configs.
+class Rng {
+    uint64_t s;
+
+public:
+    explicit Rng(uint64_t seed) : s(seed) {}
+    uint64_t next() {
+        uint64_t z = (s += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    // Uniform in [0, n), n > 0.
+    unsigned below(unsigned n) { return unsigned((next() >> 32) * n >> 32); }
+};
+
+inline std::string jsonEscape(const std::string& s) {
+    std::string r;
+    for (char c : s) {
+        if (c == '"' || c == '\\') r += '\\';
+        if (c >= 0 && c < 32) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            r += buf;
+        } else {
+            r += c;
+        }
+    }
+    return r;
+}
+
+}  // namespace benchutil
+
+#endif  // PAQMAN_BENCHUTIL_H
@@ -0,0 +1,246 @@
+/**
+ * @file corpus.cpp
+ * @brief Deterministic synthetic corpus generator for PAQMan benchmarks.
+ *
+ * All randomness comes from benchutil::Rng (splitmix64), never from the
+ * standard library distributions, whose output differs between
+ * implementations.
+ */
+
+#include "corpus.h"
+#include "benchutil.h"
+#include <cstdio>
+#include <vector>
+
+using benchutil::Rng;
+
+namespace corpus {
+
+namespace {
+
+const char* const kNames[] = {"random", "text", "x86", "records", "logs", "mixed"};
+
+// Returns an index in [0, n) skewed towards 0, roughly Zipf-like.
+unsigned skewed(Rng& rng, unsigned n) {
+    const double u = rng.below(1u << 20) / double(1u << 20);
+    return unsigned(n * u * u * u);
+}
+
+// --- random ---
+
+void genRandom(Rng& rng, size_t n, std::string& out) {
+    while (out.size() < n) {
+        uint64_t x = rng.next();
+        for (int i = 0; i < 8; ++i, x >>= 8) out += char(x);
+    }
+}
+
+// --- text ---
+
+// Builds a vocabulary of pronounceable words from syllables.
+std::vector<std::string> vocabulary(Rng& rng, int nwords) {
+    static const char* const onsets[] = {"", "b", "c", "d", "f", "g", "h", "l", "m", "n", "p",
+                                         "r", "s", "t", "v", "w", "th", "st", "pr", "tr", "ch"};
+    static const char* const vowels[] = {"a", "e", "i", "o", "u", "ea", "ou", "io", "ai"};
+    static const char* const codas[] = {"", "", "n", "r", "s", "t", "l", "nd", "st", "ng", "ck"};
+    static const char* const common[] = {"the", "of", "and", "to", "in", "is", "that", "it",
+                                         "was", "for", "on", "are", "as", "with", "be", "at"};
+    std::vector<std::string> v(common, common + sizeof(common) / sizeof(common[0]));
+    while (int(v.size()) < nwords) {
+        std::string w;
+        for (int s = 1 + rng.below(3); s > 0; --s) {
+            w += onsets[rng.below(sizeof(onsets) / sizeof(onsets[0]))];
+            w += vowels[rng.below(sizeof(vowels) / sizeof(vowels[0]))];
+            w += codas[rng.below(sizeof(codas) / sizeof(codas[0]))];
+        }
+        v.push_back(w);
+    }
+    return v;
+}
+
+void genText(Rng& rng, size_t n, std::string& out) {
+    const std::vector<std::string> words = vocabulary(rng, 4000);
+    while (out.size() < n) {
+        const int len = 5 + rng.below(16);
+        for (int i = 0; i < len; ++i) {
+            std::string w = words[skewed(rng, unsigned(words.size()))];
+            if (i == 0) w[0] = char(w[0] - 'a' + 'A');
+            out += w;
+            if (i + 1 < len) out += rng.below(12) == 0 ? ", " : " ";
+        }
+        out += rng.below(8) == 0 ? "?" : ".";
+        out += rng.below(6) == 0 ? "\n\n" : " ";
+    }
+}
+
+// --- x86 ---
+
+void put32(std::string& out, uint32_t x) {
+    for (int i = 0; i < 4; ++i, x >>= 8) out += char(x);
+}
+
+// Emits functions made of common x86-64 instruction templates. Calls
+// (E8) and jumps (E9) target earlier function starts with relative
+// offsets, which the E8E9 transform turns into repeated absolute ones.
+void genX86(Rng& rng, size_t n, std::string& out) {
+    std::vector<uint32_t> functions;
+    while (out.size() < n) {
+        functions.push_back(uint32_t(out.size()));
+        out += "\x55\x48\x89\xe5";  // push rbp; mov rbp,rsp
+        for (int k = 4 + rng.below(40); k > 0; --k) {
+            switch (rng.below(8)) {
+                case 0:  // mov r32, imm32
+                    out += char(0xb8 + rng.below(8));
+                    put32(out, rng.below(4) ? rng.below(256) : uint32_t(rng.next()));
+                    break;
+                case 1:  // mov [rbp-disp8], reg
+                    out += "\x48\x89";
+                    out += char(0x45 + 8 * rng.below(8));
+                    out += char(-8 * int(1 + rng.below(16)));
+                    break;
+                case 2:  // mov reg, [rbp-disp8]
+                    out += "\x48\x8b";
+                    out += char(0x45 + 8 * rng.below(8));
+                    out += char(-8 * int(1 + rng.below(16)));
+                    break;
+                case 3:
+                case 4: {  // call rel32 to an earlier (often recent) function
+                    const uint32_t target = functions[functions.size() - 1 - skewed(rng, unsigned(functions.size()))];
+                    out += '\xe8';
+                    put32(out, target - uint32_t(out.size() + 4));
+                    break;
+                }
+                case 5: {  // jmp rel32
+                    const uint32_t target = functions[rng.below(unsigned(functions.size()))];
+                    out += '\xe9';
+                    put32(out, target - uint32_t(out.size() + 4));
+                    break;
+                }
+                case 6:  // cmp eax, imm8; jcc rel8
+                    out += "\x83\xf8";
+                    out += char(rng.below(64));
+                    out += char(0x74 + rng.below(4));
+                    out += char(rng.below(64));
+                    break;
+                default:  // add rax, imm8 / xor eax, eax
+                    if (rng.below(2)) {
+                        out += "\x48\x83\xc0";
+                        out += char(rng.below(128));
+                    } else {
+                        out += "\x31\xc0";
+                    }
+                    break;
+            }
+        }
+        out += "\x5d\xc3";  // pop rbp; ret
+        while (out.size() % 16) out += '\xcc';
+    }
+}
+
+// --- records ---
+
+// 32-byte little-endian records: id, timestamp, type, a random walk
+// reading, a low-entropy value and a fixed-width name.
+void genRecords(Rng& rng, size_t n, std::string& out) {
+    static const char* const names[] = {"sensor-north", "sensor-south", "pump-a", "pump-b",
+                                        "valve-17", "valve-18", "meter-main"};
+    uint32_t id = 1000, t = 1760700000;
+    int reading = 2000;
+    while (out.size() < n) {
+        put32(out, id++);
+        put32(out, t += 1 + rng.below(4));
+        const unsigned type = skewed(rng, 4);
+        out += char(type);
+        out += char(0);
+        reading += int(rng.below(21)) - 10;
+        out += char(reading);
+        out += char(reading >> 8);
+        put32(out, uint32_t(type * 1000 + rng.below(16)));
+        std::string name = names[rng.below(sizeof(names) / sizeof(names[0]))];
+        name.resize(16, '\0');
+        out += name;
+    }
+}
+
+// --- logs ---
+
+void genLogs(Rng& rng, size_t n, std::string& out) {
+    static const char* const levels[] = {"INFO", "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+    static const char* const components[] = {"http", "db", "cache", "auth", "scheduler"};
+    static const char* const paths[] = {"/api/v1/users", "/api/v1/orders", "/api/v1/items",
+                                        "/healthz", "/api/v2/search", "/static/app.js"};
+    static const char* const methods[] = {"GET", "GET", "GET", "POST", "PUT", "DELETE"};
+    uint64_t ms = 1760700000000ull;
+    char line[256];
+    while (out.size() < n) {
+        ms += rng.below(50);
+        const uint64_t sec = ms / 1000;
+        const unsigned level = rng.below(sizeof(levels) / sizeof(levels[0]));
+        const unsigned comp = skewed(rng, sizeof(components) / sizeof(components[0]));
+        int len = std::snprintf(line, sizeof(line), "2025-10-17T%02u:%02u:%02u.%03uZ %-5s [%s-%u] ",
+                                unsigned(sec / 3600 % 24), unsigned(sec / 60 % 60), unsigned(sec % 60),
+                                unsigned(ms % 1000), levels[level], components[comp], rng.below(4));
+        if (comp == 0) {
+            len += std::snprintf(line + len, sizeof(line) - len,
+                                 "%s %s status=%u latency=%ums request_id=%08x\n",
+                                 methods[skewed(rng, 6)], paths[skewed(rng, 6)],
+                                 rng.below(20) ? 200 : 404 + rng.below(2) * 96, 1 + skewed(rng, 900),
+                                 unsigned(rng.next()));
+        } else {
+            len += std::snprintf(line + len, sizeof(line) - len, "%s completed in %ums (%u rows)\n",
+                                 level >= 5 ? "operation failed and retried" : "operation",
+                                 1 + skewed(rng, 200), skewed(rng, 10000));
+        }
+        out.append(line, len);
+    }
+}
+
+}  // namespace
+
+// --- Public API ---
+
+const char* kindName(Kind kind) {
+    return kNames[kind];
+}
+
+bool parseKind(const std::string& name, Kind& kind) {
+    for (int k = RANDOM; k <= MIXED; ++k) {
+        if (name == kNames[k]) {
+            kind = Kind(k);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* kindList() {
+    return "random,text,x86,records,logs,mixed";
+}
+
+std::string generate(Kind kind, size_t n, uint64_t seed) {
+    std::string out;
+    out.reserve(n + 256);
+    if (kind == MIXED) {
+        // Compressible kinds first, so small sizes are not all random
+        static const Kind parts[] = {TEXT, X86, RECORDS, LOGS, RANDOM};
+        for (int i = 0; i < 5; ++i) {
+            const size_t part = n / 5 + (i == 4 ? n % 5 : 0);
+            out += generate(parts[i], part, seed * 16 + parts[i]);
+        }
+        return out;
+    }
+
+    Rng rng(seed);
+    switch (kind) {
+        case RANDOM: genRandom(rng, n, out); break;
+        case TEXT: genText(rng, n, out); break;
+        case X86: genX86(rng, n, out); break;
+        case RECORDS: genRecords(rng, n, out); break;
+        case LOGS: genLogs(rng, n, out); break;
+        case MIXED: break;
+    }
+    out.resize(n);
+    return out;
+}
+
+}  // namespace corpus
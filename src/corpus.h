@@ -0,0 +1,43 @@
+/**
+ * @file corpus.h
+ * @brief Deterministic synthetic corpus generator for PAQMan benchmarks.
+ *
+ * Each corpus kind exercises one path of libzpaq::compressBlock():
+ *
+ * - random:  incompressible bytes (store path)
+ * - text:    English-like prose (word model, type&1)
+ * - x86:     machine code with E8/E9 call and jump targets (E8E9 filter)
+ * - records: fixed-size binary records (period detection at level 5)
+ * - logs:    highly redundant log lines (BWT)
+ * - mixed:   equal parts of all of the above, one kind after another
+ *
+ * The output depends only on kind, size and seed, so results are
+ * comparable across machines and compilers without external datasets.
+ */
+
+#ifndef PAQMAN_CORPUS_H
+#define PAQMAN_CORPUS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace corpus {
+
+enum Kind { RANDOM, TEXT, X86, RECORDS, LOGS, MIXED };
+
+// Name of kind as accepted by parseKind().
+const char* kindName(Kind kind);
+
+// Sets kind from its name and returns true, or returns false if unknown.
+bool parseKind(const std::string& name, Kind& kind);
+
+// Comma separated list of all kind names, for help and error messages.
+const char* kindList();
+
+// Returns exactly n bytes of the given kind generated from seed.
+std::string generate(Kind kind, size_t n, uint64_t seed = 1);
+
+}  // namespace corpus
+
+#endif  // PAQMAN_CORPUS_H
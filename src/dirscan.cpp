@@ -0,0 +1,282 @@
+/**
+ * @file dirscan.cpp
+ * @brief Parallel directory scan and block planning for `paqman c <dir>`.
+ *
+ * The walkers share a stack of directories still to read; a walker that
+ * finds it empty waits until the others are done too, as they may still
+ * push subdirectories. Every name is stat'ed without following symlinks,
+ * directories too, for the metadata kept of them.
+ *
+ * A file is sniffed as x86 by its ELF or PE signature or its E8/E9 call
+ * offsets, as compressed by a known signature or an incompressible
+ * sample, and as text if nearly all of its bytes are printable or UTF-8.
+ * Its redundancy is how often a byte is the one that last followed the
+ * previous byte, scaled to 0-255, as zpaq estimates it.
+ */
+
+#include "dirscan.h"
+#include "trace.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace dirscan {
+
+namespace {
+
+const uint64_t kMaxBlock = 16 << 20;  // bytes of small files per block
+const uint64_t kMinBlock = 1 << 20;   // smallest block planned for many threads
+const int kJobsPerThread = 4;         // blocks per thread on small trees
+const size_t kSniff = 16 << 10;       // bytes read to guess a file's type
+
+// Order-1 hit rate of p[0..n), 0-255.
+unsigned redundancy(const unsigned char* p, size_t n) {
+    unsigned char next[256] = {};
+    size_t hits = 0;
+    for (size_t i = 1; i < n; ++i) {
+        hits += next[p[i - 1]] == p[i];
+        next[p[i - 1]] = p[i];
+    }
+    return n < 2 ? 0 : unsigned(std::min<size_t>(255, hits * 256 / (n - 1)));
+}
+
+bool startsWith(const unsigned char* p, size_t n, const char* magic, size_t len, size_t at = 0) {
+    return n >= at + len && std::memcmp(p + at, magic, len) == 0;
+}
+
+Type classify(const unsigned char* p, size_t n, unsigned r) {
+    if (startsWith(p, n, "\x7f" "ELF", 4) || startsWith(p, n, "MZ", 2)) return X86;
+    static const char* const packed[] = {"\x1f\x8b", "PK\x03\x04", "\x89PNG", "\xff\xd8\xff", "GIF8", "\xfd" "7zXZ",
+                                         "\x28\xb5\x2f\xfd", "BZh", "7z\xbc\xaf", "7kSt", "zPQ", "OggS", "fLaC"};
+    for (const char* m : packed) {
+        if (startsWith(p, n, m, std::strlen(m))) return COMPRESSED;
+    }
+    if (startsWith(p, n, "ftyp", 4, 4) || (startsWith(p, n, "RIFF", 4) && startsWith(p, n, "WEBP", 4, 8))) {
+        return COMPRESSED;
+    }
+    if (n == 0) return TEXT;
+    size_t text = 0, calls = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const unsigned char c = p[i];
+        text += (c >= 32 && c != 127) || c == '\t' || c == '\n' || c == '\r';
+        if ((c == 0xe8 || c == 0xe9) && i + 4 < n && (p[i + 4] == 0 || p[i + 4] == 0xff)) ++calls;
+    }
+    if (text * 100 >= n * 98) return TEXT;
+    if (calls >= 16 && calls * 500 >= n) return X86;
+    if (r < 8 && n >= 4096) return COMPRESSED;
+    return OTHER;
+}
+
+// The metadata of st, as of a regular file.
+meta::Record record(const struct stat& st) {
+    meta::Record r;
+    r.mode = uint32_t(st.st_mode & 07777);
+    r.uid = st.st_uid;
+    r.gid = st.st_gid;
+    r.mtime = int64_t(st.st_mtim.tv_sec);
+    r.mtimeNsec = uint32_t(st.st_mtim.tv_nsec);
+    return r;
+}
+
+// Reads the start of the file name in directory dir and guesses its type.
+void sniff(int dir, const char* name, Entry& e) {
+    e.type = OTHER;
+    e.redundancy = 128;
+    const int fd = openat(dir, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;  // reported when it is compressed
+    unsigned char buf[kSniff];
+    ssize_t n;
+    do {
+        n = ::pread(fd, buf, sizeof(buf), 0);
+    } while (n < 0 && errno == EINTR);
+    ::close(fd);
+    if (n < 0) return;
+    e.redundancy = redundancy(buf, n);
+    e.type = classify(buf, n, e.redundancy);
+}
+
+struct Walk {
+    std::string root;
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<std::string> dirs;  // relative names still to read
+    int busy = 0;                   // walkers reading a directory
+    std::string error;
+    std::vector<Entry> files;
+
+    // Reads the directory rel (empty for the root) and its names' types.
+    void read(const std::string& rel, std::vector<std::string>& subdirs, std::vector<Entry>& found) {
+        const std::string dir = rel.empty() ? root : root + "/" + rel;
+        const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR* d = fd >= 0 ? fdopendir(fd) : nullptr;
+        if (!d) {
+            const int e = errno;
+            if (fd >= 0) ::close(fd);
+            throw std::runtime_error("Cannot read directory " + dir + ": " + std::strerror(e));
+        }
+        std::vector<std::string> names;  // to stat
+        while (const dirent* e = readdir(d)) {
+            if (std::strcmp(e->d_name, ".") == 0 || std::strcmp(e->d_name, "..") == 0) continue;
+            if (e->d_type == DT_DIR || e->d_type == DT_REG || e->d_type == DT_LNK || e->d_type == DT_UNKNOWN) {
+                names.push_back(e->d_name);
+            }
+        }
+        for (const std::string& n : names) {
+            const std::string name = rel.empty() ? n : rel + "/" + n;
+            struct stat st;
+            if (fstatat(fd, n.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) continue;  // removed meanwhile
+            Entry e{root + "/" + name, name, 0, OTHER, 0, record(st)};
+            if (S_ISREG(st.st_mode)) {
+                e.size = uint64_t(st.st_size);
+                sniff(fd, n.c_str(), e);
+            } else if (S_ISDIR(st.st_mode)) {
+                e.meta.type = meta::DIR;
+                subdirs.push_back(name);
+            } else if (S_ISLNK(st.st_mode)) {
+                e.meta.type = meta::SYMLINK;
+                std::vector<char> target(size_t(st.st_size) + 2);
+                const ssize_t len = readlinkat(fd, n.c_str(), target.data(), target.size());
+                if (len < 0 || size_t(len) == target.size()) continue;  // removed or changed meanwhile
+                e.meta.link.assign(target.data(), size_t(len));
+            } else {
+                continue;  // device, FIFO or socket
+            }
+            found.push_back(std::move(e));
+        }
+        closedir(d);
+    }
+
+    void run() {
+        std::vector<Entry> found;
+        std::unique_lock<std::mutex> lock(m);
+        for (;;) {
+            cv.wait(lock, [&] { return !dirs.empty() || busy == 0 || !error.empty(); });
+            if (dirs.empty() || !error.empty()) break;
+            const std::string rel = dirs.back();
+            dirs.pop_back();
+            ++busy;
+            lock.unlock();
+            std::vector<std::string> subdirs;
+            std::string err;
+            try {
+                read(rel, subdirs, found);
+            } catch (const std::exception& e) {
+                err = e.what();
+            }
+            lock.lock();
+            --busy;
+            if (error.empty()) error = err;
+            dirs.insert(dirs.end(), subdirs.begin(), subdirs.end());
+            cv.notify_all();
+        }
+        files.insert(files.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+    }
+};
+
+// Lowercase extension of the last path component, or "".
+std::string extension(const std::string& name) {
+    const size_t slash = name.rfind('/');
+    const size_t dot = name.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash) || dot == slash + 1) return "";
+    std::string ext = name.substr(dot + 1);
+    for (char& c : ext) c = char(std::tolower((unsigned char)c));
+    return ext;
+}
+
+}  // namespace
+
+const char* typeName(Type t) {
+    const char* names[] = {"text", "x86", "compressed", "other"};
+    return names[t];
+}
+
+std::vector<Entry> walk(const std::string& root, int threads) {
+    trace::Scope stage("scan");
+    Walk w;
+    w.root = root;
+    while (w.root.size() > 1 && w.root.back() == '/') w.root.pop_back();
+    w.dirs.push_back("");
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) pool.emplace_back([&] { w.run(); });
+    w.run();
+    for (std::thread& t : pool) t.join();
+    if (!w.error.empty()) throw std::runtime_error(w.error);
+    return std::move(w.files);
+}
+
+std::vector<Job> plan(std::vector<Entry>& files, int threads) {
+    std::vector<std::pair<std::string, size_t>> keys;
+    std::vector<size_t> others;  // directories and symlinks
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (files[i].meta.type == meta::FILE) keys.push_back({extension(files[i].name), i});
+        else others.push_back(i);
+    }
+    std::sort(keys.begin(), keys.end(), [&](const auto& a, const auto& b) {
+        const Entry &x = files[a.second], &y = files[b.second];
+        if (x.type != y.type) return x.type < y.type;
+        if (a.first != b.first) return a.first < b.first;
+        if (x.size != y.size) return x.size < y.size;
+        return x.name < y.name;
+    });
+    std::vector<Entry> sorted;
+    uint64_t total = 0;
+    for (const auto& k : keys) {
+        total += files[k.second].size;
+        sorted.push_back(std::move(files[k.second]));
+    }
+    std::sort(others.begin(), others.end(), [&](size_t a, size_t b) { return files[a].name < files[b].name; });
+    for (size_t i : others) sorted.push_back(std::move(files[i]));
+    files.swap(sorted);
+
+    const uint64_t target = std::min(kMaxBlock, std::max(kMinBlock, total / (uint64_t(threads) * kJobsPerThread)));
+    std::vector<Job> jobs;
+    Job pack;
+    uint64_t weight = 0;  // sum of redundancy * size in pack
+    auto close = [&] {
+        if (pack.files.empty()) return;
+        pack.redundancy = pack.bytes ? unsigned(weight / pack.bytes) : files[pack.files[0]].redundancy;
+        jobs.push_back(std::move(pack));
+        pack = Job();
+        weight = 0;
+    };
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const Entry& e = files[i];
+        if (e.size >= target) {
+            Job big;
+            big.files.push_back(i);
+            big.bytes = e.size;
+            big.type = e.type;
+            big.redundancy = e.redundancy;
+            jobs.push_back(std::move(big));
+            continue;
+        }
+        if (!pack.files.empty() && (pack.bytes + e.size > target || pack.type != e.type)) close();
+        pack.files.push_back(i);
+        pack.bytes += e.size;
+        pack.type = e.type;
+        weight += uint64_t(e.redundancy) * e.size;
+    }
+    close();
+    std::stable_sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.bytes > b.bytes; });
+    if (!others.empty()) {
+        jobs.emplace_back();
+        for (size_t i = keys.size(); i < files.size(); ++i) jobs.back().files.push_back(i);
+    }
+    return jobs;
+}
+
+std::string method(const Job& job, char level) {
+    const int hint = job.type == TEXT ? 1 : job.type == X86 ? 2 : 0;
+    return std::string(1, level) + "," + std::to_string(job.redundancy) + "," + std::to_string(hint);
+}
+
+}  // namespace dirscan
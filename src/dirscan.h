@@ -0,0 +1,67 @@
+/**
+ * @file dirscan.h
+ * @brief Parallel directory scan and block planning for `paqman c <dir>`.
+ *
+ * walk() lists a tree with several threads: each takes a directory, reads
+ * all its names and then stats them together relative to the directory's
+ * descriptor, keeping each entry's metadata (see meta.h), and sniffs the
+ * first 16 KiB of each file for its content type. plan() sorts the files
+ * by type, extension and size, packs the small ones of one type into
+ * blocks and returns the blocks largest first, so threads taking them in
+ * order finish at about the same time (LPT scheduling), then one block of
+ * the directories and symlinks. method() gives each block libzpaq's type
+ * hint.
+ */
+
+#ifndef PAQMAN_DIRSCAN_H
+#define PAQMAN_DIRSCAN_H
+
+#include "meta.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dirscan {
+
+// Content types, in the order their blocks are planned.
+enum Type { TEXT, X86, COMPRESSED, OTHER };
+
+const char* typeName(Type t);
+
+struct Entry {
+    std::string path;  // to open
+    std::string name;  // relative to the root, with '/'
+    uint64_t size;
+    Type type;
+    unsigned redundancy;  // 0-255, of the sniffed bytes
+    meta::Record meta;    // type FILE, DIR or SYMLINK; no owner names
+};
+
+// Regular files, directories and symlinks below root; symlinks are not
+// followed. Other special files are left out. The order is unspecified.
+// Throws if a directory cannot be read.
+std::vector<Entry> walk(const std::string& root, int threads);
+
+// One block: files are indexes into the sorted list.
+struct Job {
+    std::vector<size_t> files;
+    uint64_t bytes = 0;
+    Type type = OTHER;
+    unsigned redundancy = 0;  // weighted by size
+};
+
+// Sorts files by type, extension, size and name, and groups neighbours of
+// one type into blocks of up to 16 MiB, smaller for small trees so that
+// every thread gets some. A file at least that large is a block of its
+// own. Returns the blocks largest first, then a block without data of the
+// directories and symlinks sorted by name, if there are any.
+std::vector<Job> plan(std::vector<Entry>& files, int threads);
+
+// The "L,R,t" method for a block of job at level L (a digit), with the
+// redundancy R and the type t (1 text, 2 x86) that libzpaq::expandMethod()
+// uses to pick word models, E8E9 and whether to store.
+std::string method(const Job& job, char level);
+
+}  // namespace dirscan
+
+#endif  // PAQMAN_DIRSCAN_H
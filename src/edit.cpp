@@ -0,0 +1,195 @@
+/**
+ * @file edit.cpp
+ * @brief Archive edit commands for PAQMan (`paqman merge`, `delete`, `subset`).
+ *
+ * A partially kept block is coded again with the COMP, HCOMP and PCOMP of
+ * the original block. The kept segments are coded as the data the model
+ * was built for, as they were before postprocessing: the LZ77 codes or
+ * E8E9 output that compressSegments() makes of each segment on its own
+ * for directory and tar blocks. So re-encoding does not need the block's
+ * method, and the block shrinks by about the segments dropped.
+ */
+
+#include "edit.h"
+#include "archive.h"
+#include "libzpaq.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Discards decoded data.
+class NullWriter : public libzpaq::Writer {
+public:
+    void put(int) override {}
+    void write(const char*, int) override {}
+};
+
+// Decodes block b of path and returns a new block with only the segments
+// for which keep[i] is true, coded with the same model and postprocessor.
+std::string reencode(const std::string& path, const archive::Block& b, const std::vector<bool>& keep) {
+    const std::string bytes = archive::readRange(path, b.start, b.end);
+    libzpaq::StringBuffer raw, hcomp;
+    raw.write(bytes.data(), static_cast<int>(bytes.size()));
+    libzpaq::Decompresser d;
+    d.setInput(&raw);
+    if (!d.findBlock()) throw std::runtime_error("Block vanished from " + path);
+    d.hcomp(&hcomp);
+
+    libzpaq::StringBuffer out;
+    libzpaq::Compressor c;
+    c.setOutput(&out);
+    c.writeTag();
+    c.startBlock(hcomp.c_str());
+
+    NullWriter discard;
+    libzpaq::SHA1 sha1;
+    d.setSHA1(&sha1);
+    bool first = true;
+    for (size_t i = 0; i < keep.size(); ++i) {
+        libzpaq::StringBuffer name, comment, data;
+        if (!d.findFilename(&name)) throw std::runtime_error("Segment vanished from " + path);
+        d.readComment(&comment);
+        d.setOutput(&discard);
+        d.decompress(-1, keep[i] ? &data : nullptr);
+        char stored[21];
+        d.readSegmentEnd(stored);
+        if (stored[0] && std::memcmp(stored + 1, sha1.result(), 20) != 0) {
+            throw std::runtime_error("Checksum error in block at offset " + std::to_string(b.start) + " of " + path);
+        }
+        if (!keep[i]) continue;
+        const std::string filename(name.c_str(), name.size()), text(comment.c_str(), comment.size());
+        c.startSegment(filename.c_str(), text.c_str());
+        if (first) {  // the PCOMP goes at the start of the first segment
+            libzpaq::StringBuffer pcomp;
+            if (d.pcomp(&pcomp)) c.postProcess(pcomp.c_str());
+            first = false;
+        }
+        c.setInput(&data);
+        c.compress();
+        c.endSegment(stored[0] ? stored + 1 : nullptr);
+    }
+    c.endBlock();
+    return std::string(out.c_str(), out.size());
+}
+
+struct Counts {
+    int copied = 0, reencoded = 0, dropped = 0;
+    std::vector<bool> matched;  // per name
+};
+
+// Writes the blocks of path to out, keeping the segments of files that
+// are selected by names (or not selected if exclude).
+Counts filter(const std::string& path, std::ofstream& out, const std::vector<std::string>& names, bool exclude) {
+    Counts n;
+    n.matched.assign(names.size(), false);
+    for (const archive::Block& b : archive::scan(path)) {
+        std::vector<bool> keep;
+        int kept = 0;
+        for (const archive::Segment& s : b.segments) {
+            for (size_t i = 0; i < names.size(); ++i) {
+                if (archive::selected(s.file, {names[i]})) n.matched[i] = true;
+            }
+            keep.push_back(archive::selected(s.file, names) != exclude);
+            kept += keep.back();
+        }
+        if (kept == int(keep.size())) {
+            out << archive::readRange(path, b.start, b.end);
+            ++n.copied;
+        } else if (kept == 0) {
+            ++n.dropped;
+        } else {
+            out << reencode(path, b, keep);
+            ++n.reencoded;
+        }
+    }
+    return n;
+}
+
+void report(const Counts& n, const std::vector<std::string>& names) {
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (!n.matched[i]) std::cerr << "\33[31mWarning: \33[0m" << names[i] << " is not in the archive\n";
+    }
+    std::cout << n.copied << " blocks copied, " << n.reencoded << " re-encoded, " << n.dropped << " dropped\n";
+}
+
+void checkDistinct(const std::string& a, const std::string& b) {
+    if (fs::exists(b) && fs::equivalent(a, b)) throw std::runtime_error("Output would overwrite input " + a);
+}
+
+}  // namespace
+
+int runMerge(int argc, char** argv) {
+    if (argc < 2) throw std::runtime_error("Usage: paqman merge <output> <archive...>");
+    const std::string output = argv[0];
+    for (int i = 1; i < argc; ++i) checkDistinct(argv[i], output);
+
+    std::ofstream out(output, std::ios::binary | std::ios::trunc);
+    if (!out) throw std::runtime_error("Cannot open output file: " + output);
+    int blocks = 0;
+    for (int i = 1; i < argc; ++i) {
+        for (const archive::Block& b : archive::scan(argv[i])) {
+            out << archive::readRange(argv[i], b.start, b.end);
+            ++blocks;
+        }
+    }
+    out.flush();
+    if (!out) throw std::runtime_error("Cannot write " + output);
+    std::cout << "Merged " << argc - 1 << " archives, " << blocks << " blocks copied into " << output << "\n";
+    return 0;
+}
+
+int runDelete(int argc, char** argv) {
+    if (argc < 2) throw std::runtime_error("Usage: paqman delete <archive> <file...>");
+    const std::string path = argv[0];
+    const std::vector<std::string> names(argv + 1, argv + argc);
+    const archive::Snapshot before = archive::snapshot(path);
+
+    const std::string tmp = path + ".delete.tmp";
+    Counts n;
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("Cannot open output file: " + tmp);
+        n = filter(path, out, names, true);
+        out.flush();
+        if (!out) throw std::runtime_error("Cannot write " + tmp);
+    }
+    if (n.copied + n.reencoded == 0) {
+        fs::remove(tmp);
+        throw std::runtime_error("Deleting every file would leave an empty archive: " + path);
+    }
+    // Dropping segments must never cost space; if a re-encoded block came
+    // out larger, keep the archive as it was.
+    if (fs::file_size(tmp) > before.size) {
+        fs::remove(tmp);
+        throw std::runtime_error("Deleting would grow the archive, left unchanged: " + path);
+    }
+    archive::replace(tmp, path, before);
+    report(n, names);
+    return 0;
+}
+
+int runSubset(int argc, char** argv) {
+    if (argc < 3) throw std::runtime_error("Usage: paqman subset <archive> <output> <file...>");
+    const std::string path = argv[0], output = argv[1];
+    const std::vector<std::string> names(argv + 2, argv + argc);
+    checkDistinct(path, output);
+
+    Counts n;
+    {
+        std::ofstream out(output, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("Cannot open output file: " + output);
+        n = filter(path, out, names, false);
+        out.flush();
+        if (!out) throw std::runtime_error("Cannot write " + output);
+    }
+    report(n, names);
+    return 0;
+}
@@ -0,0 +1,28 @@
+/**
+ * @file edit.h
+ * @brief Archive edit commands for PAQMan (`paqman merge`, `delete`, `subset`).
+ *
+ * The commands work on whole blocks found by archive::scan(). A block
+ * whose segments are all kept is copied byte for byte and one whose
+ * segments are all removed is skipped, so edits of archives written one
+ * file per block are I/O-bound. Only a block that keeps some of its
+ * segments (a directory block, see compressDirectory()) is decoded and
+ * coded again with its own model.
+ */
+
+#ifndef PAQMAN_EDIT_H
+#define PAQMAN_EDIT_H
+
+// Entry point for `paqman merge <output> <archive...>`: concatenates the
+// blocks of the archives. argv[0] is the first argument after "merge".
+int runMerge(int argc, char** argv);
+
+// Entry point for `paqman delete <archive> <file...>`: removes files (or
+// all files below a directory) from the archive in place.
+int runDelete(int argc, char** argv);
+
+// Entry point for `paqman subset <archive> <output> <file...>`: writes a
+// new archive with only the given files or directories.
+int runSubset(int argc, char** argv);
+
+#endif  // PAQMAN_EDIT_H
@@ -0,0 +1,802 @@
+/**
+ * @file extract.cpp
+ * @brief Asynchronous extraction writer for PAQMan (`paqman d`).
+ *
+ * The decoding thread appends chunks to the current File under a mutex;
+ * the writer threads take whole Files from a queue and write their chunks
+ * at the chunk's offset, so chunks of one file may complete in any order.
+ * Each File has at most one owner at a time, which keeps its descriptor.
+ *
+ * Chunks end at multiples of 1 MiB in the file. Before a chunk is
+ * queued, aligned runs of 64 KiB or more zero bytes are cut out of it:
+ * they are not written, and where the file was preallocated they become
+ * HOLE pieces that punch the space out again. The runs that
+ * sparse::Reader skipped when compressing (see holes()) are not in the
+ * data at all: the offset just moves past them, with a HOLE piece where
+ * the file was preallocated. A file that ends in a hole, or was
+ * preallocated for more than it got, is truncated to its size.
+ */
+
+#include "extract.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace extract {
+
+namespace {
+
+const size_t kChunk = 1 << 20;             // bytes queued per write, and alignment
+const size_t kBlock = 4096;                // granularity of zero run detection
+const size_t kMinHole = 64 << 10;          // shortest zero run left as a hole
+const uint64_t kMinPreallocate = 1 << 20;  // smallest expect() that is preallocated
+const size_t kMaxBuffered = 64u << 20;     // queued bytes before the decoder waits
+const unsigned kRingEntries = 256;         // submission queue size
+const size_t kMaxOpenFiles = 64;           // files in progress in the uring backend
+const int kOpenFlags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW;
+
+struct Chunk {
+    enum Kind { DATA, ALLOCATE, HOLE } kind = DATA;
+    uint64_t offset = 0;
+    uint64_t length = 0;  // of ALLOCATE and HOLE
+    std::string data;     // of DATA
+};
+
+struct File {
+    std::string dir, name;  // name below dir
+    std::string path;
+    std::deque<Chunk> chunks;  // not yet taken by the writer, guarded by Impl::m
+    bool ended = false;        // no more chunks will come, guarded by Impl::m
+    uint64_t size = 0;         // final size, set with ended
+    bool truncate = false;     // to size before closing, set with ended
+    bool restore = false;      // attrs before closing, set with ended
+    bool discard = false;      // remove after closing, set with ended
+    meta::Record attrs;
+
+    // Owned by the writer
+    int fd = -1;
+    bool failed = false;
+    bool opening = false, closing = false, done = false;
+    int writes = 0;  // in flight
+};
+typedef std::shared_ptr<File> FilePtr;
+
+std::string errorText(const char* what, const std::string& path, int err) {
+    return std::string("Cannot ") + what + " " + path + ": " + std::strerror(err);
+}
+
+// Writes n bytes at offset. Returns 0 or an errno value.
+int writeAll(int fd, const char* p, size_t n, uint64_t offset) {
+    while (n > 0) {
+        ssize_t r = ::pwrite(fd, p, n, offset);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return errno;
+        if (r == 0) return ENOSPC;
+        p += r;
+        n -= r;
+        offset += r;
+    }
+    return 0;
+}
+
+// Preallocates or punches out the range of an ALLOCATE or HOLE chunk.
+// Returns 0 or an errno value; file systems that cannot do it are ignored,
+// as the range then reads as zeros anyway.
+int allocate(int fd, const Chunk& c) {
+#ifdef __linux__
+    const int mode = c.kind == Chunk::HOLE ? FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE : 0;
+    if (fallocate(fd, mode, c.offset, c.length) != 0 && errno != EOPNOTSUPP && errno != ENOSYS) return errno;
+#endif
+    return 0;
+}
+
+// Applies c to fd. Returns 0 or an errno value.
+int apply(int fd, const Chunk& c) {
+    if (c.kind == Chunk::DATA) return writeAll(fd, c.data.data(), c.data.size(), c.offset);
+    return allocate(fd, c);
+}
+
+// Whether owners are restored.
+bool asRoot() {
+    static const bool root = ::geteuid() == 0;
+    return root;
+}
+
+// Sets the owner, mode and modification time of r on fd. Returns 0 or an
+// errno value. The owner goes first, as it clears the setuid and setgid
+// bits, and the time last.
+int setAttributes(int fd, const meta::Record& r) {
+    if (asRoot() && ::fchown(fd, uid_t(r.uid), gid_t(r.gid)) != 0 && errno != EPERM && errno != EINVAL) return errno;
+    if (::fchmod(fd, mode_t(r.mode)) != 0) return errno;
+    const timespec times[2] = {{0, UTIME_OMIT}, {time_t(r.mtime), long(r.mtimeNsec)}};
+    if (::futimens(fd, times) != 0) return errno;
+    return 0;
+}
+
+bool isZero(const char* p) {
+    static const char zeros[kBlock] = {};
+    return std::memcmp(p, zeros, kBlock) == 0;
+}
+
+#ifdef __linux__
+
+// A minimal io_uring set up with raw syscalls. Not thread safe; entries
+// are only read by the kernel in submit(), as there is no SQ polling.
+class Ring {
+    int fd = -1;
+    void* sqMap = MAP_FAILED;
+    void* cqMap = MAP_FAILED;
+    void* sqeMap = MAP_FAILED;
+    size_t sqSize = 0, cqSize = 0, sqeSize = 0;
+    unsigned *sqHead = nullptr, *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+    unsigned *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+public:
+    unsigned entries = 0;
+
+    ~Ring() {
+        if (sqeMap != MAP_FAILED) munmap(sqeMap, sqeSize);
+        if (cqMap != MAP_FAILED && cqMap != sqMap) munmap(cqMap, cqSize);
+        if (sqMap != MAP_FAILED) munmap(sqMap, sqSize);
+        if (fd >= 0) ::close(fd);
+    }
+
+    // Returns false and sets why if io_uring or its openat, write, fallocate
+    // and close operations (Linux 5.6) are unavailable.
+    bool init(unsigned n, std::string& why) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd = int(syscall(__NR_io_uring_setup, n, &p));
+        if (fd < 0) {
+            why = std::strerror(errno);
+            return false;
+        }
+        sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sqSize = cqSize = std::max(sqSize, cqSize);
+        const int prot = PROT_READ | PROT_WRITE, flags = MAP_SHARED | MAP_POPULATE;
+        sqMap = mmap(nullptr, sqSize, prot, flags, fd, IORING_OFF_SQ_RING);
+        cqMap = single ? sqMap : mmap(nullptr, cqSize, prot, flags, fd, IORING_OFF_CQ_RING);
+        sqeSize = p.sq_entries * sizeof(io_uring_sqe);
+        sqeMap = mmap(nullptr, sqeSize, prot, flags, fd, IORING_OFF_SQES);
+        if (sqMap == MAP_FAILED || cqMap == MAP_FAILED || sqeMap == MAP_FAILED) {
+            why = std::strerror(errno);
+            return false;
+        }
+        char* sq = static_cast<char*>(sqMap);
+        char* cq = static_cast<char*>(cqMap);
+        sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        sqes = static_cast<io_uring_sqe*>(sqeMap);
+        entries = p.sq_entries;
+
+        std::vector<char> buf(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buf.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+            why = std::strerror(errno);
+            return false;
+        }
+        for (int op : {IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_FALLOCATE, IORING_OP_CLOSE}) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                why = "kernel lacks openat, write, fallocate or close operations";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Returns a zeroed entry to fill in, or nullptr if the queue is full.
+    io_uring_sqe* next() {
+        const unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= entries) return nullptr;
+        const unsigned i = tail & *sqMask;
+        sqArray[i] = i;
+        std::memset(&sqes[i], 0, sizeof(io_uring_sqe));
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        return &sqes[i];
+    }
+
+    // Submits the new entries and waits for at least wait completions.
+    // Returns 0 or an errno value.
+    int submit(unsigned wait) {
+        for (;;) {
+            const unsigned pending = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+            if (syscall(__NR_io_uring_enter, fd, pending, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0) >= 0) {
+                return 0;
+            }
+            if (errno != EINTR) return errno;
+        }
+    }
+
+    // Calls f(user_data, res) for every completion.
+    template <typename F>
+    void reap(F f) {
+        unsigned head = *cqHead;
+        const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& c = cqes[head & *cqMask];
+            f(c.user_data, c.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+#endif  // __linux__
+
+}  // namespace
+
+struct Sink::Impl {
+    Backend backend = SYNC;
+    std::string note;  // why uring is not used
+
+    std::mutex m;
+    std::condition_variable cv;  // queue, chunks, ended, stopping or buffered changed
+    std::deque<FilePtr> queue;   // files not yet taken by a writer
+    size_t buffered = 0;         // bytes in chunks not yet written
+    bool stopping = false;
+    std::string error;           // first error
+    std::vector<std::thread> threads;
+
+    // Decoder side
+    FilePtr current;
+    uint64_t offset = 0;     // of chunk in current
+    std::string chunk;
+    uint64_t allocated = 0;  // end of the preallocated range of current
+    uint64_t dataEnd = 0;    // end of the last DATA piece of current
+    std::deque<sparse::Run> runs;  // of the current segment, not yet reached
+    uint64_t segPos = 0;           // data bytes of the current segment so far
+    bool restore = false;          // attrs of current were given
+    bool discard = false;          // current is to be removed
+    meta::Record attrs;
+
+    std::mutex dirMutex;
+    std::unordered_set<std::string> dirs;  // created or existing
+
+#ifdef __linux__
+    Ring ring;
+#endif
+
+    // Sets error if it is the first one. m must be held.
+    void fail(const std::string& what) {
+        if (error.empty()) error = what;
+        cv.notify_all();
+    }
+
+    // Creates the parent directories of f below its dir unless done before,
+    // and removes a symlink in the place of f. Throws.
+    void makeParent(const File& f) {
+        const size_t slash = f.name.rfind('/');
+        if (slash != std::string::npos) {
+            const std::string parent = f.dir + "/" + f.name.substr(0, slash);
+            std::lock_guard<std::mutex> lock(dirMutex);
+            if (!dirs.count(parent)) {
+                makeDirectories(f.dir, f.name.substr(0, slash));
+                dirs.insert(parent);
+            }
+        }
+        struct stat st;
+        if (::lstat(f.path.c_str(), &st) == 0 && S_ISLNK(st.st_mode) && ::unlink(f.path.c_str()) != 0) {
+            throw std::runtime_error(errorText("remove", f.path, errno));
+        }
+    }
+
+    // Opens f for the sync backend if not done yet. Throws.
+    void openSync(File& f) {
+        if (f.fd >= 0) return;
+        makeParent(f);
+        trace::Scope stage("write");
+        f.fd = ::open(f.path.c_str(), kOpenFlags, 0666);
+        if (f.fd < 0) throw std::runtime_error(errorText("open", f.path, errno));
+    }
+
+    // Hands c to the writer, waiting while too much is queued.
+    void push(Chunk&& c) {
+        if (backend == SYNC) {
+            openSync(*current);
+            trace::Scope stage("write");
+            if (int e = apply(current->fd, c)) throw std::runtime_error(errorText("write", current->path, e));
+            return;
+        }
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] { return buffered < kMaxBuffered || !error.empty(); });
+        buffered += c.data.size();
+        current->chunks.push_back(std::move(c));
+        cv.notify_all();
+    }
+
+    // Pushes data [begin, end) of the chunk at offset, and a HOLE for [end, hole).
+    void queuePiece(std::string& data, size_t begin, size_t end, size_t hole) {
+        if (end > begin) {
+            Chunk c;
+            c.offset = offset + begin;
+            if (begin == 0 && end == data.size()) c.data.swap(data);
+            else c.data.assign(data, begin, end - begin);
+            dataEnd = c.offset + (end - begin);
+            push(std::move(c));
+        }
+        if (hole > end && offset + end < allocated) {
+            Chunk c;
+            c.kind = Chunk::HOLE;
+            c.offset = offset + end;
+            c.length = std::min<uint64_t>(offset + hole, allocated) - c.offset;
+            push(std::move(c));
+        }
+    }
+
+    // Pushes chunk without its runs of kMinHole or more zero bytes.
+    void flushChunk() {
+        if (chunk.empty()) return;
+        std::string data;
+        data.swap(chunk);
+        const size_t n = data.size();
+        size_t begin = 0;  // of the data not queued yet
+        for (size_t i = (kBlock - offset % kBlock) % kBlock; i + kBlock <= data.size();) {
+            size_t j = i;
+            while (j + kBlock <= data.size() && isZero(&data[j])) j += kBlock;
+            if (j - i >= kMinHole) {
+                queuePiece(data, begin, i, j);
+                begin = j;
+            }
+            i = j + kBlock;
+        }
+        queuePiece(data, begin, n, n);
+        offset += n;
+    }
+
+    // Leaves length bytes at the end of current as a hole.
+    void skip(uint64_t length) {
+        flushChunk();
+        if (offset < allocated) {
+            Chunk c;
+            c.kind = Chunk::HOLE;
+            c.offset = offset;
+            c.length = std::min(offset + length, allocated) - offset;
+            push(std::move(c));
+        }
+        offset += length;
+    }
+
+    // Skips the runs that start at segPos, or all of them.
+    void skipRuns(bool all) {
+        for (; !runs.empty() && (all || runs.front().pos <= segPos); runs.pop_front()) skip(runs.front().length);
+    }
+
+    // Ends the current file, if any.
+    void endFile() {
+        if (!current) return;
+        skipRuns(true);
+        flushChunk();
+        const bool truncate = std::max(allocated, dataEnd) != offset;
+        if (backend == SYNC) {
+            openSync(*current);
+            trace::Scope stage("write");
+            if (truncate && ::ftruncate(current->fd, offset) != 0) {
+                throw std::runtime_error(errorText("truncate", current->path, errno));
+            }
+            if (restore) {
+                if (int e = setAttributes(current->fd, attrs)) {
+                    throw std::runtime_error(errorText("set attributes of", current->path, e));
+                }
+            }
+            if (::close(current->fd) != 0) throw std::runtime_error(errorText("close", current->path, errno));
+            if (discard) ::unlink(current->path.c_str());
+        } else {
+            std::lock_guard<std::mutex> lock(m);
+            current->ended = true;
+            current->size = offset;
+            current->truncate = truncate;
+            current->restore = restore;
+            current->attrs = attrs;
+            current->discard = discard;
+            cv.notify_all();
+        }
+        current.reset();
+        offset = allocated = dataEnd = segPos = 0;
+        restore = discard = false;
+    }
+
+    void runThreads();
+    void runUring();
+};
+
+// Writer thread of the threads backend: writes one file at a time.
+void Sink::Impl::runThreads() {
+    for (;;) {
+        FilePtr f;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&] { return !queue.empty() || stopping; });
+            if (queue.empty()) return;
+            f = queue.front();
+            queue.pop_front();
+        }
+        std::string err;
+        try {
+            makeParent(*f);
+            trace::Scope stage("write");
+            f->fd = ::open(f->path.c_str(), kOpenFlags, 0666);
+            if (f->fd < 0) err = errorText("open", f->path, errno);
+        } catch (const std::exception& e) {
+            err = e.what();
+        }
+        for (;;) {
+            Chunk c;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return !f->chunks.empty() || f->ended; });
+                if (f->chunks.empty()) break;
+                c = std::move(f->chunks.front());
+                f->chunks.pop_front();
+            }
+            if (err.empty()) {
+                trace::Scope stage("write");
+                if (int e = apply(f->fd, c)) err = errorText("write", f->path, e);
+            }
+            std::lock_guard<std::mutex> lock(m);
+            buffered -= c.data.size();
+            cv.notify_all();
+        }
+        if (err.empty() && f->truncate && ::ftruncate(f->fd, f->size) != 0) err = errorText("truncate", f->path, errno);
+        if (err.empty() && f->restore) {
+            if (int e = setAttributes(f->fd, f->attrs)) err = errorText("set attributes of", f->path, e);
+        }
+        if (f->fd >= 0 && ::close(f->fd) != 0 && err.empty()) err = errorText("close", f->path, errno);
+        if (f->discard) ::unlink(f->path.c_str());
+        if (!err.empty()) {
+            std::lock_guard<std::mutex> lock(m);
+            fail(err);
+        }
+    }
+}
+
+#ifdef __linux__
+
+namespace {
+
+// One submitted operation; its address is the user_data of the entry.
+struct Op {
+    FilePtr file;
+    int opcode;
+    Chunk chunk;      // IORING_OP_WRITE, IORING_OP_FALLOCATE
+    size_t done = 0;  // bytes of chunk written
+};
+
+}  // namespace
+
+// Writer thread of the uring backend: opens up to kMaxOpenFiles files at
+// once, submits all their queued chunks, and closes each file after its
+// last write completed.
+void Sink::Impl::runUring() {
+    std::vector<FilePtr> active;
+    std::deque<Op*> ready;  // to submit
+    unsigned inflight = 0;
+    size_t released = 0;    // bytes written since the last lock
+    std::string err;        // first error since the last lock
+    bool broken = false;    // the ring failed, discard everything
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m);
+            buffered -= released;
+            released = 0;
+            if (!err.empty()) fail(err);
+            err.clear();
+            cv.notify_all();
+            for (;;) {
+                while (active.size() < kMaxOpenFiles && !queue.empty()) {
+                    FilePtr f = queue.front();
+                    queue.pop_front();
+                    f->opening = !broken;
+                    f->failed = broken;
+                    if (!broken) ready.push_back(new Op{f, IORING_OP_OPENAT, Chunk()});
+                    active.push_back(f);
+                }
+                for (const FilePtr& f : active) {
+                    if (f->opening || f->closing) continue;
+                    for (; !f->chunks.empty(); f->chunks.pop_front()) {
+                        if (f->failed) {
+                            buffered -= f->chunks.front().data.size();
+                            cv.notify_all();
+                            continue;
+                        }
+                        Chunk& c = f->chunks.front();
+                        if (c.kind == Chunk::ALLOCATE) {
+                            // Before the writes into the range, and cheap
+                            if (int e = allocate(f->fd, c)) {
+                                if (err.empty()) err = errorText("allocate", f->path, e);
+                                f->failed = true;
+                            }
+                            continue;
+                        }
+                        const int opcode = c.kind == Chunk::DATA ? IORING_OP_WRITE : IORING_OP_FALLOCATE;
+                        ready.push_back(new Op{f, opcode, std::move(c)});
+                        ++f->writes;
+                    }
+                    if (f->ended && f->writes == 0) {
+                        f->closing = true;
+                        if (f->fd >= 0 && !f->failed && f->truncate && ::ftruncate(f->fd, f->size) != 0) {
+                            if (err.empty()) err = errorText("truncate", f->path, errno);
+                        }
+                        if (f->fd >= 0 && !f->failed && f->restore) {
+                            if (int e = setAttributes(f->fd, f->attrs)) {
+                                if (err.empty()) err = errorText("set attributes of", f->path, e);
+                            }
+                        }
+                        if (f->fd >= 0) ready.push_back(new Op{f, IORING_OP_CLOSE, Chunk()});
+                        else f->done = true;
+                    }
+                }
+                active.erase(std::remove_if(active.begin(), active.end(), [](const FilePtr& f) { return f->done; }),
+                             active.end());
+                if (!ready.empty() || inflight > 0) break;
+                if (stopping && queue.empty() && active.empty()) return;
+                cv.wait(lock);
+            }
+        }
+
+        // Submit what fits, then wait for at least one completion
+        while (!ready.empty() && inflight < ring.entries) {
+            Op* op = ready.front();
+            File& f = *op->file;
+            if (op->opcode == IORING_OP_OPENAT) {
+                try {
+                    makeParent(f);
+                } catch (const std::exception& e) {
+                    if (err.empty()) err = e.what();
+                    f.failed = true;
+                    f.opening = false;
+                    ready.pop_front();
+                    delete op;
+                    continue;
+                }
+            }
+            io_uring_sqe* e = ring.next();
+            if (!e) break;
+            ready.pop_front();
+            ++inflight;
+            e->opcode = op->opcode;
+            e->user_data = reinterpret_cast<uint64_t>(op);
+            e->fd = f.fd;
+            if (op->opcode == IORING_OP_OPENAT) {
+                e->fd = AT_FDCWD;
+                e->addr = reinterpret_cast<uint64_t>(f.path.c_str());
+                e->len = 0666;
+                e->open_flags = kOpenFlags;
+            } else if (op->opcode == IORING_OP_WRITE) {
+                e->addr = reinterpret_cast<uint64_t>(op->chunk.data.data() + op->done);
+                e->len = unsigned(op->chunk.data.size() - op->done);
+                e->off = op->chunk.offset + op->done;
+            } else if (op->opcode == IORING_OP_FALLOCATE) {
+                e->off = op->chunk.offset;
+                e->addr = op->chunk.length;
+                e->len = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+            }
+        }
+        if (int e = ring.submit(inflight > 0 ? 1 : 0)) {
+            // Entries in flight are abandoned with their buffers
+            if (err.empty()) err = std::string("io_uring: ") + std::strerror(e);
+            broken = true;
+            inflight = 0;
+            for (Op* op : ready) {
+                if (op->opcode == IORING_OP_WRITE) released += op->chunk.data.size();
+                delete op;
+            }
+            ready.clear();
+            for (const FilePtr& f : active) {
+                f->failed = true;
+                f->opening = false;
+                f->writes = 0;
+                f->fd = -1;
+                if (f->closing) f->done = true;
+            }
+            continue;
+        }
+
+        trace::Scope stage("write");
+        ring.reap([&](uint64_t data, int res) {
+            Op* op = reinterpret_cast<Op*>(data);
+            File& f = *op->file;
+            --inflight;
+            if (op->opcode == IORING_OP_OPENAT) {
+                f.opening = false;
+                if (res < 0) {
+                    if (err.empty()) err = errorText("open", f.path, -res);
+                    f.failed = true;
+                } else {
+                    f.fd = res;
+                }
+            } else if (op->opcode == IORING_OP_WRITE) {
+                if (res > 0) {
+                    op->done += res;
+                } else if (res != -EINTR && res != -EAGAIN) {
+                    if (err.empty()) err = errorText("write", f.path, res < 0 ? -res : ENOSPC);
+                    f.failed = true;
+                }
+                if (!f.failed && op->done < op->chunk.data.size()) {
+                    ready.push_front(op);  // short write, submit the rest
+                    return;
+                }
+                --f.writes;
+                released += op->chunk.data.size();
+            } else if (op->opcode == IORING_OP_FALLOCATE) {
+                if (res < 0 && res != -EOPNOTSUPP && err.empty()) err = errorText("punch hole in", f.path, -res);
+                --f.writes;
+            } else {
+                if (res < 0 && err.empty()) err = errorText("close", f.path, -res);
+                if (f.discard) ::unlink(f.path.c_str());
+                f.done = true;
+            }
+            delete op;
+        });
+    }
+}
+
+#endif  // __linux__
+
+bool parseBackend(const std::string& name, Backend& b) {
+    if (name == "auto") b = AUTO;
+    else if (name == "uring") b = URING;
+    else if (name == "threads") b = THREADS;
+    else if (name == "sync") b = SYNC;
+    else return false;
+    return true;
+}
+
+Sink::Sink(Backend backend, int nthreads) : impl(new Impl) {
+    impl->backend = backend;
+    if (backend == AUTO || backend == URING) {
+        std::string why = "not Linux";
+#ifdef __linux__
+        if (impl->ring.init(kRingEntries, why)) {
+            impl->backend = URING;
+            impl->threads.emplace_back([this] { impl->runUring(); });
+            return;
+        }
+#endif
+        if (backend == URING) throw std::runtime_error("io_uring unavailable: " + why);
+        impl->backend = THREADS;
+        impl->note = "uring: " + why;
+    }
+    if (impl->backend == THREADS) {
+        for (int i = 0; i < std::max(nthreads, 1); ++i) impl->threads.emplace_back([this] { impl->runThreads(); });
+    }
+}
+
+Sink::~Sink() {
+    try {
+        finish();
+    } catch (const std::exception&) {
+    }
+}
+
+void Sink::open(const std::string& dir, const std::string& name) {
+    if (!meta::isBelow(name)) throw std::runtime_error("Unsafe file name: " + name);
+    impl->endFile();
+    impl->current = std::make_shared<File>();
+    impl->current->dir = dir;
+    impl->current->name = name;
+    impl->current->path = dir + "/" + name;
+    if (impl->backend == SYNC) return;
+    std::lock_guard<std::mutex> lock(impl->m);
+    impl->queue.push_back(impl->current);
+    impl->cv.notify_all();
+}
+
+void Sink::holes(const std::vector<sparse::Run>& runs) {
+    if (!impl->current) throw std::runtime_error("Extraction data before the first file");
+    impl->skipRuns(true);
+    impl->runs.assign(runs.begin(), runs.end());
+    impl->segPos = 0;
+}
+
+void Sink::attributes(const meta::Record& r) {
+    if (!impl->current) throw std::runtime_error("Extraction data before the first file");
+    impl->restore = true;
+    impl->attrs = r;
+}
+
+void Sink::discard() {
+    if (impl->current) impl->discard = true;
+}
+
+void Sink::put(int c) {
+    const char ch = char(c);
+    write(&ch, 1);
+}
+
+void Sink::write(const char* buf, int n) {
+    if (!impl->current) throw std::runtime_error("Extraction data before the first file");
+    while (n > 0) {
+        impl->skipRuns(false);
+        const uint64_t end = impl->offset + impl->chunk.size();
+        uint64_t room = kChunk - end % kChunk;
+        if (!impl->runs.empty()) room = std::min(room, impl->runs.front().pos - impl->segPos);
+        const int len = int(std::min<uint64_t>(n, room));
+        impl->chunk.append(buf, len);
+        impl->segPos += len;
+        if ((end + len) % kChunk == 0) impl->flushChunk();
+        buf += len;
+        n -= len;
+    }
+}
+
+void Sink::expect(uint64_t bytes) {
+    if (!impl->current || bytes < kMinPreallocate) return;
+    const uint64_t pos = impl->offset + impl->chunk.size();
+    if (pos + bytes <= impl->allocated) return;
+    Chunk c;
+    c.kind = Chunk::ALLOCATE;
+    c.offset = std::max(pos, impl->allocated);
+    c.length = pos + bytes - c.offset;
+    impl->allocated = pos + bytes;
+    impl->push(std::move(c));
+}
+
+void Sink::finish() {
+    impl->endFile();
+    {
+        std::lock_guard<std::mutex> lock(impl->m);
+        impl->stopping = true;
+        impl->cv.notify_all();
+    }
+    for (std::thread& t : impl->threads) t.join();
+    impl->threads.clear();
+    if (!impl->error.empty()) throw std::runtime_error(impl->error);
+}
+
+void makeDirectories(const std::string& dir, const std::string& name) {
+    for (size_t end = 0; end != std::string::npos;) {
+        end = name.find('/', end + 1);
+        const std::string path = dir + "/" + name.substr(0, end);
+        if (::mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+            throw std::runtime_error(errorText("create directory", path, errno));
+        }
+        struct stat st;
+        if (::lstat(path.c_str(), &st) != 0) throw std::runtime_error(errorText("create directory", path, errno));
+        if (!S_ISDIR(st.st_mode)) throw std::runtime_error("Cannot create directory " + path + ": not a directory");
+    }
+}
+
+int setAttributes(const std::string& path, const meta::Record& r) {
+    const char* p = path.c_str();
+    if (asRoot() && ::lchown(p, uid_t(r.uid), gid_t(r.gid)) != 0 && errno != EPERM && errno != EINVAL) return errno;
+    if (r.type != meta::SYMLINK && ::chmod(p, mode_t(r.mode)) != 0) return errno;
+    const timespec times[2] = {{0, UTIME_OMIT}, {time_t(r.mtime), long(r.mtimeNsec)}};
+    if (::utimensat(AT_FDCWD, p, times, AT_SYMLINK_NOFOLLOW) != 0) return errno;
+    return 0;
+}
+
+std::string Sink::describe() const {
+    const char* names[] = {"auto", "uring", "threads", "sync"};
+    std::string s = names[impl->backend];
+    if (impl->backend == THREADS) s += " x" + std::to_string(impl->threads.size());
+    if (!impl->note.empty()) s += " (" + impl->note + ")";
+    return s;
+}
+
+}  // namespace extract
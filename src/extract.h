@@ -0,0 +1,113 @@
+/**
+ * @file extract.h
+ * @brief Asynchronous extraction writer for PAQMan (`paqman d`).
+ *
+ * A Sink takes the files decoded by decompressToDirectory() and writes
+ * them on other threads, so the decoder does not wait for directory
+ * creation, open, write and close of every file. The data of a file is
+ * queued in chunks of 1 MiB (up to 64 MiB in total, then the decoder
+ * waits) and written at its offset with one of these backends:
+ *
+ * - uring: one thread submits openat/write/fallocate/close for up to 64
+ *   files at a time to an io_uring and reaps the completions in batches.
+ *   Linux 5.6 or later; set up with raw syscalls, no liburing needed.
+ * - threads: a pool of threads, each writing one file at a time with
+ *   ordinary syscalls. Used when io_uring is unavailable.
+ * - sync: the decoding thread writes itself, as before.
+ *
+ * Parent directories are created once and remembered. They, and the files,
+ * are never reached through a symlink, so an archive cannot write outside
+ * the output directory. Files announced
+ * with expect() are preallocated with fallocate(), chunks are written at
+ * 1 MiB aligned offsets, and zero runs of 64 KiB or more are left as holes,
+ * so large and sparse files (VM images) are restored without
+ * fragmentation or writing their zeros. The zero runs that were left
+ * out of the archive (see sparse.h) are restored as holes too.
+ *
+ * A file given attributes() gets its mode, modification time and, when
+ * running as root, its owner once its data is written: the writer issues
+ * fchown, fchmod and futimens on the open descriptor just before closing
+ * it, so they cost no extra open or path lookup. The uring backend does
+ * this for every file whose writes completed in one pass, before
+ * submitting their closes together.
+ */
+
+#ifndef PAQMAN_EXTRACT_H
+#define PAQMAN_EXTRACT_H
+
+#include "libzpaq.h"
+#include "meta.h"
+#include "sparse.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace extract {
+
+enum Backend { AUTO, URING, THREADS, SYNC };
+
+// Parses "auto", "uring", "threads" or "sync". Returns false if unknown.
+bool parseBackend(const std::string& name, Backend& b);
+
+class Sink : public libzpaq::Writer {
+public:
+    // AUTO tries uring, then threads. threads is the pool size of THREADS.
+    explicit Sink(Backend backend = AUTO, int threads = 4);
+    ~Sink() override;  // waits for the writes, ignoring errors
+
+    // Starts the next file, name below dir, and ends the previous one. Its
+    // parent directories are created as needed (see makeDirectories()), and
+    // a symlink in its place is replaced. Throws if name fails
+    // meta::isBelow().
+    void open(const std::string& dir, const std::string& name);
+
+    // The current file will get about bytes more data, e.g. from the size in
+    // a segment comment. Reserves the space if it is 1 MiB or more; a wrong
+    // guess costs only time.
+    void expect(uint64_t bytes);
+
+    // The zero runs left out of the data of the current segment, from its
+    // comment. Call before its data; this also skips the runs left over from
+    // the previous segment.
+    void holes(const std::vector<sparse::Run>& runs);
+
+    // The current file gets the mode, owner ids and modification time of r
+    // after its data is written. Owners are set only when running as root;
+    // ids that cannot be set there (e.g. unmapped in a user namespace) are
+    // left as they are.
+    void attributes(const meta::Record& r);
+
+    // Removes the current file once it is closed, e.g. when its data turned
+    // out to be damaged.
+    void discard();
+
+    // Append to the current file.
+    void put(int c) override;
+    void write(const char* buf, int n) override;
+
+    // Waits until every file is written and closed. Throws the first error.
+    void finish();
+
+    // Backend in use, e.g. "uring" or "threads (uring: Operation not permitted)".
+    std::string describe() const;
+
+    struct Impl;
+
+private:
+    std::unique_ptr<Impl> impl;
+};
+
+// Creates the directory name below dir and those between, as extraction
+// does for the parents of a file. Throws if one of them exists but is not
+// a directory, a symlink to one included, so nothing is created outside
+// dir through a link. name must pass meta::isBelow().
+void makeDirectories(const std::string& dir, const std::string& name);
+
+// Sets the attributes of r on path as attributes() does, without following
+// a symlink; a symlink keeps its mode. Returns 0 or an errno value.
+int setAttributes(const std::string& path, const meta::Record& r);
+
+}  // namespace extract
+
+#endif  // PAQMAN_EXTRACT_H
@@ -0,0 +1,268 @@
+/**
+ * @file jitbench.cpp
+ * @brief JIT vs interpreter differential check and benchmark (`paqman bench-jit`).
+ *
+ * libzpaq has two implementations of the same ZPAQL semantics: x86 JIT code
+ * (ZPAQL::assemble(), Predictor::assemble_p()) and the interpreter
+ * (ZPAQL::run0(), Predictor::predict0(), update0()). This harness compresses
+ * the input with every built-in level and with a set of random valid methods,
+ * once with each implementation (libzpaq::setJIT()), and asserts that:
+ *
+ * - both compressed outputs are byte-identical, and
+ * - decompressing with either implementation restores the input.
+ *
+ * It reports the JIT speedup for compression and decompression per config.
+ * The exit code is nonzero if any config mismatches, so JIT work can be
+ * gated on it.
+ */
+
+#include "bench.h"
+#include "benchutil.h"
+#include "corpus.h"
+#include "libzpaq.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace benchutil;
+
+namespace {
+
+// --- Configs ---
+
+std::string itos(int x) {
+    return std::to_string(x);
+}
+
+// log2 block size in MiB as chosen by compressBlock() for n bytes
+int blockBits(size_t n) {
+    int r = 0;
+    while ((size_t(1) << (r + 20)) < n + 4096) ++r;
+    return r;
+}
+
+// Returns a random valid explicit method "x..." for an input of n bytes:
+// a preprocessor (none, LZ77, BWT, optionally E8E9) followed by 1..8
+// modeling commands in the syntax of makeConfig().
+std::string randomMethod(Rng& rng, size_t n) {
+    const int b = blockBits(n);
+    std::string m = "x" + itos(b);
+    const int lz = rng.below(4);       // 0=none 1=var LZ77 2=byte LZ77 3=BWT
+    const int e8 = rng.below(4) == 0;  // E8E9 transform
+    m += "," + itos(lz + 4 * e8);
+    if (lz == 1) {
+        m += "," + itos(4 + rng.below(4)) + ",0," + itos(rng.below(4)) + "," + itos(19 + b);
+    } else if (lz == 2) {
+        m += "," + itos(2 + rng.below(12)) + ",0," + itos(rng.below(4)) + "," + itos(19 + b);
+    }
+
+    const int ncmd = 1 + rng.below(8);
+    int ncomp = 0;
+    for (int i = 0; i < ncmd; ++i) {
+        switch (i == 0 ? rng.below(2) : rng.below(7)) {
+            case 0: {  // c: CM or ICM with 0..3 context bytes
+                m += "c" + itos(rng.below(2) ? 0 : 1 + rng.below(256)) + ",0";
+                for (int k = rng.below(4); k > 0; --k) m += rng.below(2) ? ",255" : ",223";
+                ++ncomp;
+                break;
+            }
+            case 1:  // w: word model chain
+                m += "w" + itos(1 + rng.below(2));
+                ncomp += 2;
+                break;
+            case 2:  // i: ISSE chain
+                m += "i1";
+                for (int k = rng.below(3); k > 0; --k) m += "," + itos(1 + rng.below(2));
+                ncomp += 2;
+                break;
+            case 3:  // a: MATCH
+                m += rng.below(2) ? "a" : "a24,0,1";
+                ++ncomp;
+                break;
+            case 4:  // m: MIX of all previous
+                m += rng.below(2) ? "m" : "m16";
+                ++ncomp;
+                break;
+            case 5:  // t: MIX2 of the last 2
+                if (ncomp >= 2) {
+                    m += "t";
+                    ++ncomp;
+                }
+                break;
+            default:  // s: SSE
+                m += rng.below(2) ? "s" : "s16,32,255";
+                ++ncomp;
+                break;
+        }
+    }
+    return m;
+}
+
+// --- Measurement ---
+
+struct Pass {
+    libzpaq::StringBuffer out;
+    double compSeconds = 0;
+    double decompSeconds = 0;
+    bool restored = false;
+};
+
+// Compresses data with method using JIT or the interpreter, then decompresses
+// the result with the same engine and checks it restores data.
+void runPass(const std::string& data, const std::string& method, bool jit, Pass& p) {
+    libzpaq::setJIT(jit);
+    libzpaq::StringBuffer in(data.size());
+    in.write(data.data(), int(data.size()));
+    Clock::time_point t0 = Clock::now();
+    libzpaq::compressBlock(&in, &p.out, method.c_str());
+    p.compSeconds = secondsSince(t0);
+
+    libzpaq::StringBuffer packed, restored(data.size());
+    packed.write((const char*)p.out.c_str(), int(p.out.size()));
+    t0 = Clock::now();
+    libzpaq::decompress(&packed, &restored);
+    p.decompSeconds = secondsSince(t0);
+    p.restored = restored.size() == data.size() &&
+                 std::memcmp(restored.c_str(), data.data(), data.size()) == 0;
+    libzpaq::setJIT(true);
+}
+
+struct DiffResult {
+    std::string method;
+    size_t outBytes;
+    double jitComp, intComp, jitDecomp, intDecomp;  // seconds
+    bool identical;                                 // same compressed bytes
+    bool restored;                                  // both engines round trip
+};
+
+// --- Options ---
+
+struct JitBenchOptions {
+    std::vector<int> levels{0, 1, 2, 3, 4, 5};
+    int randomConfigs = 8;
+    uint64_t seed = 1;
+    size_t size = 1u << 20;
+    corpus::Kind corpusKind = corpus::MIXED;
+    bool json = false;
+    std::vector<std::string> files;
+};
+
+JitBenchOptions parseOptions(int argc, char** argv) {
+    JitBenchOptions o;
+    for (int i = 0; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--levels") {
+            o.levels = parseList(optionValue(argc, argv, i), 0, 5, "level");
+        } else if (a == "--random") {
+            o.randomConfigs = parseInt(optionValue(argc, argv, i), 0, 10000, "random config count");
+        } else if (a == "--seed") {
+            o.seed = parseInt(optionValue(argc, argv, i), 0, 0x7fffffff, "seed");
+        } else if (a == "--size") {
+            o.size = size_t(parseInt(optionValue(argc, argv, i), 1, 1024, "size")) << 20;
+        } else if (a == "--corpus") {
+            std::string kind = optionValue(argc, argv, i);
+            if (!corpus::parseKind(kind, o.corpusKind)) {
+                throw std::runtime_error("Unknown corpus '" + kind + "', use one of " + corpus::kindList());
+            }
+        } else if (a == "--json") {
+            o.json = true;
+        } else if (a.size() > 1 && a[0] == '-') {
+            throw std::runtime_error("Unknown bench-jit option: " + a);
+        } else {
+            o.files.push_back(a);
+        }
+    }
+    return o;
+}
+
+}  // namespace
+
+// --- Entry Point ---
+
+int runJitBench(int argc, char** argv) {
+    JitBenchOptions o = parseOptions(argc, argv);
+
+    std::string data;
+    if (o.files.empty()) {
+        data = corpus::generate(o.corpusKind, o.size, o.seed);
+    } else {
+        for (const auto& f : o.files) {
+            std::ifstream in(f, std::ios::binary);
+            if (!in.is_open()) throw std::runtime_error("Cannot open input file: " + f);
+            std::ostringstream ss;
+            ss << in.rdbuf();
+            data += ss.str();
+        }
+        if (data.size() > o.size) data.resize(o.size);
+    }
+    if (data.empty()) throw std::runtime_error("Benchmark input is empty");
+
+    std::vector<std::string> methods;
+    for (int level : o.levels) methods.push_back(itos(level));
+    Rng rng(o.seed);
+    for (int i = 0; i < o.randomConfigs; ++i) methods.push_back(randomMethod(rng, data.size()));
+
+    if (!libzpaq::isJIT() && !o.json) {
+        std::cout << "JIT is not available in this build; both passes are interpreted\n";
+    }
+    if (!o.json) {
+        std::cout << "JIT vs interpreter on " << data.size() << " bytes, seed " << o.seed << "\n";
+        std::printf("%-48s %8s %9s %9s %8s %9s %9s %8s  %s\n", "method", "ratio", "jit_c_s", "int_c_s",
+                    "c_speed", "jit_d_s", "int_d_s", "d_speed", "status");
+    }
+
+    std::vector<DiffResult> results;
+    int failures = 0;
+    for (const auto& method : methods) {
+        Pass jit, interp;
+        runPass(data, method, true, jit);
+        runPass(data, method, false, interp);
+
+        DiffResult r;
+        r.method = method;
+        r.outBytes = jit.out.size();
+        r.jitComp = jit.compSeconds;
+        r.intComp = interp.compSeconds;
+        r.jitDecomp = jit.decompSeconds;
+        r.intDecomp = interp.decompSeconds;
+        r.identical = jit.out.size() == interp.out.size() &&
+                      std::memcmp(jit.out.c_str(), interp.out.c_str(), jit.out.size()) == 0;
+        r.restored = jit.restored && interp.restored;
+        if (!r.identical || !r.restored) ++failures;
+        results.push_back(r);
+
+        if (!o.json) {
+            std::printf("%-48s %8.4f %9.3f %9.3f %8.2f %9.3f %9.3f %8.2f  %s\n", method.c_str(),
+                        double(r.outBytes) / data.size(), r.jitComp, r.intComp,
+                        r.jitComp > 0 ? r.intComp / r.jitComp : 0.0, r.jitDecomp, r.intDecomp,
+                        r.jitDecomp > 0 ? r.intDecomp / r.jitDecomp : 0.0,
+                        !r.identical ? "\33[31mOUTPUT DIFFERS\33[0m"
+                                     : !r.restored ? "\33[31mROUND TRIP FAILED\33[0m" : "ok");
+            std::fflush(stdout);
+        }
+    }
+
+    if (o.json) {
+        std::printf("{\n  \"input_bytes\": %zu,\n  \"seed\": %llu,\n  \"failures\": %d,\n  \"results\": [",
+                    data.size(), (unsigned long long)o.seed, failures);
+        for (size_t i = 0; i < results.size(); ++i) {
+            const DiffResult& r = results[i];
+            std::printf("%s\n    {\"method\": \"%s\", \"out_bytes\": %zu, \"jit_compress_s\": %.6f, "
+                        "\"interp_compress_s\": %.6f, \"jit_decompress_s\": %.6f, "
+                        "\"interp_decompress_s\": %.6f, \"identical\": %s, \"restored\": %s}",
+                        i ? "," : "", jsonEscape(r.method).c_str(), r.outBytes, r.jitComp, r.intComp,
+                        r.jitDecomp, r.intDecomp, r.identical ? "true" : "false",
+                        r.restored ? "true" : "false");
+        }
+        std::printf("\n  ]\n}\n");
+    } else {
+        std::cout << (failures ? "\33[31m" : "") << failures << " of " << results.size()
+                  << " configs failed" << (failures ? "\33[0m" : "") << "\n";
+    }
+    return failures ? 1 : 0;
+}
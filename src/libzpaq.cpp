@@ -27,6 +27,7 @@ See libzpaq.h for additional documentation.
 #include <string>
 #include <vector>
 #include <stdio.h>
+#include <math.h>
 
 #ifdef unix
 #ifndef NOJIT
@@ -37,6 +38,10 @@ See libzpaq.h for additional documentation.
 #include <wincrypt.h>
 #endif
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace libzpaq {
 
 // Read 16 bit little-endian number
@@ -98,6 +103,32 @@ void allocx(U8* &p, int &n, int newsize) {
 #endif
 }
 
+// JIT or interpreter for ZPAQL and models initialized after setJIT()
+static bool jit=true;
+
+void setJIT(bool on) {jit=on;}
+
+bool isJIT() {
+#ifdef NOJIT
+  return false;
+#else
+  return jit;
+#endif
+}
+
+// Stage timing callbacks, see setProfiler()
+static Profiler* profiler=0;
+
+void setProfiler(Profiler* p) {profiler=p;}
+
+// Report the lifetime of a Stage as the named stage if profiling
+class Stage {
+  const char* name;
+public:
+  Stage(const char* s): name(profiler ? s : 0) {if (name) profiler->begin(name);}
+  ~Stage() {if (name) profiler->end(name);}
+};
+
 //////////////////////////// SHA1 ////////////////////////////
 
 // SHA1 code, see http://en.wikipedia.org/wiki/SHA-1
@@ -1713,10 +1744,14 @@ Predictor::Predictor(ZPAQL& zr):
   pcode=0;
   pcode_size=0;
   initTables=false;
+  stats=0;
+  statsEvery=1;
+  statsSkip=0;
 }
 
 Predictor::~Predictor() {
   allocx(pcode, pcode_size, 0);  // free executable memory
+  delete[] stats;
 }
 
 // Initialize the predictor with a new model in z
@@ -1767,12 +1802,15 @@ void Predictor::init() {
   // Initialize components
   for (int i=0; i<256; ++i)  // clear old model
     comp[i].init();
+  if (stats) memset(stats, 0, 256*sizeof(ComponentStats));
+  statsSkip=0;
   int n=z.header[6]; // hsize[0..1] hh hm ph pm n (comp)[n] END 0[128] (hcomp) END
   const U8* cp=&z.header[7];  // start of component list
   for (int i=0; i<n; ++i) {
     assert(cp<&z.header[z.cend]);
     assert(cp>&z.header[0] && cp<&z.header[z.header.isize()-8]);
     Component& cr=comp[i];
+    if (stats) stats[i].type=cp[0];
     switch(cp[0]) {
       case CONS:  // c
         p[i]=(cp[1]-128)*4;
@@ -2087,11 +2125,142 @@ size_t Predictor::find(Array<U8>& ht, int sizebits, U32 cxt) {
     return memset(&ht[h2], 0, 16), ht[h2]=chk, h2;
 }
 
+/////////////////////// Predictor telemetry ///////////////
+
+// Cost in bits of coding a bit that had probability (i+0.5)/4096
+static float costt[4096];
+
+static double bitCost(int p, int y) {  // p = P(1) in 0..32767
+  return costt[(y ? p : 32767-p)>>3];
+}
+
+void Predictor::enableStats(int every) {
+  statsEvery=every>1 ? every : 1;
+  if (stats) return;
+  if (!costt[0])
+    for (int i=0; i<4096; ++i) costt[i]=float(-log2((i+0.5)/4096));
+  stats=new ComponentStats[256];
+  memset(stats, 0, 256*sizeof(ComponentStats));
+  if (z.header.isize()>6) {  // model already loaded by init()
+    const U8* cp=&z.header[7];
+    for (int i=0; i<z.header[6]; ++i, cp+=compsize[*cp])
+      stats[i].type=cp[0];
+  }
+}
+
+const ComponentStats* Predictor::stat(int i) {
+  if (!stats || z.header.isize()<=6 || i<0 || i>=z.header[6]) return 0;
+  return &stats[i];
+}
+
+// Classify the find() that predict0() is about to do
+void Predictor::countFind(ComponentStats& s, Array<U8>& ht, int sizebits,
+                          U32 cxt) {
+  int chk=cxt>>sizebits&255;
+  size_t h0=(cxt*16)&(ht.size()-16);
+  size_t h1=h0^16, h2=h0^32;
+  if (ht[h0]==chk || ht[h1]==chk || ht[h2]==chk) {++s.hits; return;}
+  size_t r=h2;  // the row find() will replace
+  if (ht[h0+1]<=ht[h1+1] && ht[h0+1]<=ht[h2+1]) r=h0;
+  else if (ht[h1+1]<ht[h2+1]) r=h1;
+  if (ht[r+1]) ++s.replaced;
+  else ++s.misses;
+}
+
+// Count hash table lookups before predict0()
+void Predictor::statsPredict() {
+  if (c8!=1 && (c8&0xf0)!=16) return;
+  const U8* cp=&z.header[7];
+  for (int i=0; i<z.header[6]; ++i, cp+=compsize[*cp])
+    if (cp[0]==ICM || cp[0]==ISSE)
+      countFind(stats[i], comp[i].ht, cp[1]+2, h[i]+16*c8);
+}
+
+// Score the predictions of predict0() against y before update0(y)
+void Predictor::statsUpdate(int y) {
+  const U8* cp=&z.header[7];
+  for (int i=0; i<z.header[6]; ++i, cp+=compsize[*cp]) {
+    Component& cr=comp[i];
+    ComponentStats& s=stats[i];
+    const double cost=bitCost(squash(p[i]), y);
+    ++s.bits;
+    s.cost+=cost;
+    switch(cp[0]) {
+      case MATCH: {
+        int b=0;
+        for (int a=cr.a; a>0; a>>=1) ++b;
+        ++s.len[b];
+        if (cr.a && int(cr.c)==y) ++s.right;
+        break;
+      }
+      case MIX2: {  // remove one input: w*pj or (65536-w)*pk
+        int w=cr.a16[cr.cxt];
+        ComponentStats& sj=stats[cp[2]];
+        ComponentStats& sk=stats[cp[3]];
+        sj.saved+=bitCost(squash((65536-w)*p[cp[3]]>>16), y)-cost;
+        sk.saved+=bitCost(squash(w*p[cp[2]]>>16), y)-cost;
+        sj.weight+=w/65536.0;
+        sk.weight+=(65536-w)/65536.0;
+        ++sj.mixed;
+        ++sk.mixed;
+        break;
+      }
+      case MIX: {  // remove one term of the dot product
+        int m=cp[3];
+        int* wt=(int*)&cr.cm[cr.cxt];
+        int dot=0;
+        for (int j=0; j<m; ++j) dot+=(wt[j]>>8)*p[cp[2]+j];
+        for (int j=0; j<m; ++j) {
+          ComponentStats& sj=stats[cp[2]+j];
+          int pj=clamp2k((dot-(wt[j]>>8)*p[cp[2]+j])>>8);
+          sj.saved+=bitCost(squash(pj), y)-cost;
+          sj.weight+=abs(wt[j])/65536.0;
+          ++sj.mixed;
+        }
+        break;
+      }
+    }
+  }
+}
+
 /////////////////////// Decoder ///////////////////////
 
 Decoder::Decoder(ZPAQL& z):
     in(0), low(1), high(0xFFFFFFFF), curr(0), rpos(0), wpos(0),
-    pr(z), buf(BUFSIZE) {
+    pr(z), buf(BUFSIZE), bp(&buf[0]), mem(0), memEnd(0) {
+}
+
+// Read input from [begin, end) in place, in windows of up to MEMWINDOW
+// bytes so rpos and wpos fit in 32 bits. Drops any buffered input.
+void Decoder::setMemory(const char* begin, const char* end) {
+  assert(begin<=end);
+  in=0;
+  mem=bp=begin;
+  memEnd=end;
+  rpos=wpos=0;
+  refill();
+}
+
+void Decoder::setReader(Reader* r) {
+  in=r;
+  if (mem) {  // leaving memory mode
+    mem=memEnd=0;
+    bp=&buf[0];
+    rpos=wpos=0;
+  }
+}
+
+void Decoder::refill() {
+  rpos=0;
+  if (mem) {
+    bp=mem;
+    wpos=U32(memEnd-mem<MEMWINDOW ? memEnd-mem : MEMWINDOW);
+    mem+=wpos;
+  }
+  else {
+    wpos=in ? in->read(&buf[0], BUFSIZE) : 0;
+    assert(wpos<=BUFSIZE);
+  }
 }
 
 void Decoder::init() {
@@ -2155,11 +2324,48 @@ int Decoder::decompress() {
 }
 
 // Find end of compressed data and return next byte
+// Skip buffered input up to where a block tag may start and return how
+// many of the next bytes findBlock() must hash one at a time before asking
+// again. A tag may also start in the last 15 bytes already hashed, and
+// the first bytes of a buffer may end a tag begun in the previous one, so
+// those are always hashed. Set restart if bytes were skipped, as the
+// hashes then no longer hold the bytes before rpos.
+int Decoder::skipToTag(bool& restart) {
+  restart=false;
+  if (rpos<15 || wpos-rpos<16) return 16;
+  const char* p=findTag(bp+rpos-15, bp+wpos);
+  if (p==bp+wpos) p-=15;  // no tag, keep the tail
+  else if (p<bp+rpos) return int(p+16-(bp+rpos));  // partly hashed
+  if (p>bp+rpos) rpos=U32(p-bp), restart=true;
+  return 16;
+}
+
 int Decoder::skip() {
   int c=-1;
   if (pr.isModeled()) {
     while (curr==0)  // at start?
       curr=get();
+    while (mem && curr) {  // search memory input for 4 zeros
+      if (rpos==wpos) {
+        if (mem==memEnd) break;
+        refill();
+      }
+      if ((curr&255)==0) {  // zeros ending curr may start the run
+        curr=curr<<8|U8(bp[rpos++]);
+        continue;
+      }
+      const char* p=bp+rpos;
+      const char* end=bp+wpos;
+      while ((p=(const char*)memchr(p, 0, end-p))!=0 && end-p>=4
+             && (p[1] || p[2] || p[3]))
+        ++p;
+      if (p && end-p>=4) {
+        rpos=U32(p+4-bp), curr=0;
+        break;
+      }
+      if (wpos-rpos>3) rpos=wpos-3;  // no run in the window, keep its tail
+      while (rpos<wpos) curr=curr<<8|U8(bp[rpos++]);
+    }
     while (curr && (c=get())>=0)  // find 4 zeros
       curr=curr<<8|c;
     while ((c=get())==0) ;  // might be more than 4
@@ -2170,6 +2376,11 @@ int Decoder::skip() {
       for (int i=0; i<4 && (c=get())>=0; ++i) curr=curr<<8|c;
     while (curr>0) {
       while (curr>0) {
+        if (mem && rpos<wpos) {  // skip in place
+          U32 n=wpos-rpos<curr ? wpos-rpos : curr;
+          rpos+=n, curr-=n;
+          continue;
+        }
         --curr;
         if (get()<0) return error("skipped to EOF"), -1;
       }
@@ -2242,6 +2453,55 @@ int PostProcessor::write(int c) {
 
 /////////////////////// Decompresser /////////////////////
 
+// Hashes of a 16 byte string as findBlock() rolls them. The multipliers
+// are even, so earlier bytes shift out after 16.
+static void hashTag(const char* p, U32& h1, U32& h2, U32& h3, U32& h4) {
+  for (int i=0; i<16; ++i) {
+    int c=U8(p[i]);
+    h1=h1*12+c;
+    h2=h2*20+c;
+    h3=h3*28+c;
+    h4=h4*44+c;
+  }
+}
+
+static bool isTag(U32 h1, U32 h2, U32 h3, U32 h4) {
+  return h1==0xB16B88F1 && h2==0xFF5376F1 && h3==0x72AC5BF1 && h4==0x2F909AF1;
+}
+
+// Candidates have the tag's first byte '7' and last byte 'Q' 15 bytes
+// apart, found 16 positions at a time with SSE2 or else with memchr(),
+// and are confirmed by the hashes.
+const char* findTag(const char* begin, const char* end) {
+  const char* p=begin;
+  U32 h1, h2, h3, h4;
+#ifdef __SSE2__
+  const __m128i first=_mm_set1_epi8(0x37), last=_mm_set1_epi8('Q');
+  for (; end-p>=31; p+=16) {
+    __m128i a=_mm_loadu_si128((const __m128i*)p);
+    __m128i b=_mm_loadu_si128((const __m128i*)(p+15));
+    int m=_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                          _mm_cmpeq_epi8(b, last)));
+    for (; m; m&=m-1) {
+      int i=0;
+      while (!(m>>i&1)) ++i;
+      h1=h2=h3=h4=0;
+      hashTag(p+i, h1, h2, h3, h4);
+      if (isTag(h1, h2, h3, h4)) return p+i;
+    }
+  }
+#endif
+  while (end-p>=16 && (p=(const char*)memchr(p, 0x37, end-p-15))!=0) {
+    if (p[15]=='Q') {
+      h1=h2=h3=h4=0;
+      hashTag(p, h1, h2, h3, h4);
+      if (isTag(h1, h2, h3, h4)) return p;
+    }
+    ++p;
+  }
+  return end;
+}
+
 // Find the start of a block and return true if found. Set memptr
 // to memory used.
 bool Decompresser::findBlock(double* memptr) {
@@ -2250,13 +2510,20 @@ bool Decompresser::findBlock(double* memptr) {
   // Find start of block
   U32 h1=0x3D49B113, h2=0x29EB7F93, h3=0x2614BE13, h4=0x3828EB13;
   // Rolling hashes initialized to hash of first 13 bytes
-  int c;
-  while ((c=dec.get())!=-1) {
+  int c, n=3;  // "zPQ" without a tag may start a block
+  while (true) {
+    if (n==0) {  // skip ahead to a possible tag
+      bool restart;
+      n=dec.skipToTag(restart);
+      if (restart) h1=h2=h3=h4=0;  // as if after zeros, never a tag
+    }
+    --n;
+    if ((c=dec.get())==-1) break;
     h1=h1*12+c;
     h2=h2*20+c;
     h3=h3*28+c;
     h4=h4*44+c;
-    if (h1==0xB16B88F1 && h2==0xFF5376F1 && h3==0x72AC5BF1 && h4==0x2F909AF1)
+    if (isTag(h1, h2, h3, h4))
       break;  // hash of 16 byte string
   }
   if (c==-1) return false;
@@ -2311,8 +2578,11 @@ void Decompresser::readComment(Writer* comment) {
   if (dec.get()!=0) error("missing reserved byte");
 }
 
-// Decompress n bytes, or all if n < 0. Return false if done
-bool Decompresser::decompress(int n) {
+// Decompress n bytes, or all if n < 0. Return false if done. If raw is
+// not 0, also write the decoded bytes to it as they were before
+// postprocessing (e.g. LZ77 codes), without the PCOMP that starts the
+// first segment, so that Compressor::compress() can code them again.
+bool Decompresser::decompress(int n, Writer* raw) {
   assert(state==DATA);
   if (decode_state==SKIP) error("decompression after skipped segment");
   assert(decode_state!=SKIP);
@@ -2320,6 +2590,7 @@ bool Decompresser::decompress(int n) {
   // Initialize models to start decompressing block
   if (decode_state==FIRSTSEG) {
     dec.init();
+    if (primen>0) dec.prime(primep, primen);
     assert(z.header.size()>5);
     pp.init(z.header[4], z.header[5]);
     decode_state=SEG;
@@ -2329,15 +2600,29 @@ bool Decompresser::decompress(int n) {
   while ((pp.getState()&3)!=1)
     pp.write(dec.decompress());
 
-  // Decompress n bytes, or all if n < 0
+  // Decompress n bytes, or all if n < 0, in batches so that decoding
+  // and postprocessing can be timed separately
+  const int BUFSIZE=1<<12;
+  int buf[BUFSIZE];
   while (n) {
-    int c=dec.decompress();
-    pp.write(c);
+    int len=0, c=0;
+    {
+      Stage stage("decode");
+      while (len<BUFSIZE && len!=n && (c=dec.decompress())!=-1)
+        buf[len++]=c;
+    }
+    Stage stage("postprocess");
+    for (int i=0; i<len; ++i)
+      pp.write(buf[i]);
+    if (raw)
+      for (int i=0; i<len; ++i)
+        raw->put(buf[i]);
+    if (n>0) n-=len;
     if (c==-1) {
+      pp.write(-1);
       state=SEGEND;
       return false;
     }
-    if (n>0) --n;
   }
   return true;
 }
@@ -2889,6 +3174,7 @@ void Compressor::postProcess(const char* pcomp, int len) {
   if (state==SEG2) return;
   assert(state==SEG1);
   enc.init();
+  if (primen>0) enc.prime(primep, primen);
   if (!pcomp) {
     len=pz.hend-pz.hbegin;
     if (len>0) {
@@ -2931,12 +3217,16 @@ bool Compressor::compress(int n) {
     if (nr<0 || nr>BUFSIZE || nr>nbuf) error("invalid read size");
     if (nr<=0) return false;
     if (n>=0) n-=nr;
-    for (int i=0; i<nr; ++i) {
-      int ch=U8(buf[i]);
-      enc.compress(ch);
-      if (verify) {
-        if (pz.hend) pz.run(ch);
-        else sha1.put(ch);
+    {
+      Stage stage("encode");
+      for (int i=0; i<nr; ++i)
+        enc.compress(U8(buf[i]));
+    }
+    if (verify) {
+      Stage stage("verify");
+      for (int i=0; i<nr; ++i) {
+        if (pz.hend) pz.run(U8(buf[i]));
+        else sha1.put(U8(buf[i]));
       }
     }
   }
@@ -2950,6 +3240,7 @@ void Compressor::endSegment(const char* sha1string) {
   assert(state==SEG2);
   enc.compress(-1);
   if (verify && pz.hend) {
+    Stage stage("verify");
     pz.run(-1);
     pz.flush();
   }
@@ -2974,6 +3265,7 @@ char* Compressor::endSegmentChecksum(int64_t* size, bool dosha1) {
   assert(state==SEG2);
   enc.compress(-1);
   if (verify && pz.hend) {
+    Stage stage("verify");
     pz.run(-1);
     pz.flush();
   }
@@ -4587,10 +4879,15 @@ int Predictor::assemble_p() {
 // Return a prediction of the next bit in range 0..32767
 // Use JIT code starting at pcode[0] if available, or else create it.
 int Predictor::predict() {
+  if (stats && !statsSkip) {  // interpreted, see enableStats()
+    statsPredict();
+    return predict0();
+  }
 #ifdef NOJIT
   return predict0();
 #else
   if (!pcode) {
+    if (!jit) return predict0();
     allocx(pcode, pcode_size, (z.cend*100+4096)&-4096);
     int n=assemble_p();
     if (n>pcode_size) {
@@ -4605,13 +4902,39 @@ int Predictor::predict() {
 #endif
 }
 
+// Train the model on n bytes as if they had been coded, so that the
+// first bytes of a block are predicted from them. Both ends of a block
+// must be primed with the same bytes.
+void Predictor::prime(const char* p, size_t n) {
+  if (!isModeled()) return;
+  Stage stage("prime");
+  for (size_t i=0; i<n; ++i) {
+    const int c=p[i]&255;
+    for (int j=7; j>=0; --j) {
+      predict();
+      update((c>>j)&1);
+    }
+  }
+}
+
 // Update the model with bit y = 0..1
 // Use the JIT code starting at pcode[5].
 void Predictor::update(int y) {
+  if (stats) {
+    const bool last=c8>=128;  // y ends a byte
+    if (!statsSkip) {
+      statsUpdate(y);
+      update0(y);
+      if (last) statsSkip=statsEvery-1;
+      return;
+    }
+    if (last) --statsSkip;
+  }
 #ifdef NOJIT
   update0(y);
 #else
-  assert(pcode && pcode[5]);
+  if (!pcode) return update0(y);  // interpreted, see setJIT()
+  assert(pcode[5]);
   ((void(*)(Predictor*, int))&pcode[5])(this, y);
 
   // Save bit y in c8, hmap4 (not implemented in JIT)
@@ -4636,6 +4959,7 @@ void ZPAQL::run(U32 input) {
   run0(input);
 #else
   if (!rcode) {
+    if (!jit) return run0(input);
     allocx(rcode, rcode_size, (hend*10+4096)&-4096);
     int n=assemble();
     if (n>rcode_size) {
@@ -6624,7 +6948,10 @@ LZBuffer::LZBuffer(StringBuffer& inbuf, int args[], const unsigned* sap):
     error("match length $3 too small");
 
   // e8e9 transform
-  if (args[1]>4 && !sap) e8e9(inbuf.data(), n);
+  if (args[1]>4 && !sap) {
+    Stage stage("e8e9");
+    e8e9(inbuf.data(), n);
+  }
 
   // build suffix array if not supplied
   if (args[5]-args[0]>=21 || level==3) {  // LZ77-SA or BWT
@@ -6634,6 +6961,7 @@ LZBuffer::LZBuffer(StringBuffer& inbuf, int args[], const unsigned* sap):
       assert(ht.size()>=n);
       assert(ht.size()>0);
       sa=&ht[0];
+      Stage stage("sort");
       if (n>0) divsufsort((const unsigned char*)in, (int*)sa, n);
     }
     if (level<3) {
@@ -6645,6 +6973,7 @@ LZBuffer::LZBuffer(StringBuffer& inbuf, int args[], const unsigned* sap):
 
 // Encode from in to buf until end of input or buf is not empty
 void LZBuffer::fill() {
+  Stage stage("lz77");
 
   // BWT
   if (level==3) {
@@ -7534,16 +7863,11 @@ std::string makeConfig(const char* method, int args[]) {
   return hdr+itos(ncomp)+"\n"+comp+hcomp+"halt\n"+pcomp;
 }
 
-// Compress from in to out in 1 segment in 1 block using the algorithm
-// descried in method. If method begins with a digit then choose
-// a method depending on type. Save filename and comment
-// in the segment header. If comment is 0 then the default is the input size
-// as a decimal string, plus " jDC\x01" for a journaling method (method[0]
-// is not 's'). Write the generated method to methodOut if not 0.
-void compressBlock(StringBuffer* in, Writer* out, const char* method_,
-                   const char* filename, const char* comment, bool dosha1) {
+// Return the method that compressBlock() uses for in. If method begins
+// with a digit then choose a method depending on type. Otherwise return
+// method unchanged.
+std::string expandMethod(StringBuffer* in, const char* method_) {
   assert(in);
-  assert(out);
   assert(method_);
   assert(method_[0]);
   std::string method=method_;
@@ -7564,18 +7888,6 @@ void compressBlock(StringBuffer* in, Writer* out, const char* method_,
     else type=arg[1]*4+arg[2];
   }
 
-  // Get hash of input
-  libzpaq::SHA1 sha1;
-  const char* sha1ptr=0;
-#ifdef DEBUG
-  if (true) {
-#else
-  if (dosha1) {
-#endif
-    sha1.write(in->c_str(), n);
-    sha1ptr=sha1.result();
-  }
-
   // Expand default methods
   if (isdigit(method[0])) {
     const int level=method[0]-'0';
@@ -7689,6 +8001,38 @@ void compressBlock(StringBuffer* in, Writer* out, const char* method_,
       method+="c0,2,0,255i1c0,3,0,0,255i1c0,4,0,0,0,255i1mm16ts19t0";
     }
   }
+  return method;
+}
+
+// Compress from in to out in 1 segment in 1 block using the algorithm
+// descried in method (see expandMethod()). Save filename and comment
+// in the segment header. If comment is 0 then the default is the input size
+// as a decimal string. If stats is not 0 then save the ComponentStats of the
+// model in stats[0..255], collected on 1 byte in statsEvery.
+void compressBlock(StringBuffer* in, Writer* out, const char* method_,
+                   const char* filename, const char* comment, bool dosha1,
+                   ComponentStats* stats, const char* primep, size_t primen,
+                   int statsEvery) {
+  assert(in);
+  assert(out);
+  assert(method_);
+  assert(method_[0]);
+  const unsigned n=in->size();  // input size
+
+  // Get hash of input
+  libzpaq::SHA1 sha1;
+  const char* sha1ptr=0;
+#ifdef DEBUG
+  if (true) {
+#else
+  if (dosha1) {
+#endif
+    Stage stage("sha1");
+    sha1.write(in->c_str(), n);
+    sha1ptr=sha1.result();
+  }
+
+  const std::string method=expandMethod(in, method_);
 
   // Compress
   std::string config;
@@ -7700,6 +8044,8 @@ void compressBlock(StringBuffer* in, Writer* out, const char* method_,
 #ifdef DEBUG
   co.setVerify(true);
 #endif
+  if (stats) co.enableStats(statsEvery);
+  co.setPrime(primep, primen);
   StringBuffer pcomp_cmd;
   co.writeTag();
   co.startBlock(config.c_str(), args, &pcomp_cmd);
@@ -7712,8 +8058,10 @@ void compressBlock(StringBuffer* in, Writer* out, const char* method_,
     co.compress();
   }
   else {  // compress with e8e9 or no preprocessing
-    if (args[1]>=4 && args[1]<=7)
+    if (args[1]>=4 && args[1]<=7) {
+      Stage stage("e8e9");
       e8e9(in->data(), in->size());
+    }
     co.setInput(in);
     co.compress();
   }
@@ -7727,6 +8075,79 @@ void compressBlock(StringBuffer* in, Writer* out, const char* method_,
 #else
   co.endSegment(sha1ptr);
 #endif
+  if (stats) {
+    memset(stats, 0, 256*sizeof(ComponentStats));
+    for (int i=0; co.stat(i); ++i) stats[i]=*co.stat(i);
+  }
+  co.endBlock();
+}
+
+// Compress in to out in 1 block with 1 segment per part, as compressBlock()
+// does for 1. Part i is the next sizes[i] bytes of in, with filenames[i]
+// and comments[i] (either array may be 0). The method is expanded for all
+// of in; each part is preprocessed on its own. The BWT postprocessor does
+// not restart at a segment boundary, so with BWT each part is compressed
+// by compressBlock() into a block of its own.
+void compressSegments(StringBuffer* in, Writer* out, const char* method_,
+                      int parts, const unsigned* sizes,
+                      const char* const* filenames,
+                      const char* const* comments, bool dosha1) {
+  assert(in);
+  assert(out);
+  assert(method_);
+  assert(method_[0]);
+  assert(parts>0);
+  const std::string method=expandMethod(in, method_);
+  std::string config;
+  int args[9]={0};
+  config=makeConfig(method.c_str(), args);
+  assert(in->size()<=(0x100000u<<args[0])-4096);
+  const unsigned char* p=in->data();
+  if ((args[1]&3)==3) {  // BWT
+    for (int i=0; i<parts; ++i) {
+      StringBuffer part(sizes[i]);
+      part.write((const char*)p, sizes[i]);
+      p+=sizes[i];
+      compressBlock(&part, out, method_, filenames ? filenames[i] : 0,
+                    comments ? comments[i] : 0, dosha1);
+    }
+    return;
+  }
+  libzpaq::Compressor co;
+  co.setOutput(out);
+  StringBuffer pcomp_cmd;
+  co.writeTag();
+  co.startBlock(config.c_str(), args, &pcomp_cmd);
+  for (int i=0; i<parts; ++i) {
+    const unsigned n=sizes[i];
+    StringBuffer part(n);
+    part.write((const char*)p, n);
+    p+=n;
+    libzpaq::SHA1 sha1;
+    const char* sha1ptr=0;
+    if (dosha1) {
+      Stage stage("sha1");
+      sha1.write(part.c_str(), n);
+      sha1ptr=sha1.result();
+    }
+    std::string cs=itos(n);
+    if (comments && comments[i]) cs=cs+" "+comments[i];
+    co.startSegment(filenames ? filenames[i] : 0, cs.c_str());
+    if (args[1]>=1 && args[1]<=7 && args[1]!=4) {  // LZ77 or BWT
+      LZBuffer lz(part, args);
+      co.setInput(&lz);
+      co.compress();
+    }
+    else {  // compress with e8e9 or no preprocessing
+      if (args[1]>=4 && args[1]<=7) {
+        Stage stage("e8e9");
+        e8e9(part.data(), part.size());
+      }
+      co.setInput(&part);
+      co.compress();
+    }
+    co.endSegment(sha1ptr);
+  }
   co.endBlock();
 }
 
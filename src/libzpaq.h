@@ -19,6 +19,8 @@ libzpaq recognizes the following options:
   -DNOJIT   Don't assume x86-32 or x86-64 with SSE2 (slower).
   -Dunix    Without -DNOJIT, assume Unix (Linux, Mac) rather than Windows.
 
+Without -DNOJIT, setJIT(false) selects the interpreter at run time.
+
 The application must provide an error handling function and derived
 implementations of two abstract classes, Reader and Writer,
 specifying the input and output byte streams. For example, to compress
@@ -471,6 +473,15 @@ read to EOF and return false.
 endSegment() writes a provided SHA-1 cryptographic hash checksum of the
 input segment before any preprocessing. It may be omitted.
 
+setPrime(p, n) before the first segment of a block trains the model on
+the n bytes at p before it codes anything, so that a small block of
+data like p compresses about as well as it would following p in one
+block. The bytes are not stored: a Decompresser must be given the same
+bytes with its own setPrime() to decode the block, and they are not
+part of its output. Priming does nothing for blocks without a context
+model (stored or LZ77 only). The setting applies to every block after
+it, in both classes, until changed; setPrime(0, 0) turns it off.
+
 
 ZPAQL
 
@@ -840,6 +851,7 @@ Use at your own risk.
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
+#include <string>
 
 namespace libzpaq {
 
@@ -857,6 +869,25 @@ extern const char* opcodelist[272];  // list of ZPAQL instructions
 // Callback for error handling
 extern void error(const char* msg);
 
+// Select JIT (default) or interpreted execution of ZPAQL and models.
+// Applies to ZPAQL programs and models initialized afterwards, so set it
+// before starting (de)compression threads. Ignored if NOJIT.
+void setJIT(bool on);
+bool isJIT();  // true if new models will use JIT code
+
+// Optional timing hooks. begin() and end() bracket pipeline stages inside
+// compressBlock(), Compressor and Decompresser: "sha1", "e8e9", "sort"
+// (divsufsort), "lz77" (LZ77/BWT parsing), "encode", "verify", "decode"
+// and "postprocess". Stages may nest and are reported on the thread doing
+// the work. Set before starting threads, 0 (default) for none.
+class Profiler {
+public:
+  virtual void begin(const char* stage) = 0;
+  virtual void end(const char* stage) = 0;
+  virtual ~Profiler() {}
+};
+void setProfiler(Profiler* p);
+
 // Virtual base classes for input and output
 // get() and put() must be overridden to read or write 1 byte.
 // read() and write() may be overridden to read or write n bytes more
@@ -1110,6 +1141,26 @@ public:
   StateTable();
 };
 
+///////////////////////// ComponentStats /////////////////////
+
+// Model telemetry collected by a Predictor after enableStats(every), reset
+// by init() at the start of each block. Bytes with stats are coded with the
+// interpreter; with every>1, only 1 byte in every is, and the JIT codes the
+// others. Costs are in bits of coded data.
+// saved is the cost of the consuming MIX or MIX2 output with this input's
+// term removed minus the cost with it, i.e. what the input earns there.
+struct ComponentStats {
+  int type;         // component type, 1..9 = CONS..SSE
+  U64 bits;         // bits predicted
+  double cost;      // cost of coding with this prediction alone
+  double saved;     // bits saved in the mixer that takes this as input
+  double weight;    // sum of |mixer weight| for this input, 1.0 = 65536
+  U64 mixed;        // bits where this was a MIX or MIX2 input
+  U64 hits, misses, replaced;  // ICM, ISSE find(): found, free row, evicted
+  U64 len[9];       // MATCH: bits at length 0, 1, 2-3, 4-7, ..., 128-255
+  U64 right;        // MATCH: correctly predicted bits
+};
+
 ///////////////////////// Predictor //////////////////////////
 
 // A predictor guesses the next bit
@@ -1120,7 +1171,9 @@ public:
   void init();          // build model
   int predict();        // probability that next bit is a 1 (0..4095)
   void update(int y);   // train on bit y (0..1)
-  int stat(int);        // Defined externally
+  void prime(const char* p, size_t n);  // train on n known bytes
+  void enableStats(int every=1);  // collect ComponentStats, see below
+  const ComponentStats* stat(int i);  // component i stats or NULL
   bool isModeled() {    // n>0 components?
     assert(z.header.isize()>6);
     return z.header[6]!=0;
@@ -1146,6 +1199,14 @@ private:
   StateTable st;        // next, cminit functions
   U8* pcode;            // JIT code for predict() and update()
   int pcode_size;       // length of pcode
+  ComponentStats* stats;  // [256] after enableStats(), else NULL
+  int statsEvery;       // stats on 1 byte in statsEvery, interpreted
+  int statsSkip;        // bytes left to code with the JIT before the next
+
+  // Telemetry for enableStats(), called before predict0() and update0()
+  void countFind(ComponentStats& s, Array<U8>& ht, int sizebits, U32 cxt);
+  void statsPredict();
+  void statsUpdate(int y);
 
   // reduce prediction error in cr.cm
   void train(Component& cr, int y) {
@@ -1201,23 +1262,30 @@ public:
   int decompress();  // return a byte or EOF
   int skip();        // skip to the end of the segment, return next byte
   void init();       // initialize at start of block
-  int stat(int x) {return pr.stat(x);}
+  void enableStats(int every=1) {pr.enableStats(every);}
+  const ComponentStats* stat(int i) {return pr.stat(i);}
   int get() {        // return 1 byte of buffered input or EOF
-    if (rpos==wpos) {
-      rpos=0;
-      wpos=in ? in->read(&buf[0], BUFSIZE) : 0;
-      assert(wpos<=BUFSIZE);
-    }
-    return rpos<wpos ? U8(buf[rpos++]) : -1;
+    if (rpos==wpos) refill();
+    return rpos<wpos ? U8(bp[rpos++]) : -1;
   }
   int buffered() {return wpos-rpos;}  // how far read ahead?
+  void setMemory(const char* begin, const char* end);  // read in place
+  void setReader(Reader* r);  // read from r through buf
+  const char* position() const {return bp+rpos;}  // next byte in memory
+  int skipToTag(bool& restart);  // skip buffered input up to a block tag
+  void prime(const char* p, size_t n) {pr.prime(p, n);}  // after init()
 private:
   U32 low, high;     // range
   U32 curr;          // last 4 bytes of archive or remaining bytes in subblock
-  U32 rpos, wpos;    // read, write position in buf
+  U32 rpos, wpos;    // read, write position in bp
   Predictor pr;      // to get p
   enum {BUFSIZE=1<<16};
+  static const int64_t MEMWINDOW=int64_t(1)<<30;  // bytes, < 4 GiB for wpos
   Array<char> buf;   // input buffer of size BUFSIZE bytes
+  const char* bp;    // buf, or the memory window being read
+  const char* mem;   // rest of the memory input after the window, or 0
+  const char* memEnd;
+  void refill();     // read the next window or buffer of input
   int decode(int p); // return decoded bit (0..1) with prob. p (0..65535)
 };
 
@@ -1242,18 +1310,24 @@ public:
 // For decompression and listing archive contents
 class Decompresser {
 public:
-  Decompresser(): z(), dec(z), pp(), state(BLOCK), decode_state(FIRSTSEG) {}
-  void setInput(Reader* in) {dec.in=in;}
+  Decompresser(): z(), dec(z), pp(), state(BLOCK), decode_state(FIRSTSEG),
+    primep(0), primen(0) {}
+  void setInput(Reader* in) {dec.setReader(in);}
+  void setInput(const char* begin, const char* end) {  // read from memory
+    dec.setMemory(begin, end);}
+  const char* position() const {return dec.position();}  // after setInput(begin, end)
   bool findBlock(double* memptr = 0);
   void hcomp(Writer* out2) {z.write(out2, false);}
   bool findFilename(Writer* = 0);
   void readComment(Writer* = 0);
   void setOutput(Writer* out) {pp.setOutput(out);}
   void setSHA1(SHA1* sha1ptr) {pp.setSHA1(sha1ptr);}
-  bool decompress(int n = -1);  // n bytes, -1=all, return true until done
+  bool decompress(int n = -1, Writer* raw = 0);  // n bytes, -1=all, return true until done
+  void setPrime(const char* p, size_t n) {primep=p; primen=n;}  // see Compressor
   bool pcomp(Writer* out2) {return pp.z.write(out2, true);}
   void readSegmentEnd(char* sha1string = 0);
-  int stat(int x) {return dec.stat(x);}
+  void enableStats(int every=1) {dec.enableStats(every);}  // see ComponentStats
+  const ComponentStats* stat(int i) {return dec.stat(i);}
   int buffered() {return dec.buffered();}
   int get() {return dec.get();}
 private:
@@ -1262,12 +1336,18 @@ private:
   PostProcessor pp;
   enum {BLOCK, FILENAME, COMMENT, DATA, SEGEND} state;  // expected next
   enum {FIRSTSEG, SEG, SKIP} decode_state;  // which segment in block?
+  const char* primep;  // model training input, not owned
+  size_t primen;
 };
 
 /////////////////////////// decompress() /////////////////////
 
 void decompress(Reader* in, Writer* out);
 
+// Return the first p in [begin, end) where the 16 byte block tag
+// (13 byte locator tag and "zPQ") starts in full, or end if none.
+const char* findTag(const char* begin, const char* end);
+
 //////////////////////////// Encoder /////////////////////////
 
 // Encoder compresses using an arithmetic code
@@ -1277,7 +1357,9 @@ public:
     out(0), low(1), high(0xFFFFFFFF), pr(z) {}
   void init();
   void compress(int c);  // c is 0..255 or EOF
-  int stat(int x) {return pr.stat(x);}
+  void prime(const char* p, size_t n) {pr.prime(p, n);}  // after init()
+  void enableStats(int every=1) {pr.enableStats(every);}
+  const ComponentStats* stat(int i) {return pr.stat(i);}
   Writer* out;  // destination
 private:
   U32 low, high; // range
@@ -1340,7 +1422,7 @@ private:
 
 class Compressor {
 public:
-  Compressor(): enc(z), in(0), state(INIT), verify(false) {}
+  Compressor(): enc(z), in(0), state(INIT), verify(false), primep(0), primen(0) {}
   void setOutput(Writer* out) {enc.out=out;}
   void writeTag();
   void startBlock(int level);  // level=1,2,3
@@ -1349,6 +1431,7 @@ public:
                   int* args,              // NULL or int[9] arguments
                   Writer* pcomp_cmd = 0); // retrieve preprocessor command
   void setVerify(bool v) {verify = v;}    // check postprocessing?
+  void setPrime(const char* p, size_t n) {primep=p; primen=n;}  // see below
   void hcomp(Writer* out2) {z.write(out2, false);}
   bool pcomp(Writer* out2) {return pz.write(out2, true);}
   void startSegment(const char* filename = 0, const char* comment = 0);
@@ -1360,7 +1443,8 @@ public:
   int64_t getSize() {return sha1.usize();}
   const char* getChecksum() {return sha1.result();}
   void endBlock();
-  int stat(int x) {return enc.stat(x);}
+  void enableStats(int every=1) {enc.enableStats(every);}  // see ComponentStats
+  const ComponentStats* stat(int i) {return enc.stat(i);}
 private:
   ZPAQL z, pz;  // model and test postprocessor
   Encoder enc;  // arithmetic encoder containing predictor
@@ -1369,6 +1453,8 @@ private:
   char sha1result[20];  // sha1 output
   enum {INIT, BLOCK1, SEG1, BLOCK2, SEG2} state;
   bool verify;  // if true then test by postprocessing
+  const char* primep;  // model training input, not owned
+  size_t primen;
 };
 
 /////////////////////////// StringBuffer /////////////////////
@@ -1503,8 +1589,25 @@ void compress(Reader* in, Writer* out, const char* method,
      const char* filename=0, const char* comment=0, bool dosha1=true);
 
 // Same as compress() but output is 1 block, ignoring block size parameter.
+// If stats is not 0, save the statistics of each model component in
+// stats[0..255] (type 0 after the last one), collected on 1 byte in
+// statsEvery, which is coded with the interpreter.
+// If primen>0, the model is first trained on primep[0..primen-1] (see
+// Compressor::setPrime()).
 void compressBlock(StringBuffer* in, Writer* out, const char* method,
-     const char* filename=0, const char* comment=0, bool dosha1=true);
+     const char* filename=0, const char* comment=0, bool dosha1=true,
+     ComponentStats* stats=0, const char* primep=0, size_t primen=0,
+     int statsEvery=1);
+
+// Same as compressBlock() but in is split into parts segments of sizes[i]
+// bytes, named filenames[i] with comments[i] appended to their sizes.
+// BWT methods write one block per part.
+void compressSegments(StringBuffer* in, Writer* out, const char* method,
+     int parts, const unsigned* sizes, const char* const* filenames=0,
+     const char* const* comments=0, bool dosha1=true);
+
+// Return the "x..." or "s..." method compressBlock() would use for in.
+std::string expandMethod(StringBuffer* in, const char* method);
 
 }  // namespace libzpaq
 
@@ -6,9 +6,34 @@
  * It supports various compression levels (0-5, where 0 is no compression and 5 is the highest).
  *
  * Usage:
- *   paqman c <input_file_or_dir> <output_file> [method]  # Compress file or directory (method: 0-5, default 5)
- *   paqman d <input_file> <output_dir>                  # Decompress to directory
+ *   paqman c <input_file_or_dir> <output_file> [method]  # Compress file or directory (method: 0-5 or 5f, default 5)
+ *   paqman c <input_dir> <output_file> --threads 4      # Compress directory blocks in parallel
+ *   paqman c <input> <output_file> --volume-size 4G     # Split into volumes output.001, .002, ...
+ *   paqman c <input_file> <output_file> 4 --seekable    # Small blocks primed with the file's start, for read
+ *   paqman c <tar_file|-> <output_file> --tar           # Compress a tar/pax stream member by member
+ *   paqman d <input_file> <output_dir> [--writer auto]  # Decompress to directory
+ *   paqman d <input_file> <output_dir> --direct         # Decompress, reading the archive with O_DIRECT
+ *   paqman d <input_file> <output_dir> <file...>        # Extract some files, decoding only their blocks
+ *   paqman d <input_file> <output_dir> --recover        # Extract what is intact of a damaged archive
+ *   paqman d <input_file> <tar_file|-> --tar            # Extract as a tar stream
  *   paqman l <input_file>                               # List contents of archive
+ *   paqman scan <file>                                  # Find block tags at memory speed
+ *   paqman read <archive> <file> <offset> <length>...   # Byte ranges of a file, decoding only their blocks
+ *   paqman c <input_file> <output_file> --fast-now      # Compress with level 1, marked for optimize
+ *   paqman optimize [options] <archive>                 # Recompress fast blocks in the background
+ *   paqman merge <output> <archive...>                  # Concatenate archives block by block
+ *   paqman delete <archive> <file...>                   # Remove files or directories from an archive
+ *   paqman subset <archive> <output> <file...>          # Copy some files into a new archive
+ *   paqman serve [--socket <path>] [--threads <n>]      # Compression daemon on a Unix socket
+ *   paqman client c|d <input> <output> [method]         # Run a job on the daemon ('-' for stdin/stdout)
+ *   paqman loadtest [options]                           # Round trips through a local daemon
+ *   paqman bench [options] [files...]                   # In-memory benchmark
+ *   paqman bench-model [options] [file]                 # Per-component model benchmark
+ *   paqman bench-jit [options] [files...]               # JIT vs interpreter check
+ *   paqman corpus <kind> <size> <output_file> [seed]    # Write a synthetic corpus
+ *   paqman stats [options] [file_or_archive]            # Per-component model statistics
+ *   paqman <mode> ... --trace <file.json>               # Per-stage timing and Chrome trace
+ *   paqman <mode> ... --perfctr                         # Per-stage hardware counters
  *   paqman --help                                       # Show help
  *
  * Examples:
@@ -16,6 +41,7 @@
  *   paqman c mydir archive.zpaq 5                 # Compress directory
  *   paqman d archive.zpaq output_dir              # Decompress to directory
  *   paqman l archive.zpaq                         # List archive contents
+ *   paqman bench --levels 1-3 --threads 1,4 --json  # Benchmark levels 1-3
  *
  * Features:
  * - Supports binary and text files.
@@ -25,9 +51,23 @@
  *
  * Dependencies:
  * - libzpaq (included in src/libzpaq.cpp and src/libzpaq.h)
+ * - Benchmark modes in src/bench.cpp, src/modelbench.cpp, src/jitbench.cpp (see src/bench.h)
+ * - Synthetic benchmark corpora in src/corpus.cpp and src/corpus.h
+ * - Adaptive component pruning (method 5f) in src/prune.cpp and src/prune.h
+ * - Lazy recompression (paqman optimize) in src/optimize.cpp and src/optimize.h
+ * - Block scanning of mapped archives in src/archive.cpp, edit commands in src/edit.cpp (see src/edit.h)
+ * - Asynchronous extraction writer (io_uring or threads) in src/extract.cpp and src/extract.h
+ * - Hole and zero run skipping input (sparse files) in src/sparse.cpp and src/sparse.h
+ * - Background read-ahead of archives in src/prefetch.cpp and src/prefetch.h
+ * - Parallel directory scan, content typing and block planning in src/dirscan.cpp and src/dirscan.h
+ * - Multi-volume archives in src/volume.cpp and src/volume.h
+ * - Random access reads with a block index and cache in src/readat.cpp and src/readat.h
+ * - Seekable archives of small primed blocks in src/seekable.cpp and src/seekable.h
+ * - Tar and pax streams in src/tarstream.cpp, file metadata records in src/meta.cpp (see src/tarstream.h, src/meta.h)
+ * - Compression daemon, client and load test (paqman serve) in src/serve.cpp and src/serve.h
  *
  * Compilation:
- *   clang++ src/libzpaq.cpp src/main.cpp -O2 -lpthread -o paqman
+ *   clang++ src/libzpaq.cpp src/bench.cpp src/modelbench.cpp src/jitbench.cpp src/corpus.cpp src/trace.cpp src/perfctr.cpp src/stats.cpp src/prune.cpp src/optimize.cpp src/archive.cpp src/edit.cpp src/extract.cpp src/sparse.cpp src/dirscan.cpp src/prefetch.cpp src/volume.cpp src/readat.cpp src/seekable.cpp src/meta.cpp src/tarstream.cpp src/serve.cpp src/main.cpp -O2 -lpthread -o paqman
  *  __ _ __ _  __ _ ____ _ ____  ___ ______
  * |  | '_ \ / _` |/ __| '_ ` _ \ / _` | '_\
  * | |_) | (_| | (__| | | | | | (_| | | | |
@@ -41,19 +81,61 @@
  */
 
 #include "libzpaq.h"
+#include "archive.h"
+#include "bench.h"
+#include "benchutil.h"
+#include "corpus.h"
+#include "dirscan.h"
+#include "edit.h"
+#include "extract.h"
+#include "meta.h"
+#include "optimize.h"
+#include "prune.h"
+#include "prefetch.h"
+#include "readat.h"
+#include "seekable.h"
+#include "serve.h"
+#include "sparse.h"
+#include "stats.h"
+#include "tarstream.h"
+#include "trace.h"
+#include "volume.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <deque>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 #include <filesystem>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
+// libzpaq calls error() on damaged input and expects it not to return.
+// Threads recovering an archive (paqman d --recover) and the workers of
+// paqman serve set this to get an exception instead, so that only the
+// block or job being decoded is lost, and so does extraction, so that the
+// file being written is removed before paqman exits.
+thread_local bool throwLibzpaqErrors = false;
+
 // Error handling function required by libzpaq
 namespace libzpaq {
     void error(const char* msg) {
+        if (throwLibzpaqErrors) throw std::runtime_error(msg);
         std::fprintf(stderr, "libzpaq Error: %s\n", msg);
         std::exit(1);
     }
@@ -88,6 +170,7 @@ public:
 
     // Override for efficient block reads (optional optimization)
     int read(char* buf, int n) override {
+        trace::Scope stage("read");
         in.read(buf, n);
         return static_cast<int>(in.gcount());
     }
@@ -120,6 +203,7 @@ public:
 
     // Override for efficient block writes (optional optimization)
     void write(const char* buf, int n) override {
+        trace::Scope stage("write");
         out.write(buf, n);
     }
 };
@@ -137,17 +221,143 @@ public:
     }
 };
 
+// --- String Writer ---
+// Appends to a string (used to hold the segments of a recovered block).
+class StringWriter : public libzpaq::Writer {
+public:
+    explicit StringWriter(std::string& s) : s(s) {}
+    void put(int c) override { s.push_back(char(c)); }
+    void write(const char* buf, int n) override { s.append(buf, n); }
+
+private:
+    std::string& s;
+};
+
+// --- Volumes ---
+// Names the parts written by a volume::Writer with a volume size.
+void reportVolumes(const std::string& output, int parts, uint64_t volumeSize) {
+    if (volumeSize == 0) return;
+    std::cout << "Wrote " << parts << " volumes of up to " << volumeSize << " bytes: " << output << ".001"
+              << (parts > 1 ? " to " + volume::parts(output + ".001").back() : std::string()) << "\n";
+}
+
 // --- Compression ---
 // Compresses the input file to the output file using the specified ZPAQ method.
 // Method: "0" to "5" (0=store, 5=best compression).
-void compressFile(const std::string& input, const std::string& output, const std::string& method = "5") {
+// The file is split into blocks of 16 MiB as libzpaq::compress() does; only
+// the first block's segment carries the filename. Holes and aligned zero
+// runs are left out and listed in the block's comment (see sparse.h); a
+// file that ends in a hole gets an empty last block for it. If fast, every
+// block's comment is marked for `paqman optimize` (see optimize.h).
+void compressFile(const std::string& input, const std::string& output, const std::string& method = "5",
+                  bool fast = false, uint64_t volumeSize = 0) {
     std::cout << "Compressing: " << input << " -> " << output << " (method: " << method << ")\n";
 
-    FileReader in(input);
-    FileWriter out(output);
+    sparse::Reader in(input);
+    volume::Writer out(output, volumeSize);
 
-    // Use libzpaq to compress
-    libzpaq::compress(&in, &out, method.c_str(), input.c_str(), nullptr, true);  // Include filename in archive
+    const int bs = (0x100000 << 4) - 4096;
+    libzpaq::StringBuffer sb(bs), archive;
+    sb.write(0, bs);
+    int block = 0;
+    for (bool more = true; more; ++block) {
+        const int n = in.read(reinterpret_cast<char*>(sb.data()), bs);
+        const std::vector<sparse::Run> runs = in.takeRuns();
+        if (n == 0 && runs.empty()) break;
+        more = n > 0;
+        trace::setBlock(block);
+        sb.resize(n);
+        const char* filename = block == 0 ? input.c_str() : nullptr;
+        // compressBlock() puts the size and a space before it
+        const std::string note = sparse::formatRuns(runs) + (fast ? kFastComment : "");
+        const char* comment = note.empty() ? nullptr : note.c_str() + 1;
+        if (method == "5f") {
+            prune::BlockReport r = prune::compressBlockAdaptive(&sb, &archive, "5", filename, comment, true);
+            std::cout << "Block " << block << ": " << r.components - r.dropped << " of " << r.components
+                      << " components after a " << r.probeBytes << " byte probe: " << r.slimMethod << "\n";
+        } else {
+            libzpaq::compressBlock(&sb, &archive, method.c_str(), filename, comment, true);
+        }
+        out.write(archive.c_str(), static_cast<int>(archive.size()));
+        out.endBlock();
+        archive.resize(0);
+        sb.resize(0);
+    }
+    trace::setBlock(-1);
+    if (in.skipped() > 0) std::cout << "Skipped " << in.skipped() << " bytes of holes and zeros\n";
+    reportVolumes(output, out.finish(), volumeSize);
+
+    std::cout << "Compression complete: " << output << "\n";
+}
+
+// --- Seekable Compression ---
+// Compresses the input file as compressFile() does into a seekable archive
+// (see seekable.h): the first primeSize data bytes go in a block of their
+// own, and the rest in blocks of up to blockSize bytes, each coded by a
+// model trained on the prime. The blocks are coded on threads, 4 per
+// thread at a time, and written in order.
+void compressSeekable(const std::string& input, const std::string& output, const std::string& method,
+                      size_t blockSize, size_t primeSize, int threads, uint64_t volumeSize = 0) {
+    std::cout << "Compressing: " << input << " -> " << output << " (method: " << method << ", seekable blocks of "
+              << blockSize << " bytes, " << primeSize << " byte prime)\n";
+
+    sparse::Reader in(input);
+    volume::Writer out(output, volumeSize);
+
+    struct Piece {
+        libzpaq::StringBuffer data, archive;
+        std::string note;
+    };
+    std::vector<Piece> window(4 * size_t(threads));
+    std::string prime;
+    std::mutex m;
+    std::string error;
+    int block = 0;
+    for (bool more = true; more;) {
+        size_t n = 0;
+        while (n < window.size() && more) {
+            Piece& p = window[n];
+            const size_t size = block + n == 0 ? primeSize : blockSize;
+            p.data.resize(0);
+            p.data.write(0, static_cast<int>(size));
+            const int got = in.read(reinterpret_cast<char*>(p.data.data()), static_cast<int>(size));
+            const std::vector<sparse::Run> runs = in.takeRuns();
+            more = got > 0;
+            if (got == 0 && runs.empty()) break;
+            p.data.resize(got);
+            if (block + n == 0) {
+                prime.assign(reinterpret_cast<const char*>(p.data.data()), got);
+                p.note = sparse::formatRuns(runs) + seekable::primeNote();
+            } else {
+                p.note = sparse::formatRuns(runs) + (prime.empty() ? "" : seekable::primedNote(prime.size()));
+            }
+            ++n;
+        }
+        benchutil::parallelFor(n, threads, [&](size_t i) {
+            trace::setBlock(block + static_cast<int>(i));
+            try {
+                const bool primed = block + i > 0;
+                const char* comment = window[i].note.empty() ? nullptr : window[i].note.c_str() + 1;
+                libzpaq::compressBlock(&window[i].data, &window[i].archive, method.c_str(),
+                                       block + i == 0 ? input.c_str() : nullptr, comment, true, nullptr,
+                                       primed ? prime.data() : nullptr, primed ? prime.size() : 0);
+            } catch (const std::exception& e) {
+                std::lock_guard<std::mutex> lock(m);
+                if (error.empty()) error = e.what();
+            }
+            trace::setBlock(-1);
+        });
+        if (!error.empty()) throw std::runtime_error(error);
+        for (size_t i = 0; i < n; ++i) {
+            out.write(window[i].archive.c_str(), static_cast<int>(window[i].archive.size()));
+            out.endBlock();
+            window[i].archive.resize(0);
+        }
+        block += static_cast<int>(n);
+    }
+    if (in.skipped() > 0) std::cout << "Skipped " << in.skipped() << " bytes of holes and zeros\n";
+    std::cout << "Wrote " << block << " blocks after a " << prime.size() << " byte prime\n";
+    reportVolumes(output, out.finish(), volumeSize);
 
     std::cout << "Compression complete: " << output << "\n";
 }
@@ -157,7 +367,7 @@ void compressFile(const std::string& input, const std::string& output, const std
 void decompressFile(const std::string& input, const std::string& output) {
     std::cout << "Decompressing: " << input << " -> " << output << "\n";
 
-    FileReader in(input);
+    prefetch::Reader in(input);
     FileWriter out(output);
 
     // Use libzpaq to decompress
@@ -167,156 +377,1339 @@ void decompressFile(const std::string& input, const std::string& output) {
 }
 
 // --- Compress Directory ---
+// Writes the blocks of compressDirectory() in plan order while they are
+// coded in parallel. The first unfinished block goes straight to the file;
+// later ones are buffered, and their threads wait once that reaches
+// kMaxPending until their block is first. A job may code several ZPAQ
+// blocks; endBlock() marks where each ends, for the volume boundaries.
+class BlockOrder {
+public:
+    BlockOrder(volume::Writer& out, size_t blocks) : out(out), pending(blocks), cuts(blocks), done(blocks, false) {}
+
+    // Adds a block after the others and returns its number, for callers
+    // that do not know how many blocks there will be.
+    size_t add() {
+        std::lock_guard<std::mutex> lock(m);
+        pending.emplace_back();
+        cuts.emplace_back();
+        done.push_back(false);
+        return done.size() - 1;
+    }
+
+    void write(size_t block, const char* buf, int n) {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] { return block == head || pending[block].size() < kMaxPending; });
+        if (block == head) {
+            flush(block);
+            out.write(buf, n);
+        } else {
+            pending[block].append(buf, n);
+        }
+    }
+
+    void endBlock(size_t block) {
+        std::lock_guard<std::mutex> lock(m);
+        if (block == head) {
+            flush(block);
+            out.endBlock();
+        } else {
+            cuts[block].push_back(pending[block].size());
+        }
+    }
+
+    void finish(size_t block) {
+        std::lock_guard<std::mutex> lock(m);
+        done[block] = true;
+        while (head < done.size() && (flush(head), done[head])) ++head;
+        cv.notify_all();
+    }
+
+private:
+    static const size_t kMaxPending = 64 << 20;
+    volume::Writer& out;
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<std::string> pending;
+    std::vector<std::vector<size_t>> cuts;  // block ends in pending
+    std::vector<bool> done;
+    size_t head = 0;
+
+    void flush(size_t block) {
+        std::string& p = pending[block];
+        size_t from = 0;
+        for (size_t cut : cuts[block]) {
+            out.write(p.data() + from, static_cast<int>(cut - from));
+            out.endBlock();
+            from = cut;
+        }
+        if (from < p.size()) out.write(p.data() + from, static_cast<int>(p.size() - from));
+        std::string().swap(p);
+        cuts[block].clear();
+    }
+};
+
+// Output of one block for BlockOrder.
+class BlockWriter : public libzpaq::Writer {
+public:
+    BlockWriter(BlockOrder& order, size_t block) : order(order), block(block) {}
+    void put(int c) override {
+        buf.push_back(char(c));
+        if (buf.size() >= 1 << 16) flush();
+    }
+    void write(const char* p, int n) override {
+        buf.append(p, n);
+        if (buf.size() >= 1 << 16) flush();
+    }
+    void flush() {
+        if (!buf.empty()) order.write(block, buf.data(), static_cast<int>(buf.size()));
+        buf.clear();
+    }
+    void endBlock() {
+        flush();
+        order.endBlock(block);
+    }
+
+private:
+    BlockOrder& order;
+    size_t block;
+    std::string buf;
+};
+
 // Compresses all files in the input directory recursively to the output file.
-void compressDirectory(const std::string& inputDir, const std::string& output, const std::string& method = "5") {
+// The tree is scanned and the files grouped into blocks by dirscan, one
+// content type per block (sorted by extension and size within it); threads
+// code the blocks largest first, and the blocks are written in that order.
+// Each block is coded with the method's level and the type hint of its
+// files. A file larger than a block is split into blocks as compressFile()
+// does, without the hole skipping. The mode, owner ids and modification
+// time of every file, directory and symlink are kept in its first
+// segment's comment (see meta.h), so extraction can restore them;
+// directories and symlinks are segments without data in a last block.
+void compressDirectory(const std::string& inputDir, const std::string& output, const std::string& method = "5",
+                       int threads = 1, uint64_t volumeSize = 0) {
     std::cout << "Compressing directory: " << inputDir << " -> " << output << " (method: " << method << ")\n";
 
-    libzpaq::Compressor c;
-    c.setOutput(new FileWriter(output));
-    c.startBlock(atoi(method.c_str()));  // Use level based on method
+    std::vector<dirscan::Entry> files = dirscan::walk(inputDir, threads);
+    const std::vector<dirscan::Job> jobs = dirscan::plan(files, threads);
+    uint64_t total = 0;
+    size_t others = 0;
+    for (const dirscan::Job& j : jobs) total += j.bytes;
+    for (const dirscan::Entry& e : files) others += e.meta.type != meta::FILE;
+    std::cout << "Scanned " << files.size() - others << " files and " << others << " directories and links, "
+              << total << " bytes in " << jobs.size() << " blocks, " << threads << " threads\n";
 
-    // Recursively add files
-    for (const auto& entry : fs::recursive_directory_iterator(inputDir)) {
-        if (entry.is_regular_file()) {
-            std::string relativePath = fs::relative(entry.path(), inputDir).string();
-            std::cout << "Adding: " << relativePath << "\n";
+    volume::Writer out(output, volumeSize);
+    BlockOrder order(out, jobs.size());
+    std::mutex print;
+    std::string error;
+    const int bs = (0x100000 << 4) - 4096;
+    benchutil::parallelFor(jobs.size(), threads, [&](size_t j) {
+        trace::setBlock(static_cast<int>(j));
+        try {
+            const dirscan::Job& job = jobs[j];
+            const std::string m = dirscan::method(job, method[0]);
+            {
+                std::lock_guard<std::mutex> lock(print);
+                if (!error.empty()) throw std::runtime_error(error);
+                const bool data = files[job.files[0]].meta.type == meta::FILE;
+                std::cout << "Block " << j << ": " << job.files.size() << " "
+                          << (data ? std::string(dirscan::typeName(job.type)) + " files" : "directories and links")
+                          << ", " << job.bytes << " bytes, method " << m << "\n";
+                for (size_t i : job.files) std::cout << "Adding: " << files[i].name << "\n";
+            }
+            BlockWriter w(order, j);
+            libzpaq::StringBuffer sb;
+            if (job.files.size() == 1 && job.bytes >= uint64_t(bs)) {
+                const dirscan::Entry& e = files[job.files[0]];
+                const std::string record = meta::format(e.meta).substr(1);  // after the size
+                FileReader in(e.path);
+                sb.write(0, bs);
+                for (int n, piece = 0; (n = in.read(reinterpret_cast<char*>(sb.data()), bs)) > 0; ++piece) {
+                    sb.resize(n);
+                    libzpaq::compressBlock(&sb, &w, m.c_str(), piece == 0 ? e.name.c_str() : nullptr,
+                                           piece == 0 ? record.c_str() : nullptr, true);
+                    w.endBlock();
+                    sb.resize(0);
+                    sb.write(0, bs);
+                }
+            } else {
+                std::vector<unsigned> sizes;
+                std::vector<const char*> names, comments;
+                std::vector<std::string> records;
+                char buf[1 << 16];
+                for (size_t i : job.files) {
+                    const size_t before = sb.size();
+                    if (files[i].meta.type == meta::FILE) {
+                        FileReader in(files[i].path);
+                        for (int n; (n = in.read(buf, sizeof(buf))) > 0;) sb.write(buf, n);
+                    }
+                    sizes.push_back(static_cast<unsigned>(sb.size() - before));
+                    names.push_back(files[i].name.c_str());
+                    records.push_back(meta::format(files[i].meta).substr(1));
+                }
+                for (const std::string& r : records) comments.push_back(r.c_str());
+                libzpaq::compressSegments(&sb, &w, m.c_str(), static_cast<int>(sizes.size()), sizes.data(),
+                                          names.data(), comments.data());
+                w.endBlock();
+            }
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(print);
+            if (error.empty()) error = e.what();
+        }
+        try {
+            order.finish(j);
+        } catch (const std::exception& e) {  // a write error of a volume
+            std::lock_guard<std::mutex> lock(print);
+            if (error.empty()) error = e.what();
+        }
+        trace::setBlock(-1);
+    });
+    if (!error.empty()) throw std::runtime_error(error);
+    reportVolumes(output, out.finish(), volumeSize);
+
+    std::cout << "Directory compression complete: " << output << "\n";
+}
 
-            c.startSegment(relativePath.c_str());
-            FileReader in(entry.path().string());
-            c.setInput(&in);
-            while (c.compress(1000000));  // Compress in chunks
-            c.endSegment();
+// --- Compress Tar Stream ---
+// Compresses a tar or pax stream (see tarstream.h) from the input file, or
+// from standard input for "-", without unpacking it. Each member becomes a
+// segment named by its path, with its metadata in the comment (see
+// meta.h); directories, links and special files are segments without
+// data. Members are packed into blocks of up to 16 MiB in stream order as
+// they arrive, a member that does not fit continuing in the next block,
+// and threads code each block as soon as it is full while the stream is
+// read on. Blocks are written in order by BlockOrder.
+void compressTar(const std::string& input, const std::string& output, const std::string& method = "5",
+                 int threads = 1, uint64_t volumeSize = 0) {
+    std::cout << "Compressing tar stream: " << (input == "-" ? "standard input" : input) << " -> " << output
+              << " (method: " << method << ")\n";
+
+    const int fd = input == "-" ? 0 : ::open(input.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open input file: " + input);
+    struct Closer {
+        int fd;
+        ~Closer() {
+            if (fd > 0) ::close(fd);
         }
+    } closer{fd};
+    tarstream::Reader in(fd);
+    volume::Writer out(output, volumeSize);
+    BlockOrder order(out, 0);
+
+    struct Job {
+        size_t block = 0;
+        libzpaq::StringBuffer data;
+        std::vector<unsigned> sizes;
+        std::vector<std::string> names, comments;  // empty name: continues the last file
+    };
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<std::unique_ptr<Job>> queue;
+    bool closed = false;
+    std::string error;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            for (;;) {
+                std::unique_ptr<Job> job;
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    cv.wait(lock, [&] { return !queue.empty() || closed; });
+                    if (queue.empty()) return;
+                    job = std::move(queue.front());
+                    queue.pop_front();
+                    cv.notify_all();
+                }
+                trace::setBlock(static_cast<int>(job->block));
+                try {
+                    std::vector<const char*> names, comments;
+                    for (size_t i = 0; i < job->sizes.size(); ++i) {
+                        names.push_back(job->names[i].empty() ? nullptr : job->names[i].c_str());
+                        comments.push_back(job->comments[i].empty() ? nullptr : job->comments[i].c_str());
+                    }
+                    BlockWriter w(order, job->block);
+                    libzpaq::compressSegments(&job->data, &w, method.c_str(), static_cast<int>(job->sizes.size()),
+                                              job->sizes.data(), names.data(), comments.data());
+                    w.endBlock();
+                } catch (const std::exception& e) {
+                    std::lock_guard<std::mutex> lock(m);
+                    if (error.empty()) error = e.what();
+                }
+                try {
+                    order.finish(job->block);
+                } catch (const std::exception& e) {  // a write error of a volume
+                    std::lock_guard<std::mutex> lock(m);
+                    if (error.empty()) error = e.what();
+                }
+                trace::setBlock(-1);
+            }
+        });
     }
+    auto stop = [&] {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            closed = true;
+        }
+        cv.notify_all();
+        for (std::thread& t : workers) t.join();
+    };
 
-    c.endBlock();
-    std::cout << "Directory compression complete: " << output << "\n";
+    // At most one block per thread waits in the queue
+    auto submit = [&](std::unique_ptr<Job> job) {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] { return queue.size() < size_t(threads) || !error.empty(); });
+        if (!error.empty()) throw std::runtime_error(error);
+        job->block = order.add();
+        queue.push_back(std::move(job));
+        cv.notify_all();
+    };
+
+    const unsigned bs = (0x100000 << 4) - 4096;
+    uint64_t members = 0, bytes = 0;
+    int blocks = 0;
+    try {
+        std::unique_ptr<Job> job(new Job);
+        tarstream::Member member;
+        while (in.next(member)) {
+            if (member.name.empty()) continue;  // the top directory, "./"
+            ++members;
+            bytes += member.size;
+            uint64_t left = member.size;
+            for (bool first = true; first || left > 0; first = false) {
+                if (job->data.size() == bs) {
+                    submit(std::move(job));
+                    job.reset(new Job);
+                    ++blocks;
+                }
+                const unsigned take = static_cast<unsigned>(std::min<uint64_t>(left, bs - job->data.size()));
+                const size_t at = job->data.size();
+                job->data.write(nullptr, static_cast<int>(take));
+                for (size_t got = 0; got < take;) {
+                    const size_t n = in.read(reinterpret_cast<char*>(job->data.data()) + at + got, take - got);
+                    if (n == 0) throw std::runtime_error("Tar member " + member.name + " ends early");
+                    got += n;
+                }
+                job->sizes.push_back(take);
+                job->names.push_back(first ? member.name : std::string());
+                // compressSegments() puts the size and a space before it
+                job->comments.push_back(first ? meta::format(member.meta).substr(1) : std::string());
+                left -= take;
+            }
+        }
+        if (!job->sizes.empty()) {
+            submit(std::move(job));
+            ++blocks;
+        }
+    } catch (...) {
+        stop();
+        throw;
+    }
+    stop();
+    if (!error.empty()) throw std::runtime_error(error);
+    std::cout << "Read " << members << " members, " << bytes << " bytes of data from a " << in.bytes()
+              << " byte stream into " << blocks << " blocks, " << threads << " threads\n";
+    reportVolumes(output, out.finish(), volumeSize);
+
+    std::cout << "Tar compression complete: " << output << "\n";
+}
+
+// --- Extract Segment ---
+// Decodes the data of the segment whose comment was just read into the
+// current file of out, restoring the zero runs the comment lists. named is
+// true for a segment that starts a file, for the primer (see seekable.h).
+// Throws if the data does not match the segment's SHA-1, after telling out
+// to remove the file, so a damaged file is not left as if it were good.
+void extractSegment(libzpaq::Decompresser& d, extract::Sink& out, const libzpaq::StringBuffer& comment,
+                    seekable::Primer& primer, bool named, const std::string& file) {
+    // compressBlock() starts the comment with the segment's size,
+    // which does not count the zero runs left out (see sparse.h)
+    const std::string text(comment.c_str(), comment.size());
+    const std::vector<sparse::Run> runs = sparse::parseRuns(text);
+    out.holes(runs);
+    if (runs.empty()) out.expect(std::strtoull(text.c_str(), nullptr, 10));
+    d.setOutput(primer.segment(d, named, text, &out));
+    try {
+        archive::decodeSegment(d, text, file);
+    } catch (const std::exception&) {
+        out.discard();
+        throw;
+    }
 }
 
+// --- Special Files ---
+// Creates the directories, links and special files that the metadata
+// records of segments describe (see meta.h) below a directory, and gives
+// them and the regular files the attributes of their records. Nothing is
+// created outside the directory: names lose a leading "/" and "../" as in
+// tar, other names with ".." are refused, and no path goes through a
+// symlink (see extract::makeDirectories()). finish() makes the hard links
+// once the files they name have been written, then the symlinks, so no
+// file is written through one, and gives directories their attributes
+// last, deepest first, as writing into a directory changes its time and
+// may need the permission its mode takes.
+class Specials {
+public:
+    explicit Specials(const std::string& outputDir) : dir(outputDir) {}
+
+    // Creates name from the record in its first segment's comment. Returns
+    // false for a regular file, which is extracted as data.
+    bool extract(const std::string& name, const std::string& comment) {
+        meta::Record r;
+        if (!meta::parse(comment, r) || r.type == meta::FILE) return false;
+        const std::string rel = below(name);
+        switch (r.type) {
+        case meta::DIR:
+            extract::makeDirectories(dir, rel);
+            dirs.emplace_back(rel, r);
+            break;
+        case meta::SYMLINK:
+            symlinks.emplace_back(rel, r);
+            break;
+        case meta::HARDLINK:
+            links.emplace_back(below(r.link), rel);
+            break;
+        default:
+            std::cerr << "\33[31mSkipped: \33[0m" << name << " (device or FIFO)\n";
+        }
+        return true;
+    }
+
+    // Starts the regular file name in out, with the attributes of the
+    // record in comment if it has one. A damaged record is ignored, as the
+    // data may still be good.
+    void open(extract::Sink& out, const std::string& name, const std::string& comment) {
+        out.open(dir, below(name));
+        meta::Record r;
+        try {
+            if (meta::parse(comment, r)) out.attributes(r);
+        } catch (const std::runtime_error&) {
+        }
+    }
+
+    void finish() {
+        for (const auto& l : links) {
+            const std::string target = dir + "/" + l.first, path = replace(l.second);
+            if (throughLink(l.first)) {
+                throw std::runtime_error("Cannot link " + path + " to " + target + ": symlink in path");
+            }
+            if (::link(target.c_str(), path.c_str()) != 0) {
+                throw std::runtime_error("Cannot link " + path + " to " + target + ": " + std::strerror(errno));
+            }
+        }
+        links.clear();
+        for (const auto& l : symlinks) {
+            const std::string path = replace(l.first);
+            if (::symlink(l.second.link.c_str(), path.c_str()) != 0) {
+                throw std::runtime_error("Cannot create symlink " + path + ": " + std::strerror(errno));
+            }
+            setAttributes(path, l.second);
+        }
+        symlinks.clear();
+        std::sort(dirs.begin(), dirs.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+        for (const auto& d : dirs) setAttributes(dir + "/" + d.first, d.second);
+        dirs.clear();
+    }
+
+private:
+    std::string dir;
+    std::vector<std::pair<std::string, std::string>> links;  // target, link
+    std::vector<std::pair<std::string, meta::Record>> symlinks, dirs;
+
+    // name without a leading "/" and "../", as tar extracts it. Throws if
+    // it still has a ".." component.
+    static std::string below(std::string name) {
+        for (;;) {
+            if (name.compare(0, 1, "/") == 0) name.erase(0, 1);
+            else if (name.compare(0, 2, "./") == 0) name.erase(0, 2);
+            else if (name.compare(0, 3, "../") == 0) name.erase(0, 3);
+            else break;
+        }
+        if (!meta::isBelow(name)) throw std::runtime_error("Unsafe file name in archive: " + name);
+        return name;
+    }
+
+    // Creates the parents of rel and removes what is in its place, unless
+    // a directory. Returns its path.
+    std::string replace(const std::string& rel) {
+        const size_t slash = rel.rfind('/');
+        if (slash != std::string::npos) extract::makeDirectories(dir, rel.substr(0, slash));
+        const std::string path = dir + "/" + rel;
+        struct stat st;
+        if (::lstat(path.c_str(), &st) == 0 && !S_ISDIR(st.st_mode) && ::unlink(path.c_str()) != 0) {
+            throw std::runtime_error("Cannot remove " + path + ": " + std::strerror(errno));
+        }
+        return path;
+    }
+
+    // Whether a directory above rel is a symlink, which may lead outside.
+    bool throughLink(const std::string& rel) const {
+        for (size_t slash = rel.find('/'); slash != std::string::npos; slash = rel.find('/', slash + 1)) {
+            struct stat st;
+            if (::lstat((dir + "/" + rel.substr(0, slash)).c_str(), &st) == 0 && S_ISLNK(st.st_mode)) return true;
+        }
+        return false;
+    }
+
+    static void setAttributes(const std::string& path, const meta::Record& r) {
+        if (int e = extract::setAttributes(path, r)) {
+            throw std::runtime_error("Cannot set attributes of " + path + ": " + std::strerror(e));
+        }
+    }
+};
+
 // --- Decompress to Directory ---
 // Decompresses the input ZPAQ file to the output directory, preserving structure.
-void decompressToDirectory(const std::string& input, const std::string& outputDir) {
+// A segment with an empty filename continues the previous file, as written by
+// compressFile() for files larger than one block. The archive, or all its
+// volumes in turn, is read ahead on other threads (with O_DIRECT if
+// direct), and files are written by an
+// extract::Sink with the given backend, so decoding waits for neither.
+void decompressToDirectory(const std::string& input, const std::string& outputDir,
+                           extract::Backend writer = extract::AUTO, bool direct = false) {
+    throwLibzpaqErrors = true;
     std::cout << "Decompressing: " << input << " -> " << outputDir << "\n";
 
     // Create output directory if it doesn't exist
     fs::create_directories(outputDir);
 
-    FileReader in(input);
+    volume::Reader in(volume::parts(input), direct);
     libzpaq::Decompresser d;
     d.setInput(&in);
 
+    extract::Sink out(writer);
+    std::cout << "Writer: " << out.describe() << "\n";
+    seekable::Primer primer;
+    Specials specials(outputDir);
+    NullWriter none;
     double memory = 0;
-    if (!d.findBlock(&memory)) {
+    int block = 0;
+    bool started = false, special = false;
+    std::string filename;
+    for (; d.findBlock(&memory); ++block) {
+        trace::setBlock(block);
+        libzpaq::StringBuffer name, comment;
+        while (d.findFilename(&name)) {
+            d.readComment(&comment);
+            const bool named = name.size() > 0 || !started;
+            if (named) {
+                filename.assign(name.c_str(), name.size());
+                if (filename.empty()) throw std::runtime_error("Segment without filename in " + input);
+                const std::string text(comment.c_str(), comment.size());
+                special = specials.extract(filename, text);
+                if (!special) specials.open(out, filename, text);
+                started = true;
+                std::cout << "Extracted: " << filename << "\n";
+            }
+            if (special) {
+                d.setOutput(&none);
+                while (d.decompress(1000000));
+                d.readSegmentEnd();
+            } else {
+                extractSegment(d, out, comment, primer, named, filename);
+            }
+            name.reset();
+            comment.reset();
+        }
+    }
+    trace::setBlock(-1);
+    out.finish();
+    specials.finish();
+    if (block == 0) {
         throw std::runtime_error("\33[31mNo valid ZPAQ block found in " + input + "\33[0m");
     }
 
-    while (d.findFilename()) {
-        // Get filename
-        std::string filename;
-        {
-            char buf[4096];
-            int len = 0;
-            while ((buf[len] = d.get()) != -1 && len < 4095) ++len;
-            buf[len] = 0;
-            filename = buf;
+    std::cout << "Directory decompression complete: " << outputDir << "\n";
+}
+
+// --- Decompress to Tar Stream ---
+// Adds the zero runs left out of a segment (see sparse.h) back into its
+// data as zeros on the way to a tar member.
+class TarData : public libzpaq::Writer {
+public:
+    TarData(tarstream::Writer& tar, std::vector<sparse::Run> runs) : tar(tar), runs(std::move(runs)) {}
+    void put(int c) override {
+        const char b = char(c);
+        write(&b, 1);
+    }
+    void write(const char* buf, int n) override {
+        while (n > 0) {
+            zeros();
+            const int take = next < runs.size() ? int(std::min<uint64_t>(n, runs[next].pos - at)) : n;
+            tar.write(buf, take);
+            at += take;
+            buf += take;
+            n -= take;
         }
+    }
+    void finish() { zeros(); }
 
-        // Create full output path
-        fs::path outPath = fs::path(outputDir) / filename;
-        fs::create_directories(outPath.parent_path());
+private:
+    tarstream::Writer& tar;
+    std::vector<sparse::Run> runs;
+    size_t next = 0;
+    uint64_t at = 0;  // data bytes so far
 
-        // Set output to file
-        FileWriter out(outPath.string());
-        d.setOutput(&out);
+    void zeros() {
+        static const char zero[1 << 16] = {};
+        for (; next < runs.size() && runs[next].pos <= at; ++next) {
+            for (uint64_t left = runs[next].length; left > 0;) {
+                const size_t k = size_t(std::min<uint64_t>(left, sizeof(zero)));
+                tar.write(zero, k);
+                left -= k;
+            }
+        }
+    }
+};
 
-        // Decompress segment
-        while (d.decompress(1000000));
+// Writes the files of the input archive, or of all its volumes, as a tar
+// stream to the output file, or to standard output for "-", instead of
+// to a directory. A tar header needs the size of its file, so the archive
+// is mapped and scanned first and each file's size summed from the sizes
+// and zero runs in its segments' comments. Metadata comes from the records
+// of `c --tar` (see meta.h); other files get mode 644 and the archive's
+// modification time. Zero runs are written as zeros. If a segment fails
+// its SHA-1 check, the output file is removed.
+void decompressToTar(const std::string& input, const std::string& output) {
+    throwLibzpaqErrors = true;
+    std::ostream& log = output == "-" ? std::cerr : std::cout;
+    log << "Decompressing: " << input << " -> " << (output == "-" ? "standard output" : output) << " (tar)\n";
 
-        // Read segment end
-        char sha1[21];
-        d.readSegmentEnd(sha1);
+    std::vector<std::unique_ptr<archive::Mapping>> parts;
+    for (const std::string& part : volume::parts(input)) parts.emplace_back(new archive::Mapping(part));
+    if (parts.empty()) throw std::runtime_error("Cannot open archive: " + input);
+    struct stat st;
+    meta::Record plain;
+    if (::stat(volume::parts(input)[0].c_str(), &st) == 0) plain.mtime = st.st_mtime;
 
-        std::cout << "Extracted: " << filename << "\n";
+    std::vector<tarstream::Member> members;
+    for (const auto& part : parts) {
+        for (const archive::Block& b : archive::scan(*part)) {
+            for (const archive::Segment& seg : b.segments) {
+                if (seg.named || members.empty()) {
+                    if (seg.file.empty()) throw std::runtime_error("Segment without filename in " + input);
+                    tarstream::Member m;
+                    m.name = seg.file;
+                    m.meta = plain;
+                    meta::parse(seg.comment, m.meta);
+                    members.push_back(m);
+                }
+                if (seg.comment.empty() || !std::isdigit(static_cast<unsigned char>(seg.comment[0]))) {
+                    throw std::runtime_error("A segment of " + seg.file + " has no size; extract to a directory");
+                }
+                uint64_t size = std::strtoull(seg.comment.c_str(), nullptr, 10);
+                for (const sparse::Run& r : sparse::parseRuns(seg.comment)) size += r.length;
+                members.back().size += size;
+            }
+        }
     }
 
-    std::cout << "Directory decompression complete: " << outputDir << "\n";
+    const int fd = output == "-" ? 1 : ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("Cannot open output file: " + output);
+    struct Closer {
+        int fd;
+        const char* path;  // removed unless written completely
+        ~Closer() {
+            if (fd > 1) ::close(fd);
+            if (path) ::unlink(path);
+        }
+    } closer{fd, fd > 1 ? output.c_str() : nullptr};
+    tarstream::Writer tar(fd);
+    seekable::Primer primer;
+    size_t next = 0;  // member
+    int block = 0;
+    for (const auto& part : parts) {
+        libzpaq::Decompresser d;
+        d.setInput(part->data(), part->data() + part->size());
+        for (; d.findBlock(); ++block) {
+            trace::setBlock(block);
+            libzpaq::StringBuffer name, comment;
+            while (d.findFilename(&name)) {
+                d.readComment(&comment);
+                const std::string text(comment.c_str(), comment.size());
+                const bool named = name.size() > 0 || next == 0;
+                if (named) {
+                    if (next == members.size()) throw std::runtime_error(input + " changed while reading it");
+                    if (next > 0) tar.end();
+                    tar.begin(members[next]);
+                    log << "Extracted: " << members[next++].name << "\n";
+                }
+                TarData data(tar, sparse::parseRuns(text));
+                d.setOutput(primer.segment(d, named, text, &data));
+                archive::decodeSegment(d, text, members[next - 1].name);
+                data.finish();
+                name.reset();
+                comment.reset();
+            }
+        }
+    }
+    trace::setBlock(-1);
+    if (next > 0) tar.end();
+    tar.finish();
+    closer.fd = -1;
+    if (fd > 1 && ::close(fd) != 0) throw std::runtime_error("Cannot write " + output);
+    closer.path = nullptr;
+
+    log << "Wrote " << next << " members, " << tar.bytes() << " bytes of tar: " << output << "\n";
 }
 
-// --- List Archive Contents ---
-// Lists the contents of the input ZPAQ file without extracting.
-void listArchiveContents(const std::string& input) {
-    std::cout << "Listing contents of: " << input << "\n";
+// --- Recover Damaged Archive ---
+// One segment found by recoverRange().
+struct RecoveredSegment {
+    std::string name;     // empty for a continuation of the previous file
+    std::string comment;
+    std::string data;
+    std::string problem;  // empty if it decoded and its SHA-1 matched
+    bool decoded = false;  // data is complete, if maybe wrong
+};
 
-    FileReader in(input);
-    libzpaq::Decompresser d;
-    d.setInput(&in);
+// The segments of the blocks between two block tags.
+struct RecoveredRange {
+    uint64_t offset = 0;
+    std::vector<RecoveredSegment> segments;
+    std::string problem;  // why the blocks after the last segment are unknown
+};
 
-    double memory = 0;
-    if (!d.findBlock(&memory)) {
-        throw std::runtime_error("\33[31mNo valid ZPAQ block found in " + input + "\33[0m");
+// Decodes the blocks in [begin, end) of a mapped archive, each with a new
+// Decompresser. When a segment fails, the rest of its block cannot be
+// decoded, as the model state carries over, but a pass over the block's
+// headers still names the files that are lost, and decoding goes on after
+// it. Only a block whose headers are damaged too ends the range early. A
+// primed block (see seekable.h) is decoded with the data primeOf() returns,
+// which is null if the prime is lost.
+RecoveredRange recoverRange(const char* begin, const char* end, uint64_t offset,
+                            const std::function<std::shared_ptr<const std::string>()>& primeOf) {
+    throwLibzpaqErrors = true;
+    RecoveredRange r;
+    r.offset = offset;
+    std::shared_ptr<const std::string> prime;
+    for (const char* at = begin; at < end;) {
+        const size_t first = r.segments.size();
+        bool inData = false;  // the last segment is being decoded
+        std::string why;
+        try {
+            libzpaq::Decompresser d;
+            d.setInput(at, end);
+            if (!d.findBlock()) {
+                // A block whose tag is damaged still starts with "zPQ", the
+                // level and the ZPAQL type, which findBlock() accepts at the
+                // start of its input
+                const char* z = at;
+                while ((z = static_cast<const char*>(memmem(z, end - z, "zPQ", 3))) != nullptr &&
+                       !(end - z > 5 && (z[3] == 1 || z[3] == 2) && z[4] == 1)) {
+                    ++z;
+                }
+                if (z != nullptr && z != at) {
+                    at = z;
+                    continue;
+                }
+                r.problem = "No block in the " + std::to_string(end - at) + " bytes after byte " +
+                            std::to_string(offset + (at - begin));
+                break;
+            }
+            libzpaq::StringBuffer name, comment;
+            while (d.findFilename(&name)) {
+                d.readComment(&comment);
+                RecoveredSegment s;
+                s.name.assign(name.c_str(), name.size());
+                s.comment.assign(comment.c_str(), comment.size());
+                r.segments.push_back(s);
+                inData = true;
+                const uint64_t primed = seekable::primedBytes(s.comment);
+                d.setPrime(0, 0);
+                if (primed > 0) {
+                    if (!prime) prime = primeOf();
+                    if (!prime || prime->size() < primed) throw std::runtime_error("the prime of its file is lost");
+                    d.setPrime(prime->data(), primed);
+                }
+                StringWriter data(r.segments.back().data);
+                libzpaq::SHA1 sha1;
+                d.setSHA1(&sha1);
+                d.setOutput(&data);
+                d.decompress();
+                char stored[21];
+                d.readSegmentEnd(stored);
+                inData = false;
+                r.segments.back().decoded = true;
+                if (stored[0] && std::memcmp(stored + 1, sha1.result(), 20) != 0) {
+                    r.segments.back().problem = "SHA-1 mismatch";
+                }
+                name.reset();
+                comment.reset();
+            }
+            at = d.position();
+            continue;
+        } catch (const std::exception& e) {
+            why = e.what();
+        }
+        if (inData) {
+            r.segments.back().data.clear();
+            r.segments.back().problem = why;
+        }
+        const size_t known = r.segments.size() - first;
+        try {
+            libzpaq::Decompresser h;
+            h.setInput(at, end);
+            h.findBlock();
+            libzpaq::StringBuffer name, comment;
+            for (size_t k = 0; h.findFilename(&name); ++k) {
+                h.readComment(&comment);
+                h.readSegmentEnd();
+                if (k >= known) {
+                    RecoveredSegment s;
+                    s.name.assign(name.c_str(), name.size());
+                    s.comment.assign(comment.c_str(), comment.size());
+                    s.problem = k == known && !inData ? why : "lost after an earlier error in its block";
+                    r.segments.push_back(s);
+                }
+                name.reset();
+                comment.reset();
+            }
+            at = h.position();
+        } catch (const std::exception& e) {
+            r.problem = std::string(e.what()) + " in the headers of the block after byte " +
+                        std::to_string(offset + (at - begin));
+            break;
+        }
     }
+    return r;
+}
 
-    NullWriter nullOut;
-    d.setOutput(&nullOut);
+// Whether the first segment in [begin, end) is the prime of a file (see
+// seekable.h), from its header. False if the header is damaged.
+bool startsWithPrime(const char* begin, const char* end) {
+    throwLibzpaqErrors = true;
+    try {
+        libzpaq::Decompresser h;
+        h.setInput(begin, end);
+        libzpaq::StringBuffer comment;
+        if (!h.findBlock() || !h.findFilename()) return false;
+        h.readComment(&comment);
+        return seekable::isPrime(std::string(comment.c_str(), comment.size()));
+    } catch (const std::exception&) {
+        return false;
+    }
+}
 
-    while (d.findFilename()) {
-        // Get filename
-        std::string filename;
+// Extracts what is intact of a damaged archive. The blocks are found by
+// their tags (see archive::findTags()) and decoded independently on
+// threads, and their segments are written in archive order, at most
+// 2 * threads ranges ahead of the writer. A damaged segment is reported and
+// written as zeros of its size from the comment, so the rest of its file
+// stays in place; a continuation whose file is unknown is reported and
+// dropped. The ranges that start with a prime are found from their headers
+// first, and a range with primed blocks waits for the nearest one before
+// it to be decoded. Returns false if anything was damaged.
+bool recoverToDirectory(const std::string& input, const std::string& outputDir, extract::Backend writer,
+                        int threads) {
+    std::cout << "Recovering: " << input << " -> " << outputDir << " (" << threads << " threads)\n";
+    fs::create_directories(outputDir);
+
+    const archive::Mapping map(input);
+    std::vector<uint64_t> starts = archive::findTags(map);
+    if (starts.empty() || starts[0] > 0) starts.insert(starts.begin(), 0);  // blocks without a tag
+    const size_t n = starts.size();
+    std::vector<bool> hasPrime(n);
+    for (size_t i = 0; i < n; ++i) {
+        hasPrime[i] = startsWithPrime(map.data() + starts[i], map.data() + (i + 1 < n ? starts[i + 1] : map.size()));
+    }
+
+    extract::Sink out(writer);
+    std::cout << "Writer: " << out.describe() << "\n";
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<RecoveredRange> results(n);
+    std::vector<bool> ready(n, false);
+    std::vector<std::shared_ptr<const std::string>> primes(n);  // of the ranges with one, once ready
+    size_t head = 0;
+    std::string error;
+    std::string filename;  // being written, empty if unknown
+    Specials specials(outputDir);
+    int files = 0, damaged = 0, lost = 0;
+
+    auto emit = [&](const RecoveredRange& r) {
+        for (const RecoveredSegment& s : r.segments) {
+            bool special = false;
+            try {
+                special = !s.name.empty() && specials.extract(s.name, s.comment);
+            } catch (const std::runtime_error&) {
+                // a damaged record, extracted as a file
+            }
+            if (special) {
+                filename.clear();
+                ++files;
+                std::cout << "Extracted: " << s.name << "\n";
+                continue;
+            }
+            if (!s.name.empty()) {
+                filename = s.name;
+                specials.open(out, filename, s.comment);
+                ++files;
+                std::cout << "Extracted: " << filename << "\n";
+            } else if (filename.empty()) {
+                std::cerr << "\33[31mLost: \33[0mpart of an unknown file after byte " << r.offset << ": "
+                          << (s.problem.empty() ? "its start is damaged" : s.problem) << "\n";
+                ++lost;
+                continue;
+            }
+            std::vector<sparse::Run> runs;
+            try {
+                runs = sparse::parseRuns(s.comment);
+            } catch (const std::exception&) {
+                // a damaged comment, the data is still good
+            }
+            out.holes(runs);
+            if (s.problem.empty()) {
+                out.write(s.data.data(), static_cast<int>(s.data.size()));
+                continue;
+            }
+            std::cerr << "\33[31mDamaged: \33[0m" << filename << " (block after byte " << r.offset
+                      << "): " << s.problem << "\n";
+            ++damaged;
+            if (s.decoded) {
+                out.write(s.data.data(), static_cast<int>(s.data.size()));
+            } else {
+                const std::string zeros(1 << 16, '\0');
+                for (uint64_t left = std::strtoull(s.comment.c_str(), nullptr, 10); left > 0;) {
+                    const int k = static_cast<int>(std::min<uint64_t>(left, zeros.size()));
+                    out.write(zeros.data(), k);
+                    left -= k;
+                }
+            }
+        }
+        if (!r.problem.empty()) {
+            std::cerr << "\33[31mLost: \33[0m" << r.problem << "\n";
+            ++lost;
+            filename.clear();
+        }
+    };
+
+    benchutil::parallelFor(n, threads, [&](size_t i) {
         {
-            char buf[4096];
-            int len = 0;
-            while ((buf[len] = d.get()) != -1 && len < 4095) ++len;
-            buf[len] = 0;
-            filename = buf;
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&] { return i < head + 2 * size_t(threads) || !error.empty(); });
+            if (!error.empty()) return;
+        }
+        // Ranges are handed out in order, so the one with the prime is
+        // being decoded already and does not wait for this one
+        auto primeOf = [&]() -> std::shared_ptr<const std::string> {
+            size_t j = i;
+            while (j > 0 && !hasPrime[j - 1]) --j;
+            if (j == 0) return nullptr;
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&] { return ready[j - 1] || !error.empty(); });
+            return primes[j - 1];
+        };
+        trace::setBlock(static_cast<int>(i));
+        const uint64_t end = i + 1 < n ? starts[i + 1] : map.size();
+        RecoveredRange r = recoverRange(map.data() + starts[i], map.data() + end, starts[i], primeOf);
+        trace::setBlock(-1);
+        std::lock_guard<std::mutex> lock(m);
+        if (hasPrime[i] && !r.segments.empty() && r.segments[0].problem.empty()) {
+            primes[i] = std::make_shared<const std::string>(r.segments[0].data);
+        }
+        results[i] = std::move(r);
+        ready[i] = true;
+        try {
+            for (; head < n && ready[head] && error.empty(); ++head) {
+                emit(results[head]);
+                results[head] = RecoveredRange();
+            }
+        } catch (const std::exception& e) {
+            error = e.what();
         }
+        cv.notify_all();
+    });
+    if (!error.empty()) throw std::runtime_error(error);
+    out.finish();
+    specials.finish();
 
-        std::cout << filename << "\n";
+    std::cout << "Recovered " << files << " files from " << n << " block ranges: " << damaged
+              << " damaged segments, " << lost << " lost\n";
+    return damaged == 0 && lost == 0;
+}
+
+// --- Extract Selected Files ---
+// Extracts only the given files or directories of the input archive. The
+// archive is mapped and scanned for its blocks, and only the blocks holding
+// a selected file are decoded, each read in place from its range of the
+// mapping. Segments of other files in those blocks are decoded to nowhere,
+// as later segments of a block depend on the model state they leave.
+void extractFiles(const std::string& input, const std::string& outputDir, const std::vector<std::string>& names,
+                  extract::Backend writer = extract::AUTO) {
+    throwLibzpaqErrors = true;
+    std::cout << "Extracting from: " << input << " -> " << outputDir << "\n";
+    fs::create_directories(outputDir);
+
+    const archive::Mapping map(input);
+    const std::vector<archive::Block> blocks = archive::scan(map);
+    std::vector<bool> matched(names.size(), false);
+    libzpaq::Decompresser d;
+    extract::Sink out(writer);
+    std::cout << "Writer: " << out.describe() << "\n";
+    seekable::Primer primer;
+    Specials specials(outputDir);
+    NullWriter skipped;
+    std::string filename;  // being written
+    int decoded = 0;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        const archive::Block& b = blocks[i];
+        size_t last = 0;  // one past the last selected segment
+        for (size_t k = 0; k < b.segments.size(); ++k) {
+            for (size_t n = 0; n < names.size(); ++n) {
+                if (archive::selected(b.segments[k].file, {names[n]})) matched[n] = true, last = k + 1;
+            }
+        }
+        if (last == 0) continue;
+        trace::setBlock(int(i));
+        d.setInput(map.data() + b.start, map.data() + b.end);
+        if (!d.findBlock()) throw std::runtime_error("Block vanished from " + input);
+        ++decoded;
+        for (size_t k = 0; k < last; ++k) {
+            const archive::Segment& seg = b.segments[k];
+            libzpaq::StringBuffer comment;
+            if (!d.findFilename()) throw std::runtime_error("Segment vanished from " + input);
+            d.readComment(&comment);
+            const bool wanted = archive::selected(seg.file, names);
+            const bool special = wanted && seg.named && specials.extract(seg.file, seg.comment);
+            if (special) std::cout << "Extracted: " << seg.file << "\n";
+            if (!wanted || special) {
+                d.setOutput(primer.segment(d, seg.named, seg.comment, &skipped));
+                while (d.decompress(1000000));
+                d.readSegmentEnd();
+                continue;
+            }
+            const bool named = seg.named || seg.file != filename;
+            if (named) {
+                filename = seg.file;
+                specials.open(out, filename, seg.comment);
+                std::cout << "Extracted: " << filename << "\n";
+            }
+            extractSegment(d, out, comment, primer, named, filename);
+        }
+    }
+    trace::setBlock(-1);
+    out.finish();
+    specials.finish();
+    for (size_t n = 0; n < names.size(); ++n) {
+        if (!matched[n]) std::cerr << "\33[31mWarning: \33[0m" << names[n] << " is not in the archive\n";
+    }
+    std::cout << decoded << " of " << blocks.size() << " blocks decoded\n";
+}
 
-        // Skip decompression by decompressing to null writer
-        while (d.decompress(1000000));
+// --- List Archive Contents ---
+// Lists the contents of the input ZPAQ file without extracting. Only the
+// segment headers are parsed (see archive::scan()); the coded data is
+// skipped in place in a mapping of the archive.
+void listArchiveContents(const std::string& input) {
+    std::cout << "Listing contents of: " << input << "\n";
 
-        // Read segment end
-        char sha1[21];
-        d.readSegmentEnd(sha1);
+    std::vector<std::string> parts = volume::parts(input);
+    if (parts.empty()) parts.push_back(input);  // for the error
+    for (const std::string& part : parts) {
+        for (const archive::Block& b : archive::scan(part)) {
+            for (const archive::Segment& s : b.segments) {
+                if (s.named) std::cout << s.file << "\n";
+            }
+        }
     }
 
     std::cout << "Listing complete.\n";
 }
 
+// --- Scan Block Tags ---
+// Prints the offset of every block tag in a file, the bytes up to the next
+// one and the ZPAQ level after it, without decoding or parsing the blocks.
+void scanArchive(const std::string& input) {
+    const auto start = std::chrono::steady_clock::now();
+    const archive::Mapping map(input);
+    const std::vector<uint64_t> tags = archive::findTags(map);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < tags.size(); ++i) {
+        const uint64_t end = i + 1 < tags.size() ? tags[i + 1] : map.size();
+        const int level = tags[i] + 16 < map.size() ? (unsigned char)map.data()[tags[i] + 16] : -1;
+        std::cout << tags[i] << " " << end - tags[i] << " level " << level << "\n";
+    }
+    std::cout << tags.size() << " block tags in " << map.size() << " bytes, " << int(seconds * 1000 + 0.5) << " ms";
+    if (seconds > 0) std::cout << " (" << int(map.size() / seconds / (1 << 20)) << " MiB/s)";
+    std::cout << "\n";
+}
+
+// --- Random Access Read ---
+// Writes byte ranges (offset, length) of one file of the archive to
+// standard output, decoding only the blocks they overlap (see readat.h).
+void readRanges(const std::string& input, const std::string& file,
+                const std::vector<std::pair<uint64_t, uint64_t>>& ranges) {
+    readat::Archive a(input);
+    const uint64_t size = a.size(file);
+    std::string buf;
+    uint64_t total = 0;
+    for (const auto& r : ranges) {
+        for (uint64_t at = r.first, end = r.first + r.second; at < end && at < size;) {
+            buf = a.readAt(file, at, size_t(std::min<uint64_t>(end - at, 16 << 20)));
+            std::cout.write(buf.data(), buf.size());
+            at += buf.size();
+            total += buf.size();
+        }
+    }
+    std::cout.flush();
+    if (!std::cout) throw std::runtime_error("Cannot write to standard output");
+    const readat::Stats st = a.stats();
+    std::cerr << "Read " << total << " bytes of " << file << " (" << size << " bytes): " << st.decoded << " of "
+              << a.blocks() << " blocks decoded, " << st.hits << " cache hits\n";
+}
+
+// --- Synthetic Corpus ---
+// Parses a byte count with an optional K, M or G suffix (powers of 1024).
+uint64_t parseSize(const std::string& s) {
+    size_t end = 0;
+    uint64_t n = 0;
+    try {
+        n = std::stoull(s, &end);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Invalid size: " + s);
+    }
+    std::string suffix = s.substr(end);
+    if (suffix == "K" || suffix == "k") n <<= 10;
+    else if (suffix == "M" || suffix == "m") n <<= 20;
+    else if (suffix == "G" || suffix == "g") n <<= 30;
+    else if (!suffix.empty()) throw std::runtime_error("Invalid size suffix: " + s);
+    return n;
+}
+
+// Writes a deterministic synthetic corpus (see corpus.h) to a file, so the
+// benchmark inputs can also be fed to other tools.
+void writeCorpus(const std::string& kindName, const std::string& size, const std::string& output,
+                 uint64_t seed) {
+    corpus::Kind kind;
+    if (!corpus::parseKind(kindName, kind)) {
+        throw std::runtime_error("Unknown corpus '" + kindName + "', use one of " + corpus::kindList());
+    }
+    std::string data = corpus::generate(kind, parseSize(size), seed);
+    FileWriter out(output);
+    out.write(data.data(), static_cast<int>(data.size()));
+    std::cout << "Wrote " << data.size() << " bytes of " << kindName << " corpus (seed " << seed
+              << ") to " << output << "\n";
+}
+
+// --- Options of 'c' and 'd' ---
+// The options that may follow the paths of 'c' and 'd', and the arguments
+// left: the paths, then the method of 'c' or the files 'd' extracts.
+struct CommandOptions {
+    std::vector<std::string> args;
+    std::vector<std::string> given;  // options as named, for only()
+    bool fast = false;      // --fast-now
+    bool seek = false;      // --seekable
+    size_t seekBlock = seekable::kDefaultBlock, seekPrime = seekable::kDefaultPrime;
+    bool tar = false;       // --tar
+    bool direct = false;    // --direct
+    bool recover = false;   // --recover
+    extract::Backend writer = extract::AUTO;
+    int threads = std::max(1, int(std::thread::hardware_concurrency()));
+    uint64_t volumeSize = 0;
+
+    // Throws if an option was given that the command described by what
+    // does not use, so that none is silently ignored.
+    void only(std::initializer_list<const char*> used, const std::string& what) const {
+        for (const std::string& g : given) {
+            if (std::find_if(used.begin(), used.end(), [&](const char* u) { return g == u; }) == used.end()) {
+                throw std::runtime_error(g + " does not go with " + what);
+            }
+        }
+    }
+};
+
+CommandOptions parseCommandOptions(int argc, char** argv) {
+    CommandOptions o;
+    const size_t limit = (0x100000 << 4) - 4096;  // of a seekable block or prime
+    for (int i = 0; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a.size() < 2 || a[0] != '-') {
+            o.args.push_back(a);
+            continue;
+        }
+        o.given.push_back(a);
+        if (a == "--fast-now") {
+            o.fast = true;
+        } else if (a == "--seekable") {
+            o.seek = true;
+        } else if (a == "--block-size" || a == "--prime-size") {
+            const uint64_t size = parseSize(benchutil::optionValue(argc, argv, i));
+            if (size == 0 || size > limit) {
+                throw std::runtime_error(a + " takes 1 to " + std::to_string(limit) + " bytes");
+            }
+            (a == "--block-size" ? o.seekBlock : o.seekPrime) = size_t(size);
+        } else if (a == "--tar") {
+            o.tar = true;
+        } else if (a == "--direct") {
+            o.direct = true;
+        } else if (a == "--recover") {
+            o.recover = true;
+        } else if (a == "--writer") {
+            const std::string w = benchutil::optionValue(argc, argv, i);
+            if (!extract::parseBackend(w, o.writer)) {
+                throw std::runtime_error("Unknown writer '" + w + "', use auto, uring, threads or sync");
+            }
+        } else if (a == "--threads") {
+            o.threads = benchutil::parseInt(benchutil::optionValue(argc, argv, i), 1, 256, "thread count");
+        } else if (a == "--volume-size") {
+            o.volumeSize = parseSize(benchutil::optionValue(argc, argv, i));
+            if (o.volumeSize == 0) throw std::runtime_error("--volume-size must be more than 0");
+        } else {
+            throw std::runtime_error("Unknown option: " + a);
+        }
+    }
+    return o;
+}
+
 // --- Main ---
-// Entry point for the PAQMan application.
 // Parses command-line arguments and dispatches to compression or decompression.
-int main(int argc, char** argv) {
+int runCommand(int argc, char** argv) {
     if (argc < 2 || std::string(argv[1]) == "--help") {
         std::cout << "-(\33[31mPAQMan\33[0m)-By-(\33[31mzero\33[0m)-\n\n";
         std::cout << "Usage:\n";
         std::cout << "  \33[31mpaqman c <input_file_or_dir> <output_file> [method]\33[0m  # Compress file or directory (method: 0-5, default 5)\n";
+        std::cout << "      --threads <n> (directories and --seekable: blocks coded in parallel, default all cores)\n";
+        std::cout << "      --volume-size <size> (split into <output>.001, .002, ... at block boundaries; K, M or G)\n";
+        std::cout << "      --seekable (files: small blocks for paqman read, each coded after training on the file's start;\n";
+        std::cout << "                  --block-size 2M  --prime-size 512K; best with methods 4 and 5)\n";
+        std::cout << "      --tar (input is a tar or pax stream, '-' for stdin; members become segments with their metadata)\n";
         std::cout << "  \33[31mpaqman d <input_file> <output_dir>\33[0m                  # Decompress to directory\n";
+        std::cout << "      --writer auto (uring, threads or sync: how extracted files are written)\n";
+        std::cout << "      --direct (read the archive with O_DIRECT, bypassing the page cache)\n";
+        std::cout << "      --recover (decode blocks independently on --threads <n>, extract what is intact, report damage)\n";
+        std::cout << "      --tar (write a tar stream to <output_dir> as a file, '-' for stdout, instead of a directory)\n";
+        std::cout << "  \33[31mpaqman d <input_file> <output_dir> <file_or_dir...>\33[0m # Extract only these files, decoding only their blocks\n";
+        std::cout << "  \33[31mpaqman c <input_file> <output_file> --fast-now\33[0m      # Compress with level 1 now, recompress later with optimize\n";
+        std::cout << "  \33[31mpaqman optimize [options] <archive>\33[0m                 # Recompress --fast-now blocks at low priority\n";
+        std::cout << "      --method 5 (1-5 or 5f)  --threads 1  --min-gain 2 (%)  --nice 19\n";
+        std::cout << "  \33[31mpaqman merge <output> <archive...>\33[0m                  # Concatenate archives, copying blocks unchanged\n";
+        std::cout << "  \33[31mpaqman delete <archive> <file_or_dir...>\33[0m            # Remove files, re-encoding only blocks shared with other files\n";
+        std::cout << "  \33[31mpaqman subset <archive> <output> <file_or_dir...>\33[0m   # Write a new archive with only these files\n";
         std::cout << "  \33[31mpaqman --help\33[0m                                       # Show this help\n";
-        std::cout << "  \33[31mpaqman l <archive>\33[0m				    # list files in the compressed archive\n\n";
+        std::cout << "  \33[31mpaqman l <archive>\33[0m				    # list files in the compressed archive\n";
+        std::cout << "  \33[31mpaqman scan <file>\33[0m                                  # Offsets of all block tags, without decoding\n";
+        std::cout << "  \33[31mpaqman read <archive> <file> <offset> <length>...\33[0m   # Write byte ranges of a file to stdout, decoding only their blocks\n";
+        std::cout << "  \33[31mpaqman serve [--socket <path>] [--threads <n>]\33[0m      # Daemon: compress/decompress jobs from a Unix socket on a shared worker pool\n";
+        std::cout << "  \33[31mpaqman client c|d <input> <output> [method]\33[0m         # Run one job on the daemon; '-' is stdin or stdout\n";
+        std::cout << "      --socket <path>  --send path|fd|data (default path, or fd with '-')  --name <stored name>\n";
+        std::cout << "  \33[31mpaqman client stop\33[0m                                  # Stop the daemon after its running jobs\n";
+        std::cout << "  \33[31mpaqman loadtest [options]\33[0m                           # Round trips through a daemon (started in-process unless --socket)\n";
+        std::cout << "      --clients 4  --jobs 64  --size 256 (KiB)  --method 1  --threads <n>  --send fd|data  --corpus mixed  --json\n";
+        std::cout << "  \33[31mpaqman bench [options] [files...]\33[0m                   # In-memory benchmark (synthetic corpus if no files)\n";
+        std::cout << "      --levels 0-5  --threads 1,4  --block-sizes 1,16 (MiB)  --size 8 (MiB)  --corpus mixed  --seed 1  --json\n";
+        std::cout << "  \33[31mpaqman bench-model [options] [file]\33[0m                 # ns/bit per model component, JIT vs interpreter\n";
+        std::cout << "      --models cm,icm,...  --sizebits 10,16,20  --size 1 (MiB)  --corpus mixed  --seed 1  --json\n";
+        std::cout << "  \33[31mpaqman bench-jit [options] [files...]\33[0m               # Check JIT == interpreter output, report speedup\n";
+        std::cout << "      --levels 0-5  --random 8  --seed 1  --size 1 (MiB)  --corpus mixed  --json\n";
+        std::cout << "  \33[31mpaqman corpus <kind> <size> <output_file> [seed]\33[0m    # Write a synthetic benchmark corpus\n";
+        std::cout << "      kinds: " << corpus::kindList() << "; size may end in K, M or G\n";
+        std::cout << "  \33[31mpaqman stats [options] [file_or_archive]\33[0m            # Per-component cost, mixer gain, hash table and match stats\n";
+        std::cout << "      --method 5 (or x... method)  --size 4 (MiB)  --corpus mixed  --seed 1  --json\n";
+        std::cout << "  \33[31m--trace <file.json>\33[0m                                 # Any mode: per-stage timing summary and Chrome trace\n";
+        std::cout << "  \33[31m--perfctr\33[0m                                           # Any mode: cycles, instructions, cache/TLB/branch misses per stage and block\n\n";
         std::cout << "Methods:\n";
         std::cout << "  \33[31m0\33[0m: Store only (no compression)\n";
-        std::cout << "  \33[31m1-5\33[0m: Increasing compression levels (5 is slowest/best)\n\n";
+        std::cout << "  \33[31m1-5\33[0m: Increasing compression levels (5 is slowest/best)\n";
+        std::cout << "  \33[31m5f\33[0m: Level 5 with the least useful components removed after probing each block\n\n";
         std::cout << "Examples:\n";
         std::cout << "  \33[31mpaqman c input.txt compressed.zpaq 3\33[0m\n";
         std::cout << "  \33[31mpaqman c mydir archive.zpaq 5\33[0m\n";
-        std::cout << "  \33[31mpaqman d compressed.zpaq output_dir\33[0m\n\n";
+        std::cout << "  \33[31mpaqman d compressed.zpaq output_dir\33[0m\n";
+        std::cout << "  \33[31mpaqman bench --levels 1-3 --threads 1,4 --json\33[0m\n";
+        std::cout << "  \33[31mpaqman c input.txt compressed.zpaq 5 --trace trace.json\33[0m\n\n";
         std::cout << "For more details, see the file header or LICENSE.\n";
         return 0;
     }
 
-    if (argc < 4) {
+    std::string mode = argv[1];
+
+    // Benchmark, statistics, archive edit and daemon modes parse their own arguments
+    if (mode == "bench" || mode == "bench-model" || mode == "bench-jit" || mode == "stats" || mode == "optimize" ||
+        mode == "merge" || mode == "delete" || mode == "subset" || mode == "serve" || mode == "client" ||
+        mode == "loadtest") {
+        try {
+            if (mode == "serve") return runServe(argc - 2, argv + 2);
+            if (mode == "client") return runClient(argc - 2, argv + 2);
+            if (mode == "loadtest") return runLoadTest(argc - 2, argv + 2);
+            if (mode == "merge") return runMerge(argc - 2, argv + 2);
+            if (mode == "delete") return runDelete(argc - 2, argv + 2);
+            if (mode == "subset") return runSubset(argc - 2, argv + 2);
+            if (mode == "optimize") return runOptimize(argc - 2, argv + 2);
+            if (mode == "stats") return runStats(argc - 2, argv + 2);
+            if (mode == "bench-model") return runModelBench(argc - 2, argv + 2);
+            if (mode == "bench-jit") return runJitBench(argc - 2, argv + 2);
+            return runBench(argc - 2, argv + 2);
+        } catch (const std::exception& e) {
+            std::cerr << "\33[31mError: \33[0m" << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (mode == "corpus") {
+        if (argc < 5) {
+            std::cerr << "\33[31mError: Usage: paqman corpus <kind> <size> <output_file> [seed]\33[0m\n";
+            return 1;
+        }
+        try {
+            writeCorpus(argv[2], argv[3], argv[4], argc > 5 ? parseSize(argv[5]) : 1);
+        } catch (const std::exception& e) {
+            std::cerr << "\33[31mError: \33[0m" << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (mode == "scan" && argc == 3) {
+        try {
+            scanArchive(argv[2]);
+        } catch (const std::exception& e) {
+            std::cerr << "\33[31mError: \33[0m" << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (mode == "read" && argc >= 6 && argc % 2 == 0) {
+        try {
+            std::vector<std::pair<uint64_t, uint64_t>> ranges;
+            for (int i = 4; i + 1 < argc; i += 2) ranges.push_back({parseSize(argv[i]), parseSize(argv[i + 1])});
+            readRanges(argv[2], argv[3], ranges);
+        } catch (const std::exception& e) {
+            std::cerr << "\33[31mError: \33[0m" << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (mode == "l" && argc == 3) {
+        try {
+            listArchiveContents(argv[2]);
+        } catch (const std::exception& e) {
+            std::cerr << "\33[31mError: \33[0m" << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    CommandOptions o;
+    try {
+        o = parseCommandOptions(argc - 2, argv + 2);
+    } catch (const std::exception& e) {
+        std::cerr << "\33[31mError: \33[0m" << e.what() << "\n";
+        return 1;
+    }
+    if (o.args.size() < 2) {
         std::cerr << "\33[31mError: Insufficient arguments. Use --help for usage.\33[0m\n";
         return 1;
     }
 
-    std::string mode = argv[1];
-    std::string input = argv[2];
-    std::string output = argv[3];
+    std::string input = o.args[0];
+    std::string output = o.args[1];
+    const std::vector<std::string> rest(o.args.begin() + 2, o.args.end());
 
-    // Validate input file exists
+    // Validate input file exists (for 'd', or the first part of a split archive)
     std::ifstream check(input);
-    if (!check.good()) {
+    if (!check.good() && !(mode == "d" && !volume::parts(input).empty()) && !(o.tar && input == "-")) {
         std::cerr << "\33[31mError: Input file '" << input << "' mdoes not exist or is inaccessible.\33[0m\n";
         return 1;
     }
@@ -324,19 +1717,66 @@ int main(int argc, char** argv) {
 
     try {
         if (mode == "c") {
-            std::string method = (argc > 4) ? std::string(argv[4]) : "5";
-            // Basic validation for method (0-5)
-            if (method.length() != 1 || method < "0" || method > "5") {
-                std::cerr << "\33[31mError: Invalid method '" << method << "'. Use 0-5.\33[0m\n";
+            if (rest.size() > 1) throw std::runtime_error("c takes one method after its paths");
+            if (o.fast && !rest.empty()) {
+                std::cerr << "\33[31mError: --fast-now always uses method 1.\33[0m\n";
                 return 1;
             }
-            if (fs::is_directory(input)) {
-                compressDirectory(input, output, method);
+            std::string method = o.fast ? "1" : !rest.empty() ? rest[0] : "5";
+            // Basic validation for method (0-5, or 5f for adaptive level 5)
+            if ((method.length() != 1 || method < "0" || method > "5") && method != "5f") {
+                std::cerr << "\33[31mError: Invalid method '" << method << "'. Use 0-5 or 5f.\33[0m\n";
+                return 1;
+            }
+            if (o.tar) {
+                if (method == "5f") {
+                    std::cerr << "\33[31mError: --tar does not go with method 5f.\33[0m\n";
+                    return 1;
+                }
+                o.only({"--tar", "--threads", "--volume-size"}, "c --tar");
+                compressTar(input, output, method, o.threads, o.volumeSize);
+            } else if (fs::is_directory(input)) {
+                if (method == "5f") {
+                    std::cerr << "\33[31mError: Method 5f is only supported for single files.\33[0m\n";
+                    return 1;
+                }
+                o.only({"--threads", "--volume-size"}, "c of a directory");
+                compressDirectory(input, output, method, o.threads, o.volumeSize);
+            } else if (o.seek) {
+                if (method == "5f") {
+                    std::cerr << "\33[31mError: --seekable does not go with method 5f.\33[0m\n";
+                    return 1;
+                }
+                o.only({"--seekable", "--block-size", "--prime-size", "--threads", "--volume-size"}, "c --seekable");
+                compressSeekable(input, output, method, o.seekBlock, o.seekPrime, o.threads, o.volumeSize);
             } else {
-                compressFile(input, output, method);
+                o.only({"--fast-now", "--volume-size"}, "c of a file");
+                compressFile(input, output, method, o.fast, o.volumeSize);
+            }
+        } else if (mode == "d" && o.tar) {
+            if (o.recover || !rest.empty()) {
+                std::cerr << "\33[31mError: --tar always writes the whole archive.\33[0m\n";
+                return 1;
             }
+            o.only({"--tar"}, "d --tar");
+            decompressToTar(input, output);
+        } else if (mode == "d" && (o.recover || !rest.empty()) && volume::parts(input).size() > 1) {
+            std::cerr << "\33[31mError: --recover and file selection read one volume at a time, e.g. "
+                      << volume::parts(input)[0] << ".\33[0m\n";
+            return 1;
+        } else if (mode == "d" && o.recover) {
+            if (!rest.empty()) {
+                std::cerr << "\33[31mError: --recover always extracts the whole archive.\33[0m\n";
+                return 1;
+            }
+            o.only({"--recover", "--writer", "--threads"}, "d --recover");
+            if (!recoverToDirectory(input, output, o.writer, o.threads)) return 2;
+        } else if (mode == "d" && !rest.empty()) {
+            o.only({"--writer"}, "d with file selection");
+            extractFiles(input, output, rest, o.writer);
         } else if (mode == "d") {
-            decompressToDirectory(input, output);
+            o.only({"--writer", "--direct"}, "d");
+            decompressToDirectory(input, output, o.writer, o.direct);
         } else {
             std::cerr << "\33[31mError: Unknown mode '" << mode << "'. Use 'c', 'd', or 'l'.\33[0m\n";
             return 1;
@@ -351,3 +1791,43 @@ int main(int argc, char** argv) {
 
     return 0;
 }
+
+// Entry point for the PAQMan application.
+// Removes "--trace <file.json>" and "--perfctr" from the arguments, runs the
+// command and then writes the trace and prints the stage summary.
+int main(int argc, char** argv) {
+    std::string traceFile;
+    bool perfCounters = false;
+    int n = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--trace" && i + 1 < argc) {
+            traceFile = argv[++i];
+        } else if (std::string(argv[i]) == "--perfctr") {
+            perfCounters = true;
+        } else {
+            argv[n++] = argv[i];
+        }
+    }
+    argv[n] = nullptr;
+    if (perfCounters) {
+        std::string why;
+        if (!trace::enableCounters(why)) {
+            std::cerr << "\33[31mWarning: \33[0mHardware counters unavailable, timing stages only: " << why << "\n";
+        }
+    }
+    if (perfCounters || !traceFile.empty()) trace::enable();
+
+    int status = runCommand(n, argv);
+
+    if (trace::enabled()) {
+        try {
+            if (!traceFile.empty()) trace::writeChromeTrace(traceFile);
+            trace::printSummary(std::cerr);
+            if (!traceFile.empty()) std::cerr << "Trace written to " << traceFile << "\n";
+        } catch (const std::exception& e) {
+            std::cerr << "\33[31mError: \33[0m" << e.what() << "\n";
+            return 1;
+        }
+    }
+    return status;
+}
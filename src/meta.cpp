@@ -0,0 +1,128 @@
+/**
+ * @file meta.cpp
+ * @brief File metadata records in segment comments.
+ *
+ * Record layout: the type letter, then unsigned LEB128 varints of mode,
+ * uid, gid, mtime (zigzag) and nanoseconds, then the link, user and
+ * group names, each as a varint length and bytes, and for devices the
+ * major and minor numbers. Base64 uses the
+ * standard alphabet without padding.
+ */
+
+#include "meta.h"
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace meta {
+
+namespace {
+
+const char kBase64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void putVarint(std::string& s, uint64_t v) {
+    for (; v >= 0x80; v >>= 7) s.push_back(char((v & 0x7f) | 0x80));
+    s.push_back(char(v));
+}
+
+uint64_t getVarint(const std::string& s, size_t& at) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (at >= s.size()) break;
+        const unsigned char c = s[at++];
+        v |= uint64_t(c & 0x7f) << shift;
+        if (c < 0x80) return v;
+    }
+    throw std::runtime_error("Damaged metadata record");
+}
+
+std::string encode(const std::string& in) {
+    std::string out;
+    uint32_t bits = 0;
+    int n = 0;
+    for (unsigned char c : in) {
+        bits = bits << 8 | c;
+        for (n += 8; n >= 6; n -= 6) out.push_back(kBase64[(bits >> (n - 6)) & 63]);
+    }
+    if (n > 0) out.push_back(kBase64[(bits << (6 - n)) & 63]);
+    return out;
+}
+
+std::string decode(const std::string& in) {
+    std::string out;
+    uint32_t bits = 0;
+    int n = 0;
+    for (char c : in) {
+        const char* p = c ? std::strchr(kBase64, c) : nullptr;
+        if (p == nullptr) throw std::runtime_error("Damaged metadata record");
+        bits = bits << 6 | uint32_t(p - kBase64);
+        n += 6;
+        if (n >= 8) out.push_back(char((bits >> (n -= 8)) & 255));
+    }
+    return out;
+}
+
+}  // namespace
+
+std::string format(const Record& r) {
+    std::string s(1, r.type);
+    putVarint(s, r.mode);
+    putVarint(s, r.uid);
+    putVarint(s, r.gid);
+    putVarint(s, (uint64_t(r.mtime) << 1) ^ uint64_t(r.mtime >> 63));
+    putVarint(s, r.mtimeNsec);
+    for (const std::string* t : {&r.link, &r.user, &r.group}) {
+        putVarint(s, t->size());
+        s += *t;
+    }
+    if (r.type == CHAR || r.type == BLOCK) {
+        putVarint(s, r.major);
+        putVarint(s, r.minor);
+    }
+    return " meta=" + encode(s);
+}
+
+bool parse(const std::string& comment, Record& r) {
+    std::istringstream words(comment);
+    std::string w;
+    while (words >> w) {
+        if (w.compare(0, 5, "meta=") != 0) continue;
+        const std::string s = decode(w.substr(5));
+        if (s.empty()) throw std::runtime_error("Damaged metadata record");
+        Record m;
+        size_t at = 1;
+        m.type = s[0];
+        m.mode = uint32_t(getVarint(s, at));
+        m.uid = getVarint(s, at);
+        m.gid = getVarint(s, at);
+        const uint64_t t = getVarint(s, at);
+        m.mtime = int64_t((t >> 1) ^ (0 - (t & 1)));
+        m.mtimeNsec = uint32_t(getVarint(s, at));
+        for (std::string* t : {&m.link, &m.user, &m.group}) {
+            const uint64_t n = getVarint(s, at);
+            if (n > s.size() - at) throw std::runtime_error("Damaged metadata record");
+            *t = s.substr(at, n);
+            at += n;
+        }
+        if (m.type == CHAR || m.type == BLOCK) {
+            m.major = uint32_t(getVarint(s, at));
+            m.minor = uint32_t(getVarint(s, at));
+        }
+        r = m;
+        return true;
+    }
+    return false;
+}
+
+bool isBelow(const std::string& name) {
+    if (name.empty() || name[0] == '/') return false;
+    for (size_t at = 0; at <= name.size();) {
+        size_t slash = name.find('/', at);
+        if (slash == std::string::npos) slash = name.size();
+        if (slash - at == 2 && name.compare(at, 2, "..") == 0) return false;
+        at = slash + 1;
+    }
+    return true;
+}
+
+}  // namespace meta
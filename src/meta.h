@@ -0,0 +1,58 @@
+/**
+ * @file meta.h
+ * @brief File metadata records in segment comments.
+ *
+ * A file's type, permissions, owner, modification time and link target
+ * are kept in the comment of its first segment as the word
+ * "meta=<record>", after the size and any zero runs (see sparse.h). The
+ * record is a few varints, base64 encoded so that the comment stays text
+ * without spaces or NUL bytes; a regular file owned by "root" costs about
+ * 30 characters. Directories, links and special files are segments
+ * without data. A segment without a record is a regular file with no
+ * known metadata.
+ */
+
+#ifndef PAQMAN_META_H
+#define PAQMAN_META_H
+
+#include <cstdint>
+#include <string>
+
+namespace meta {
+
+// File types, as letters.
+enum Type : char {
+    FILE = 'f',
+    DIR = 'd',
+    SYMLINK = 'l',
+    HARDLINK = 'h',  // link names an earlier file of the archive
+    CHAR = 'c',
+    BLOCK = 'b',
+    FIFO = 'p',
+};
+
+struct Record {
+    char type = FILE;
+    uint32_t mode = 0644;  // permission bits, with setuid, setgid and sticky
+    uint64_t uid = 0, gid = 0;
+    int64_t mtime = 0;     // seconds since 1970
+    uint32_t mtimeNsec = 0;
+    std::string link;      // target of a symlink or hard link
+    std::string user, group;  // owner names, if known
+    uint32_t major = 0, minor = 0;  // of a device
+};
+
+// " meta=<record>", to append to a segment comment.
+std::string format(const Record& r);
+
+// Reads the record of a segment comment into r. Returns false, leaving r
+// alone, if there is none; throws if it is damaged.
+bool parse(const std::string& comment, Record& r);
+
+// Whether name is relative and has no ".." component, so that it stays
+// below the directory it is extracted to (unless through a symlink).
+bool isBelow(const std::string& name);
+
+}  // namespace meta
+
+#endif  // PAQMAN_META_H
@@ -0,0 +1,243 @@
+/**
+ * @file modelbench.cpp
+ * @brief Component-level predictor microbenchmark (`paqman bench-model`).
+ *
+ * Builds single-component and small-chain ZPAQ models from ZPAQL source
+ * through libzpaq::Compiler, then drives libzpaq::Predictor::predict() and
+ * update() directly over a fixed bit stream. Each model is timed twice:
+ * with JIT code and with the interpreter (predict0/update0, run0), selected
+ * by libzpaq::setJIT(). The per-bit cost and the coding cost (bits per byte)
+ * of each model are reported so that the component choices made by
+ * makeConfig() can be priced.
+ *
+ * Every model uses the same HCOMP: h[i] is a hash of the last i+1 bytes.
+ */
+
+#include "bench.h"
+#include "benchutil.h"
+#include "corpus.h"
+#include "libzpaq.h"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace benchutil;
+
+namespace {
+
+// --- Models ---
+
+struct ModelSpec {
+    std::string name;  // component chain, e.g. "icm>isse"
+    std::string comp;  // COMP section lines
+    int n;             // number of components
+    bool sized;        // takes sizebits (false for the baseline)
+};
+
+std::string itos(int x) {
+    return std::to_string(x);
+}
+
+// Returns the benchmark models for component sizebits s. Inputs feeding
+// MIX, MIX2 and SSE are kept small so that the cost of the measured
+// component dominates the difference from the baseline.
+std::vector<ModelSpec> modelSpecs(int s) {
+    const std::string S = itos(s);
+    return {
+        {"const", "0 const 128\n", 1, false},
+        {"cm", "0 cm " + S + " 255\n", 1, true},
+        {"icm", "0 icm " + S + "\n", 1, true},
+        {"match", "0 match " + S + " " + itos(s + 2) + "\n", 1, true},
+        {"icm>isse", "0 icm " + S + "\n1 isse " + S + " 0\n", 2, true},
+        {"cm,icm>mix", "0 cm 12 255\n1 icm 10\n2 mix " + S + " 0 2 24 255\n", 3, true},
+        {"cm,icm>mix2", "0 cm 12 255\n1 icm 10\n2 mix2 " + S + " 0 1 24 255\n", 3, true},
+        {"cm>sse", "0 cm 12 255\n1 sse " + S + " 0 32 255\n", 2, true},
+        {"icm>isse>isse>mix", "0 icm " + S + "\n1 isse " + S + " 0\n2 isse " + S + " 1\n"
+                              "3 mix 8 0 3 24 255\n", 4, true},
+    };
+}
+
+// Returns complete ZPAQL source for spec.
+std::string modelConfig(const ModelSpec& spec) {
+    std::string cfg = "comp 3 8 0 0 " + itos(spec.n) + "\n" + spec.comp +
+                      "hcomp\n  c++ *c=a b=c a=0\n";
+    for (int i = 0; i < spec.n; ++i) {
+        cfg += (i == 0 ? "  d= 0" : "  d++") + std::string(" hash *d=a b--\n");
+    }
+    return cfg + "  halt\npost 0 end\n";
+}
+
+// --- Measurement ---
+
+struct Timing {
+    double nsPerBit;
+    double bitsPerByte;
+};
+
+// Runs predict()/update() over every bit of data with a fresh model.
+Timing timeModel(const std::string& config, const std::string& data, bool jit) {
+    libzpaq::setJIT(jit);
+    libzpaq::ZPAQL hz, pz;
+    libzpaq::Compiler(config.c_str(), 0, hz, pz, 0);
+    std::unique_ptr<libzpaq::Predictor> pr(new libzpaq::Predictor(hz));
+    pr->init();
+
+    // cost[i] = -log2 of a probability in bucket i of 1024
+    static double cost[1024];
+    if (cost[0] == 0) {
+        for (int i = 0; i < 1024; ++i) cost[i] = -std::log2((i * 32 + 16) / 32768.0);
+    }
+
+    double bits = 0;
+    Clock::time_point t0 = Clock::now();
+    for (unsigned char c : data) {
+        for (int i = 7; i >= 0; --i) {
+            const int p = pr->predict();  // P(1) in 0..32767
+            const int y = c >> i & 1;
+            bits += cost[(y ? p : 32767 - p) >> 5];
+            pr->update(y);
+        }
+    }
+    const double sec = secondsSince(t0);
+    libzpaq::setJIT(true);
+    return {sec * 1e9 / (data.size() * 8.0), bits / data.size()};
+}
+
+struct ModelResult {
+    std::string name;
+    int sizebits;  // -1 if not sized
+    double memoryBytes;
+    Timing jit;
+    Timing interp;
+};
+
+// --- Options ---
+
+struct ModelBenchOptions {
+    std::vector<int> sizebits{10, 16, 20};
+    std::vector<std::string> models;  // empty = all
+    size_t size = 1u << 20;
+    corpus::Kind corpusKind = corpus::MIXED;
+    uint64_t seed = 1;
+    bool json = false;
+    std::string file;
+};
+
+ModelBenchOptions parseOptions(int argc, char** argv) {
+    ModelBenchOptions o;
+    for (int i = 0; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--sizebits") {
+            o.sizebits = parseList(optionValue(argc, argv, i), 0, 24, "sizebits");
+        } else if (a == "--models") {
+            std::stringstream ss(optionValue(argc, argv, i));
+            for (std::string m; std::getline(ss, m, ',');) o.models.push_back(m);
+        } else if (a == "--size") {
+            o.size = size_t(parseInt(optionValue(argc, argv, i), 1, 1024, "size")) << 20;
+        } else if (a == "--corpus") {
+            std::string kind = optionValue(argc, argv, i);
+            if (!corpus::parseKind(kind, o.corpusKind)) {
+                throw std::runtime_error("Unknown corpus '" + kind + "', use one of " + corpus::kindList());
+            }
+        } else if (a == "--seed") {
+            o.seed = parseInt(optionValue(argc, argv, i), 0, 0x7fffffff, "seed");
+        } else if (a == "--json") {
+            o.json = true;
+        } else if (a.size() > 1 && a[0] == '-') {
+            throw std::runtime_error("Unknown bench-model option: " + a);
+        } else if (o.file.empty()) {
+            o.file = a;
+        } else {
+            throw std::runtime_error("bench-model takes at most one input file");
+        }
+    }
+    return o;
+}
+
+bool selected(const ModelBenchOptions& o, const std::string& name) {
+    if (o.models.empty()) return true;
+    for (const auto& m : o.models) {
+        if (m == name) return true;
+    }
+    return false;
+}
+
+}  // namespace
+
+// --- Entry Point ---
+
+int runModelBench(int argc, char** argv) {
+    ModelBenchOptions o = parseOptions(argc, argv);
+
+    std::string data, name = o.file;
+    if (o.file.empty()) {
+        data = corpus::generate(o.corpusKind, o.size, o.seed);
+        name = std::string(corpus::kindName(o.corpusKind)) + ":seed=" + std::to_string(o.seed);
+    } else {
+        std::ifstream in(o.file, std::ios::binary);
+        if (!in.is_open()) throw std::runtime_error("Cannot open input file: " + o.file);
+        std::ostringstream ss;
+        ss << in.rdbuf();
+        data = ss.str().substr(0, o.size);
+    }
+    if (data.empty()) throw std::runtime_error("Benchmark input is empty");
+
+    if (!o.json) {
+        std::cout << "Model benchmark on " << name << " ("
+                  << data.size() << " bytes, JIT " << (libzpaq::isJIT() ? "available" : "unavailable")
+                  << ")\n";
+        std::printf("%-20s %8s %9s %10s %10s %8s %8s\n", "model", "sizebits", "mem_MB",
+                    "jit_ns/bit", "int_ns/bit", "speedup", "bpc");
+    }
+
+    std::vector<ModelResult> results;
+    bool baselineDone = false;
+    for (int s : o.sizebits) {
+        for (const ModelSpec& spec : modelSpecs(s)) {
+            if (!selected(o, spec.name) || (!spec.sized && baselineDone)) continue;
+            if (!spec.sized) baselineDone = true;
+
+            const std::string cfg = modelConfig(spec);
+            ModelResult r;
+            r.name = spec.name;
+            r.sizebits = spec.sized ? s : -1;
+            {
+                libzpaq::ZPAQL hz, pz;
+                libzpaq::Compiler(cfg.c_str(), 0, hz, pz, 0);
+                r.memoryBytes = hz.memory();
+            }
+            r.jit = timeModel(cfg, data, true);
+            r.interp = timeModel(cfg, data, false);
+            results.push_back(r);
+
+            if (!o.json) {
+                std::printf("%-20s %8s %9.1f %10.2f %10.2f %8.2f %8.4f\n", r.name.c_str(),
+                            spec.sized ? itos(s).c_str() : "-", r.memoryBytes / 1048576.0,
+                            r.jit.nsPerBit, r.interp.nsPerBit,
+                            r.jit.nsPerBit > 0 ? r.interp.nsPerBit / r.jit.nsPerBit : 0.0,
+                            r.jit.bitsPerByte);
+                std::fflush(stdout);
+            }
+        }
+    }
+
+    if (o.json) {
+        std::printf("{\n  \"input\": \"%s\",\n  \"input_bytes\": %zu,\n  \"results\": [",
+                    jsonEscape(name).c_str(), data.size());
+        for (size_t i = 0; i < results.size(); ++i) {
+            const ModelResult& r = results[i];
+            std::printf("%s\n    {\"model\": \"%s\", \"sizebits\": %d, \"memory_bytes\": %.0f, "
+                        "\"jit_ns_per_bit\": %.3f, \"interp_ns_per_bit\": %.3f, \"bits_per_byte\": %.5f}",
+                        i ? "," : "", r.name.c_str(), r.sizebits, r.memoryBytes,
+                        r.jit.nsPerBit, r.interp.nsPerBit, r.jit.bitsPerByte);
+        }
+        std::printf("\n  ]\n}\n");
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * @file optimize.cpp
+ * @brief Lazy recompression of fast archives for PAQMan (`paqman optimize`).
+ *
+ * The archive is scanned once with archive::scan(). Marked single-segment
+ * blocks are then decoded and recompressed a window of --threads blocks at
+ * a time, and every block is appended in order to "<archive>.optimize.tmp".
+ * If the archive was modified in the meantime, the result is discarded.
+ */
+
+#include "optimize.h"
+#include "archive.h"
+#include "benchutil.h"
+#include "libzpaq.h"
+#include "prune.h"
+#include "trace.h"
+#include <sys/resource.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace benchutil;
+
+const char* const kFastComment = " fast";
+const char* const kKeptComment = " kept";
+
+namespace {
+
+bool endsWith(const std::string& s, const char* suffix) {
+    size_t n = std::strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// --- Options ---
+
+struct OptimizeOptions {
+    std::string method = "5";
+    int threads = 1;
+    double minGain = 2;  // percent
+    int nice = 19;
+    std::string archive;
+};
+
+OptimizeOptions parseOptions(int argc, char** argv) {
+    OptimizeOptions o;
+    for (int i = 0; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--method") {
+            o.method = optionValue(argc, argv, i);
+            if ((o.method.size() != 1 || o.method < "1" || o.method > "5") && o.method != "5f") {
+                throw std::runtime_error("Invalid method '" + o.method + "', use 1-5 or 5f");
+            }
+        } else if (a == "--threads") {
+            o.threads = parseInt(optionValue(argc, argv, i), 1, 256, "thread count");
+        } else if (a == "--min-gain") {
+            o.minGain = parseInt(optionValue(argc, argv, i), 0, 100, "min-gain");
+        } else if (a == "--nice") {
+            o.nice = parseInt(optionValue(argc, argv, i), 0, 19, "nice");
+        } else if (a.size() > 1 && a[0] == '-') {
+            throw std::runtime_error("Unknown optimize option: " + a);
+        } else if (o.archive.empty()) {
+            o.archive = a;
+        } else {
+            throw std::runtime_error("optimize takes one archive");
+        }
+    }
+    if (o.archive.empty()) throw std::runtime_error("Usage: paqman optimize [options] <archive>");
+    return o;
+}
+
+// --- Recompression ---
+
+struct Result {
+    std::string bytes;  // block to write
+    bool replaced = false;
+};
+
+// Decodes the single segment block b and codes it again with method.
+// Keeps the original bytes, marked as tried, unless it shrinks by minGain percent.
+Result recompress(const std::string& path, const archive::Block& b, const OptimizeOptions& o) {
+    Result r;
+    r.bytes = archive::readRange(path, b.start, b.end);
+
+    libzpaq::StringBuffer raw, name, data;
+    raw.write(r.bytes.data(), static_cast<int>(r.bytes.size()));
+    libzpaq::Decompresser d;
+    d.setInput(&raw);
+    if (!d.findBlock() || !d.findFilename(&name)) throw std::runtime_error("Block vanished from " + path);
+    d.readComment();
+    d.setOutput(&data);
+    libzpaq::SHA1 sha1;
+    d.setSHA1(&sha1);
+    d.decompress();
+    char stored[21];
+    d.readSegmentEnd(stored);
+    if (stored[0] && std::memcmp(stored + 1, sha1.result(), 20) != 0) {
+        throw std::runtime_error("Checksum error in block at offset " + std::to_string(b.start) + " of " + path);
+    }
+
+    const std::string filename(name.c_str(), name.size());
+    // compressBlock() puts the size back in front of the rest of the comment
+    const std::string kept = b.comment.substr(0, b.comment.size() - std::strlen(kFastComment));
+    const size_t space = kept.find(' ');
+    const std::string rest = space == std::string::npos ? std::string() : kept.substr(space + 1);
+    const char* comment = rest.empty() ? nullptr : rest.c_str();
+    libzpaq::StringBuffer out;
+    if (o.method == "5f") {
+        prune::compressBlockAdaptive(&data, &out, "5", filename.c_str(), comment, stored[0] != 0);
+    } else {
+        libzpaq::compressBlock(&data, &out, o.method.c_str(), filename.c_str(), comment, stored[0] != 0);
+    }
+
+    if (out.size() <= r.bytes.size() * (1 - o.minGain / 100)) {
+        r.bytes.assign(out.c_str(), out.size());
+        r.replaced = true;
+    } else {
+        const size_t at = b.commentEnd - b.start - std::strlen(kKeptComment);
+        r.bytes.replace(at, std::strlen(kKeptComment), kKeptComment);
+    }
+    return r;
+}
+
+}  // namespace
+
+int runOptimize(int argc, char** argv) {
+    OptimizeOptions o = parseOptions(argc, argv);
+    setpriority(PRIO_PROCESS, 0, o.nice);  // best effort, threads inherit it
+
+    const archive::Snapshot before = archive::snapshot(o.archive);
+    std::vector<archive::Block> blocks = archive::scan(o.archive);
+
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].segments.size() == 1 && endsWith(blocks[i].comment, kFastComment)) todo.push_back(i);
+    }
+    std::cout << "Optimizing: " << o.archive << " (" << todo.size() << " of " << blocks.size()
+              << " blocks marked fast, method " << o.method << ", " << o.threads << " threads)\n";
+    if (todo.empty()) return 0;
+
+    const std::string tmp = o.archive + ".optimize.tmp";
+    uint64_t oldBytes = 0, newBytes = 0;
+    int replaced = 0;
+    try {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("Cannot open output file: " + tmp);
+        size_t copied = 0;  // blocks before this one are written
+        for (size_t w = 0; w < todo.size(); w += o.threads) {
+            const size_t n = std::min(todo.size() - w, size_t(o.threads));
+            std::vector<Result> results(n);
+            parallelFor(n, o.threads, [&](size_t i) {
+                trace::setBlock(static_cast<int>(todo[w + i]));
+                results[i] = recompress(o.archive, blocks[todo[w + i]], o);
+                trace::setBlock(-1);
+            });
+            for (size_t i = 0; i < n; ++i) {
+                const archive::Block& b = blocks[todo[w + i]];
+                if (b.start > blocks[copied].start) {
+                    out << archive::readRange(o.archive, blocks[copied].start, b.start);
+                }
+                out << results[i].bytes;
+                copied = todo[w + i] + 1;
+                oldBytes += b.end - b.start;
+                newBytes += results[i].bytes.size();
+                replaced += results[i].replaced;
+                std::cout << "Block " << todo[w + i] << ": " << b.end - b.start << " -> "
+                          << results[i].bytes.size() << (results[i].replaced ? "" : " (kept)") << "\n";
+            }
+        }
+        if (copied < blocks.size()) out << archive::readRange(o.archive, blocks[copied].start, before.size);
+        out.flush();
+        if (!out) throw std::runtime_error("Cannot write " + tmp);
+        out.close();
+        archive::replace(tmp, o.archive, before);
+    } catch (...) {
+        std::remove(tmp.c_str());  // the archive is left as it was
+        throw;
+    }
+    std::cout << "Optimize complete: " << replaced << " blocks recompressed, " << oldBytes << " -> " << newBytes
+              << " bytes\n";
+    return 0;
+}
@@ -0,0 +1,27 @@
+/**
+ * @file optimize.h
+ * @brief Lazy recompression of fast archives for PAQMan (`paqman optimize`).
+ *
+ * `paqman c --fast-now` writes level 1 blocks and marks them with the
+ * comment "<size> fast". `paqman optimize` later recompresses each marked
+ * block with a slower method on a limited number of low priority threads.
+ * Blocks that shrink by less than a threshold are copied unchanged and
+ * marked "<size> kept", so later runs skip them too; all other blocks are
+ * copied as raw bytes without decoding. The new archive is written next to
+ * the old one and renamed over it at the end, so readers always see a
+ * complete archive.
+ */
+
+#ifndef PAQMAN_OPTIMIZE_H
+#define PAQMAN_OPTIMIZE_H
+
+// Comment suffixes of blocks written by --fast-now ("<size> fast") and of
+// blocks that optimize tried without enough gain ("<size> kept").
+extern const char* const kFastComment;
+extern const char* const kKeptComment;
+
+// Entry point for `paqman optimize [options] <archive>`.
+// argv[0] is the first argument after "optimize". Returns a process exit code.
+int runOptimize(int argc, char** argv);
+
+#endif  // PAQMAN_OPTIMIZE_H
@@ -0,0 +1,152 @@
+/**
+ * @file perfctr.cpp
+ * @brief Hardware performance counters for PAQMan stages (`--perfctr`).
+ */
+
+#include "perfctr.h"
+#include <cstring>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace perfctr {
+
+namespace {
+
+const char* const kNames[NCOUNTERS] = {"cycles", "instructions", "l1d-miss", "llc-miss", "dtlb-miss", "branch-miss"};
+
+#ifdef __linux__
+
+struct Spec {
+    uint32_t type;
+    uint64_t config;
+};
+
+const uint64_t kReadMiss = PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+
+const Spec kSpecs[NCOUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | kReadMiss},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | kReadMiss},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+bool probed = false;
+bool opened[NCOUNTERS];  // counters opened by the probing thread
+int probeErrno = 0;      // first failure, for the probe() message
+
+// One counter group for the calling thread.
+class ThreadCounters {
+    int fd[NCOUNTERS];
+    int slot[NCOUNTERS];  // position in the group read, or -1
+    int n = 0;            // counters in the group
+
+public:
+    ThreadCounters() {
+        for (int i = 0; i < NCOUNTERS; ++i) {
+            fd[i] = slot[i] = -1;
+            if (probed && !opened[i]) continue;
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = kSpecs[i].type;
+            attr.config = kSpecs[i].config;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            const int leader = n ? fd[first()] : -1;
+            fd[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd[i] < 0) {
+                if (!probeErrno) probeErrno = errno;
+                continue;
+            }
+            slot[i] = n++;
+        }
+    }
+
+    ~ThreadCounters() {
+        for (int i = 0; i < NCOUNTERS; ++i) {
+            if (fd[i] >= 0) close(fd[i]);
+        }
+    }
+
+    int first() const {
+        for (int i = 0; i < NCOUNTERS; ++i) {
+            if (slot[i] >= 0) return i;
+        }
+        return -1;
+    }
+
+    bool isOpen(int i) const { return slot[i] >= 0; }
+
+    void read(Counts& c) const {
+        std::memset(&c, 0, sizeof(c));
+        if (!n) return;
+        uint64_t buf[3 + NCOUNTERS];  // nr, time enabled, time running, values
+        if (::read(fd[first()], buf, sizeof(buf)) < ssize_t((3 + n) * sizeof(uint64_t))) return;
+        const double scale = buf[2] && buf[2] < buf[1] ? double(buf[1]) / buf[2] : 1.0;
+        for (int i = 0; i < NCOUNTERS; ++i) {
+            if (slot[i] >= 0) c.v[i] = uint64_t(buf[3 + slot[i]] * scale);
+        }
+    }
+};
+
+ThreadCounters& local() {
+    thread_local ThreadCounters counters;
+    return counters;
+}
+
+#endif  // __linux__
+
+}  // namespace
+
+const char* name(int counter) {
+    return kNames[counter];
+}
+
+#ifdef __linux__
+
+bool probe(std::string& why) {
+    if (!probed) {
+        ThreadCounters& c = local();
+        for (int i = 0; i < NCOUNTERS; ++i) opened[i] = c.isOpen(i);
+        probed = true;
+    }
+    if (local().first() >= 0) return true;
+    why = std::string("perf_event_open: ") + std::strerror(probeErrno);
+    if (probeErrno == EACCES || probeErrno == EPERM) why += " (see /proc/sys/kernel/perf_event_paranoid)";
+    return false;
+}
+
+bool available(int counter) {
+    return probed && opened[counter];
+}
+
+void read(Counts& c) {
+    local().read(c);
+}
+
+#else
+
+bool probe(std::string& why) {
+    why = "hardware counters need Linux perf_event_open";
+    return false;
+}
+
+bool available(int) {
+    return false;
+}
+
+void read(Counts& c) {
+    std::memset(&c, 0, sizeof(c));
+}
+
+#endif
+
+}  // namespace perfctr
@@ -0,0 +1,45 @@
+/**
+ * @file perfctr.h
+ * @brief Hardware performance counters for PAQMan stages (`--perfctr`).
+ *
+ * Counts cycles, instructions, L1D read misses, LLC misses, dTLB read
+ * misses and branch misses of the calling thread with perf_event_open().
+ * The counters of a thread are opened as one group on its first read()
+ * and closed when the thread exits. Counters the CPU or kernel does not
+ * provide are left out and reported as unavailable.
+ *
+ * trace.cpp reads them at every stage boundary; see trace::enableCounters().
+ */
+
+#ifndef PAQMAN_PERFCTR_H
+#define PAQMAN_PERFCTR_H
+
+#include <cstdint>
+#include <string>
+
+namespace perfctr {
+
+enum Counter { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, DTLB_MISSES, BRANCH_MISSES, NCOUNTERS };
+
+struct Counts {
+    uint64_t v[NCOUNTERS];
+};
+
+// Short name of a counter for reports, e.g. "llc-miss".
+const char* name(int counter);
+
+// Opens the counters for the calling thread. Returns false and sets why
+// if none of them is available (no kernel support, perf_event_paranoid,
+// virtual machine without a PMU).
+bool probe(std::string& why);
+
+// True if counter was opened by probe().
+bool available(int counter);
+
+// Reads the calling thread's counters since its first read(), scaled for
+// multiplexing. Unavailable counters read as 0.
+void read(Counts& c);
+
+}  // namespace perfctr
+
+#endif  // PAQMAN_PERFCTR_H
@@ -0,0 +1,165 @@
+/**
+ * @file prefetch.cpp
+ * @brief Background read-ahead of archive input for PAQMan.
+ *
+ * The buffers form a ring: the reading thread fills them in order and the
+ * consumer empties them in the same order, each side waiting only when it
+ * catches up with the other. Buffers are page aligned and every read but
+ * the last is a whole buffer at a multiple of its size, as O_DIRECT needs.
+ */
+
+#include "prefetch.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+namespace prefetch {
+
+namespace {
+
+const size_t kSlot = 4 << 20;  // bytes per read
+const int kSlots = 3;
+const size_t kAlign = 4096;
+
+struct Slot {
+    char* data = nullptr;
+    size_t len = 0;
+    bool full = false;  // filled and not yet consumed, guarded by Impl::m
+    bool last = false;  // nothing follows, set with full
+};
+
+}  // namespace
+
+struct Reader::Impl {
+    int fd = -1;
+    std::string path;
+    Slot slots[kSlots];
+
+    std::mutex m;
+    std::condition_variable cv;  // full, stop or error changed
+    bool stop = false;
+    std::string error;
+    std::thread thread;
+
+    // Consumer side
+    int current = 0;
+    bool have = false;  // slots[current] is full and being consumed
+    size_t pos = 0;
+
+    ~Impl() {
+        for (Slot& s : slots) std::free(s.data);
+        if (fd >= 0) ::close(fd);
+    }
+
+    // Reads up to kSlot bytes at offset into p. Returns the length, 0 at
+    // the end, or -1 with errno set.
+    ssize_t fill(char* p, uint64_t offset) {
+        size_t got = 0;
+        while (got < kSlot) {
+            ssize_t r = ::pread(fd, p + got, kSlot - got, offset + got);
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0 && errno == EINVAL && (fcntl(fd, F_GETFL) & O_DIRECT)) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);  // not supported here after all
+                continue;
+            }
+            if (r < 0) return -1;
+            if (r == 0) break;
+            got += r;
+        }
+        return ssize_t(got);
+    }
+
+    void run() {
+        uint64_t offset = 0;
+        for (int i = 0;; i = (i + 1) % kSlots) {
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return !slots[i].full || stop; });
+                if (stop) return;
+            }
+            ssize_t n;
+            {
+                trace::Scope stage("read");
+                n = fill(slots[i].data, offset);
+            }
+            const int err = errno;
+            std::lock_guard<std::mutex> lock(m);
+            if (n < 0) {
+                error = "Cannot read " + path + ": " + std::strerror(err);
+                cv.notify_all();
+                return;
+            }
+            slots[i].len = size_t(n);
+            slots[i].last = size_t(n) < kSlot;
+            slots[i].full = true;
+            offset += n;
+            cv.notify_all();
+            if (slots[i].last) return;
+        }
+    }
+};
+
+Reader::Reader(const std::string& path, bool direct) : impl(new Impl) {
+    impl->path = path;
+    impl->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | (direct ? O_DIRECT : 0));
+    if (impl->fd < 0 && direct && errno == EINVAL) impl->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (impl->fd < 0) throw std::runtime_error("Cannot open input file: " + path);
+    if (!direct) posix_fadvise(impl->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    for (Slot& s : impl->slots) {
+        void* p = nullptr;
+        if (posix_memalign(&p, kAlign, kSlot) != 0) throw std::bad_alloc();
+        s.data = static_cast<char*>(p);
+    }
+    impl->thread = std::thread([this] { impl->run(); });
+}
+
+Reader::~Reader() {
+    {
+        std::lock_guard<std::mutex> lock(impl->m);
+        impl->stop = true;
+        impl->cv.notify_all();
+    }
+    impl->thread.join();
+}
+
+int Reader::get() {
+    char c;
+    return read(&c, 1) == 1 ? (unsigned char)c : -1;
+}
+
+int Reader::read(char* buf, int n) {
+    Impl& r = *impl;
+    int got = 0;
+    while (got < n) {
+        Slot& s = r.slots[r.current];
+        if (!r.have) {
+            std::unique_lock<std::mutex> lock(r.m);
+            r.cv.wait(lock, [&] { return s.full || !r.error.empty(); });
+            if (!s.full) throw std::runtime_error(r.error);
+            r.have = true;
+            r.pos = 0;
+        }
+        const size_t len = std::min(size_t(n - got), s.len - r.pos);
+        std::memcpy(buf + got, s.data + r.pos, len);
+        got += int(len);
+        r.pos += len;
+        if (r.pos < s.len) continue;
+        if (s.last) break;
+        std::lock_guard<std::mutex> lock(r.m);
+        s.full = false;
+        r.have = false;
+        r.current = (r.current + 1) % kSlots;
+        r.cv.notify_all();
+    }
+    return got;
+}
+
+}  // namespace prefetch
@@ -0,0 +1,39 @@
+/**
+ * @file prefetch.h
+ * @brief Background read-ahead of archive input for PAQMan.
+ *
+ * libzpaq's Decoder refills its 64 KiB buffer with a synchronous read()
+ * whenever it runs dry, so every disk or network read stalls decoding.
+ * prefetch::Reader reads the file on its own thread into three 4 MiB
+ * buffers at aligned offsets, ahead of the Decoder, which then only copies
+ * from memory. With direct, the reads bypass the page cache (O_DIRECT),
+ * for archives larger than memory that are read once; file systems
+ * without O_DIRECT are read normally.
+ */
+
+#ifndef PAQMAN_PREFETCH_H
+#define PAQMAN_PREFETCH_H
+
+#include "libzpaq.h"
+#include <memory>
+#include <string>
+
+namespace prefetch {
+
+class Reader : public libzpaq::Reader {
+public:
+    // Throws if path cannot be opened.
+    explicit Reader(const std::string& path, bool direct = false);
+    ~Reader() override;
+    int get() override;
+    int read(char* buf, int n) override;  // throws on a read error
+
+    struct Impl;
+
+private:
+    std::unique_ptr<Impl> impl;
+};
+
+}  // namespace prefetch
+
+#endif  // PAQMAN_PREFETCH_H
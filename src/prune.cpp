@@ -0,0 +1,224 @@
+/**
+ * @file prune.cpp
+ * @brief Adaptive component pruning for PAQMan ("fast level 5", method `5f`).
+ *
+ * The value of a component is ComponentStats::saved: the bits the MIX and
+ * MIX2 components consuming it would lose without its input. Mixers and SSE
+ * are never removed, and the component an ISSE chain hangs off only with
+ * the chain, so the slimmed method is always valid for makeConfig().
+ */
+
+#include "prune.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+namespace prune {
+
+namespace {
+
+// One model command of a method, e.g. "c0,2,0,255" or "i1,1,2".
+struct Command {
+    char op;
+    std::vector<int> args;
+    int first = 0;             // index of its first component
+    std::vector<bool> alive;   // per component (per chain element for 'i')
+};
+
+// Number of components makeConfig() generates for c.
+int componentCount(const Command& c) {
+    switch (c.op) {
+        case 'i': return int(c.args.size());
+        case 'w': return c.args.empty() ? 1 : std::max(c.args[0], 1);
+        default: return 1;
+    }
+}
+
+// Parses "xN,N...{cmd}N,N..." into prefix and commands. Returns false for
+// methods this module does not understand.
+bool parse(const std::string& method, std::string& prefix, std::vector<Command>& cmds) {
+    if (method.empty() || method[0] != 'x') return false;
+    size_t i = 1;
+    while (i < method.size() && (std::isdigit((unsigned char)method[i]) || method[i] == ',' || method[i] == '.')) ++i;
+    prefix = method.substr(0, i);
+    int ncomp = 0;
+    while (i < method.size()) {
+        Command c;
+        c.op = method[i++];
+        if (!std::strchr("ciamtsw", c.op)) return false;
+        if (i < method.size() && std::isdigit((unsigned char)method[i])) {
+            c.args.push_back(0);
+            while (i < method.size() && (std::isdigit((unsigned char)method[i]) || method[i] == ',' || method[i] == '.')) {
+                if (std::isdigit((unsigned char)method[i])) c.args.back() = c.args.back() * 10 + method[i] - '0';
+                else c.args.push_back(0);
+                ++i;
+            }
+        }
+        c.first = ncomp;
+        c.alive.assign(componentCount(c), true);
+        ncomp += componentCount(c);
+        cmds.push_back(c);
+    }
+    return ncomp > 0 && ncomp < 254;
+}
+
+bool anyAlive(const Command& c) {
+    return std::find(c.alive.begin(), c.alive.end(), true) != c.alive.end();
+}
+
+// The next command after k that still makes components, or cmds.size().
+size_t nextAlive(const std::vector<Command>& cmds, size_t k) {
+    for (size_t j = k + 1; j < cmds.size(); ++j) {
+        if (anyAlive(cmds[j])) return j;
+    }
+    return cmds.size();
+}
+
+// True if the next command that still makes components is an ISSE chain,
+// which would then hang off a different component.
+bool feedsChain(const std::vector<Command>& cmds, size_t k) {
+    const size_t j = nextAlive(cmds, k);
+    return j < cmds.size() && cmds[j].op == 'i';
+}
+
+// A removable unit: a whole command, the command together with the ISSE
+// chain hanging off it, or one element of a chain.
+struct Candidate {
+    size_t cmd;
+    int element;  // -1 for the whole command
+    size_t chain;  // the chain removed with it, or cmds.size()
+    double saved;
+};
+
+double savedBy(const Command& c, const libzpaq::ComponentStats* stats) {
+    double saved = 0;
+    for (size_t e = 0; e < c.alive.size(); ++e) {
+        if (c.alive[e]) saved += stats[c.first + e].saved;
+    }
+    return saved;
+}
+
+int aliveCount(const Command& c) {
+    return int(std::count(c.alive.begin(), c.alive.end(), true));
+}
+
+std::vector<Candidate> candidates(const std::vector<Command>& cmds, const libzpaq::ComponentStats* stats) {
+    std::vector<Candidate> out;
+    for (size_t k = 0; k < cmds.size(); ++k) {
+        const Command& c = cmds[k];
+        if (!anyAlive(c) || std::strchr("mts", c.op)) continue;
+        if (c.op == 'i') {
+            for (size_t e = 0; e < c.alive.size(); ++e) {
+                if (!c.alive[e]) continue;
+                size_t next = e + 1;
+                while (next < c.alive.size() && !c.alive[next]) ++next;
+                if (next < c.alive.size()) {  // merge order increment into the next element
+                    if (c.args[e] % 10 + c.args[next] % 10 > 9) continue;
+                } else if (feedsChain(cmds, k)) {
+                    continue;
+                }
+                out.push_back({k, int(e), cmds.size(), stats[c.first + e].saved});
+            }
+        } else if (!feedsChain(cmds, k)) {
+            out.push_back({k, -1, cmds.size(), savedBy(c, stats)});
+        } else {
+            // The input of a chain often saves nothing in the mixer itself,
+            // but goes with the chain, the most costly components to run
+            const size_t j = nextAlive(cmds, k);
+            if (!feedsChain(cmds, j)) out.push_back({k, -1, j, savedBy(c, stats) + savedBy(cmds[j], stats)});
+        }
+    }
+    return out;
+}
+
+std::string format(const std::string& prefix, const std::vector<Command>& cmds) {
+    std::string out = prefix;
+    for (const Command& c : cmds) {
+        if (!anyAlive(c)) continue;
+        std::vector<int> args = c.args;
+        if (c.op == 'i') {
+            args.clear();
+            for (size_t e = 0; e < c.alive.size(); ++e) {
+                if (c.alive[e]) args.push_back(c.args[e]);
+            }
+        }
+        out += c.op;
+        for (size_t a = 0; a < args.size(); ++a) out += (a ? "," : "") + std::to_string(args[a]);
+    }
+    return out;
+}
+
+}  // namespace
+
+std::string slimMethod(const std::string& method, const libzpaq::ComponentStats* stats, double budget,
+                       int* dropped) {
+    if (dropped) *dropped = 0;
+    std::string prefix;
+    std::vector<Command> cmds;
+    if (!parse(method, prefix, cmds)) return method;
+
+    int n = 0, contexts = 0;  // components, and those that are not mixers
+    for (const Command& c : cmds) {
+        n += componentCount(c);
+        if (!std::strchr("mts", c.op)) contexts += componentCount(c);
+    }
+    if (stats[n - 1].type == 0 || stats[n].type != 0) return method;  // stats are for another model
+    double allowance = budget * stats[n - 1].cost;
+
+    while (contexts > 2) {
+        std::vector<Candidate> cand = candidates(cmds, stats);
+        if (cand.empty()) break;
+        const Candidate& best = *std::min_element(cand.begin(), cand.end(), [](const Candidate& a, const Candidate& b) {
+            return a.saved < b.saved;
+        });
+        if (best.saved > allowance) break;
+        allowance -= std::max(best.saved, 0.0);
+
+        Command& c = cmds[best.cmd];
+        if (best.element < 0) {
+            int n = componentCount(c);
+            std::fill(c.alive.begin(), c.alive.end(), false);
+            if (best.chain < cmds.size()) {
+                n += aliveCount(cmds[best.chain]);
+                std::fill(cmds[best.chain].alive.begin(), cmds[best.chain].alive.end(), false);
+            }
+            contexts -= n;
+            if (dropped) *dropped += n;
+        } else {
+            size_t next = best.element + 1;
+            while (next < c.alive.size() && !c.alive[next]) ++next;
+            if (next < c.alive.size()) c.args[next] += c.args[best.element] % 10;
+            c.alive[best.element] = false;
+            --contexts;
+            if (dropped) ++*dropped;
+        }
+    }
+    return format(prefix, cmds);
+}
+
+BlockReport compressBlockAdaptive(libzpaq::StringBuffer* in, libzpaq::Writer* out, const char* method,
+                                  const char* filename, const char* comment, bool dosha1, double budget) {
+    BlockReport r;
+    r.fullMethod = libzpaq::expandMethod(in, method);
+    r.slimMethod = r.fullMethod;
+
+    // Probe 256 KiB in 8 slices spread over the block, so that data unlike
+    // its start keeps the components it needs
+    const size_t n = in->size();
+    const size_t slices = 8, slice = size_t(1) << 15;
+    if (r.fullMethod[0] == 'x' && n >= 8 * slices * slice) {
+        libzpaq::StringBuffer probe(slices * slice), discard;
+        for (size_t i = 0; i < slices; ++i) probe.write(in->c_str() + (n - slice) * i / (slices - 1), int(slice));
+        libzpaq::ComponentStats stats[256];
+        libzpaq::compressBlock(&probe, &discard, r.fullMethod.c_str(), nullptr, nullptr, false, stats, nullptr, 0,
+                               kStatsEvery);
+        while (r.components < 256 && stats[r.components].type) ++r.components;
+        r.slimMethod = slimMethod(r.fullMethod, stats, budget, &r.dropped);
+        r.probeBytes = probe.size();
+    }
+    libzpaq::compressBlock(in, out, r.slimMethod.c_str(), filename, comment, dosha1);
+    return r;
+}
+
+}  // namespace prune
@@ -0,0 +1,56 @@
+/**
+ * @file prune.h
+ * @brief Adaptive component pruning for PAQMan ("fast level 5", method `5f`).
+ *
+ * Level 5 runs 20 or more components on every bit, and on many inputs
+ * several of them contribute almost nothing. compressBlockAdaptive() codes
+ * a probe of slices from across a block with the full level 5 model while
+ * collecting libzpaq::ComponentStats, removes the components whose input
+ * saves the mixers least, and codes the block with the slimmed model. The
+ * probe's output is thrown away; the block is an ordinary ZPAQ block.
+ */
+
+#ifndef PAQMAN_PRUNE_H
+#define PAQMAN_PRUNE_H
+
+#include "libzpaq.h"
+#include <string>
+
+namespace prune {
+
+// Fraction of the probe's coded size that the dropped components may
+// have saved, in total.
+const double kDefaultBudget = 0.02;
+
+// The probe collects stats on 1 byte in this many, coded with the
+// interpreter, and codes the others with the JIT.
+const int kStatsEvery = 8;
+
+// Returns the expanded method ("x...", see libzpaq::expandMethod()) with
+// the least valuable components removed, cheapest first, while the bits
+// they saved in stats[] stay within budget times the coded size. ISSEs in
+// the middle of a chain are merged into the next one, so later contexts
+// keep their order. Methods it cannot parse are returned unchanged.
+// Sets *dropped to the number of components removed if not null.
+std::string slimMethod(const std::string& method, const libzpaq::ComponentStats* stats, double budget,
+                       int* dropped = nullptr);
+
+struct BlockReport {
+    std::string fullMethod;  // expanded level 5 method
+    std::string slimMethod;  // method the block is coded with
+    int components = 0;      // in the full model
+    int dropped = 0;         // removed from the slim model
+    size_t probeBytes = 0;   // coded with the full model, 0 if none
+};
+
+// Compresses in to out as one block with the slimmed model, or with the
+// full model if in is under 2 MiB, too small to be worth probing.
+// Arguments as libzpaq::compressBlock(); method is a level 5 method ("5",
+// "5B,R,t").
+BlockReport compressBlockAdaptive(libzpaq::StringBuffer* in, libzpaq::Writer* out, const char* method,
+                                  const char* filename = nullptr, const char* comment = nullptr,
+                                  bool dosha1 = true, double budget = kDefaultBudget);
+
+}  // namespace prune
+
+#endif  // PAQMAN_PRUNE_H
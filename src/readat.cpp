@@ -0,0 +1,294 @@
+/**
+ * @file readat.cpp
+ * @brief Random access reads into compressed files (`paqman read`).
+ *
+ * The index comes from archive::scan() of every volume. A segment's size
+ * is the number its comment starts with, as written by compressBlock()
+ * and compressSegments(); a block whose comments do not give sizes is
+ * decoded once while indexing to measure them. A file named again later
+ * in the archive is replaced, as extraction replaces it.
+ *
+ * Blocks are decoded outside the cache lock, so reads of other blocks
+ * go on meanwhile; two threads missing the same block may both decode it.
+ * A primed block (see seekable.h) is decoded with the data of its file's
+ * prime, which is looked up in the cache like any other block.
+ */
+
+#include "readat.h"
+#include "archive.h"
+#include "libzpaq.h"
+#include "seekable.h"
+#include "sparse.h"
+#include "volume.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace readat {
+
+namespace {
+
+typedef std::vector<std::string> Decoded;  // data of each segment of a block
+
+// A segment of a file.
+struct Piece {
+    size_t block, segment;
+    uint64_t start;   // offset in the file
+    uint64_t bytes;   // data bytes, without the zero runs
+    uint64_t length;  // bytes and zero runs
+    std::vector<sparse::Run> runs;
+};
+
+struct File {
+    std::vector<Piece> pieces;  // non-empty ones, by start
+    uint64_t size = 0;
+    size_t primeBlock = 0, primeSegment = 0;
+    bool primed = false;  // has a prime
+};
+
+struct BlockRange {
+    const char* begin;
+    const char* end;
+    uint64_t bytes;  // data bytes of all segments
+    uint64_t primed;  // bytes of the prime it was coded with, or 0
+    size_t primeBlock, primeSegment;
+};
+
+class StringWriter : public libzpaq::Writer {
+public:
+    explicit StringWriter(std::string& s) : s(s) {}
+    void put(int c) override { s.push_back(char(c)); }
+    void write(const char* buf, int n) override { s.append(buf, n); }
+
+private:
+    std::string& s;
+};
+
+bool hasSize(const std::string& comment) {
+    return !comment.empty() && std::isdigit((unsigned char)comment[0]);
+}
+
+}  // namespace
+
+struct Archive::Impl {
+    std::vector<std::unique_ptr<archive::Mapping>> parts;
+    std::vector<BlockRange> blocks;
+    std::map<std::string, File> files;
+    std::vector<std::string> order;  // names in archive order
+    std::string current;             // file of the last named segment, across volumes
+
+    size_t cacheBytes;
+    mutable std::mutex m;
+    std::list<size_t> recent;  // cached blocks, most recent first
+    std::unordered_map<size_t, std::pair<std::shared_ptr<const Decoded>, std::list<size_t>::iterator>> cache;
+    size_t cached = 0;  // bytes
+    Stats stats;
+
+    std::shared_ptr<const Decoded> decode(size_t b) {
+        std::shared_ptr<Decoded> out(new Decoded);
+        libzpaq::Decompresser d;
+        std::shared_ptr<const Decoded> prime;
+        if (blocks[b].primed > 0) {
+            prime = block(blocks[b].primeBlock);
+            const std::string& p = prime->at(blocks[b].primeSegment);
+            if (p.size() < blocks[b].primed) throw std::runtime_error("Prime of block " + std::to_string(b) + " is short");
+            d.setPrime(p.data(), blocks[b].primed);
+        }
+        d.setInput(blocks[b].begin, blocks[b].end);
+        if (!d.findBlock()) throw std::runtime_error("Block " + std::to_string(b) + " is gone from the archive");
+        for (libzpaq::StringBuffer comment; d.findFilename(); comment.reset()) {
+            d.readComment(&comment);
+            out->emplace_back();
+            StringWriter w(out->back());
+            d.setOutput(&w);
+            archive::decodeSegment(d, std::string(comment.c_str(), comment.size()), "block " + std::to_string(b));
+        }
+        return out;
+    }
+
+    // Caller holds m.
+    void insert(size_t b, std::shared_ptr<const Decoded> data) {
+        if (cache.count(b)) return;
+        recent.push_front(b);
+        cache[b] = {data, recent.begin()};
+        cached += blocks[b].bytes;
+        while (cached > cacheBytes && recent.size() > 1) {
+            const size_t old = recent.back();
+            recent.pop_back();
+            cached -= blocks[old].bytes;
+            cache.erase(old);
+        }
+    }
+
+    std::shared_ptr<const Decoded> block(size_t b) {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            auto it = cache.find(b);
+            if (it != cache.end()) {
+                ++stats.hits;
+                recent.splice(recent.begin(), recent, it->second.second);
+                return it->second.first;
+            }
+        }
+        std::shared_ptr<const Decoded> data = decode(b);
+        std::lock_guard<std::mutex> lock(m);
+        ++stats.decoded;
+        insert(b, data);
+        return data;
+    }
+
+    void index(const archive::Mapping& part) {
+        for (const archive::Block& b : archive::scan(part)) {
+            const size_t block = blocks.size();
+            blocks.push_back({part.data() + b.start, part.data() + b.end, 0, 0, 0, 0});
+            std::shared_ptr<const Decoded> measured;
+            for (size_t i = 0; i < b.segments.size(); ++i) {
+                const archive::Segment& s = b.segments[i];
+                if (s.named) {
+                    current = s.file;
+                    if (!files.count(current)) order.push_back(current);
+                    files[current] = File();
+                }
+                if (seekable::isPrime(s.comment)) {
+                    files[current].primeBlock = block;
+                    files[current].primeSegment = i;
+                    files[current].primed = true;
+                }
+                if (const uint64_t primed = seekable::primedBytes(s.comment)) {
+                    const File& f = files[current];
+                    if (!f.primed || i > 0) {
+                        throw std::runtime_error("Primed block " + std::to_string(block) + " without its prime");
+                    }
+                    blocks[block].primed = primed;
+                    blocks[block].primeBlock = f.primeBlock;
+                    blocks[block].primeSegment = f.primeSegment;
+                }
+                Piece p;
+                p.block = block;
+                p.segment = i;
+                if (hasSize(s.comment)) {
+                    p.bytes = std::strtoull(s.comment.c_str(), nullptr, 10);
+                    p.runs = sparse::parseRuns(s.comment);
+                } else {
+                    if (!measured) measured = decode(block);
+                    if (i >= measured->size()) throw std::runtime_error("Block " + std::to_string(block) + " changed");
+                    p.bytes = (*measured)[i].size();
+                }
+                p.length = p.bytes;
+                for (const sparse::Run& r : p.runs) p.length += r.length;
+                blocks[block].bytes += p.bytes;
+                File& f = files[current];
+                p.start = f.size;
+                f.size += p.length;
+                if (p.length > 0) f.pieces.push_back(std::move(p));
+            }
+            if (measured) insert(block, measured);
+        }
+    }
+
+    const File& file(const std::string& name) const {
+        auto it = files.find(name);
+        if (it == files.end()) throw std::runtime_error("File not in archive: " + name);
+        return it->second;
+    }
+
+    // Copies n bytes of p from offset from in the file to out: its data
+    // chunks from the decoded block, its zero runs as zeros.
+    void copy(const Piece& p, uint64_t from, uint64_t n, char* out) {
+        std::shared_ptr<const Decoded> data;
+        uint64_t at = 0, dataAt = 0;  // chunk start in the piece and in its data
+        for (size_t r = 0; r <= p.runs.size() && n > 0; ++r) {
+            const uint64_t dataEnd = r < p.runs.size() ? p.runs[r].pos : p.bytes;
+            const uint64_t chunks[2] = {dataEnd - dataAt, r < p.runs.size() ? p.runs[r].length : 0};
+            for (int zero = 0; zero < 2; ++zero) {
+                const uint64_t end = at + chunks[zero];
+                if (from < end && n > 0) {
+                    const uint64_t take = std::min(n, end - from);
+                    if (zero) {
+                        std::memset(out, 0, take);
+                    } else {
+                        if (!data) data = block(p.block);
+                        const std::string& s = (*data).at(p.segment);
+                        if (s.size() < dataAt + (from - at) + take) {
+                            throw std::runtime_error("Segment shorter than its comment in block " +
+                                                     std::to_string(p.block));
+                        }
+                        std::memcpy(out, s.data() + dataAt + (from - at), take);
+                    }
+                    out += take;
+                    from += take;
+                    n -= take;
+                }
+                at = end;
+            }
+            dataAt = dataEnd;
+        }
+    }
+};
+
+Archive::Archive(const std::string& path, size_t cacheBytes) : impl(new Impl) {
+    impl->cacheBytes = cacheBytes;
+    const std::vector<std::string> parts = volume::parts(path);
+    if (parts.empty()) throw std::runtime_error("Cannot open archive: " + path);
+    for (const std::string& part : parts) {
+        impl->parts.emplace_back(new archive::Mapping(part));
+        impl->index(*impl->parts.back());
+    }
+}
+
+Archive::~Archive() = default;
+
+std::vector<std::string> Archive::files() const {
+    return impl->order;
+}
+
+bool Archive::contains(const std::string& file) const {
+    return impl->files.count(file) > 0;
+}
+
+uint64_t Archive::size(const std::string& file) const {
+    return impl->file(file).size;
+}
+
+size_t Archive::blocks() const {
+    return impl->blocks.size();
+}
+
+size_t Archive::readAt(const std::string& file, uint64_t offset, char* buf, size_t len) {
+    const File& f = impl->file(file);
+    if (offset >= f.size) return 0;
+    len = size_t(std::min<uint64_t>(len, f.size - offset));
+    auto p = std::upper_bound(f.pieces.begin(), f.pieces.end(), offset,
+                              [](uint64_t o, const Piece& q) { return o < q.start; }) - 1;
+    for (size_t done = 0; done < len; ++p) {
+        const uint64_t from = offset + done - p->start;
+        const uint64_t n = std::min<uint64_t>(len - done, p->length - from);
+        impl->copy(*p, from, n, buf + done);
+        done += n;
+    }
+    return len;
+}
+
+std::string Archive::readAt(const std::string& file, uint64_t offset, size_t len) {
+    const uint64_t size = impl->file(file).size;
+    std::string s(offset < size ? size_t(std::min<uint64_t>(len, size - offset)) : 0, '\0');
+    readAt(file, offset, &s[0], s.size());
+    return s;
+}
+
+Stats Archive::stats() const {
+    std::lock_guard<std::mutex> lock(impl->m);
+    return impl->stats;
+}
+
+std::string readAt(const std::string& archive, const std::string& file, uint64_t offset, size_t len) {
+    return Archive(archive, 0).readAt(file, offset, len);
+}
+
+}  // namespace readat
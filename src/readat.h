@@ -0,0 +1,67 @@
+/**
+ * @file readat.h
+ * @brief Random access reads into compressed files (`paqman read`).
+ *
+ * readat::Archive indexes an archive once, from its segment headers only:
+ * every file becomes a list of pieces, each a segment with its offset in
+ * the file, its size and the zero runs left out of it (see sparse.h). A
+ * read decodes only the blocks whose pieces overlap the range, so reading
+ * 4 KiB of a large file costs one block, not the file. Decoded blocks are
+ * kept in a cache of recently used blocks, bounded in bytes. Zero runs
+ * are filled in without decoding anything.
+ *
+ * Blocks are the unit of decoding because the segments of a block share
+ * the model state; a read from a small file in a directory block decodes
+ * the block's segments up to it.
+ */
+
+#ifndef PAQMAN_READAT_H
+#define PAQMAN_READAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace readat {
+
+const size_t kDefaultCache = 64 << 20;  // bytes of decoded blocks
+
+struct Stats {
+    uint64_t decoded = 0;  // blocks decoded by reads
+    uint64_t hits = 0;     // block lookups served from the cache
+};
+
+class Archive {
+public:
+    // Maps the archive at path, or its volumes (see volume.h), and indexes
+    // its files. Throws if there is none or it has no blocks.
+    explicit Archive(const std::string& path, size_t cacheBytes = kDefaultCache);
+    ~Archive();
+
+    std::vector<std::string> files() const;  // in archive order
+    bool contains(const std::string& file) const;
+    uint64_t size(const std::string& file) const;  // throws if not in the archive
+    size_t blocks() const;
+
+    // Copies up to len bytes of file starting at offset to buf; fewer at
+    // the end of the file. Returns the number copied. Throws if file is
+    // not in the archive. Safe to call from several threads.
+    size_t readAt(const std::string& file, uint64_t offset, char* buf, size_t len);
+    std::string readAt(const std::string& file, uint64_t offset, size_t len);
+
+    Stats stats() const;
+
+    struct Impl;
+
+private:
+    std::unique_ptr<Impl> impl;
+};
+
+// Reads one range without keeping the index.
+std::string readAt(const std::string& archive, const std::string& file, uint64_t offset, size_t len);
+
+}  // namespace readat
+
+#endif  // PAQMAN_READAT_H
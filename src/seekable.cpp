@@ -0,0 +1,78 @@
+/**
+ * @file seekable.cpp
+ * @brief Seekable archives of small primed blocks (`paqman c --seekable`).
+ */
+
+#include "seekable.h"
+#include <sstream>
+#include <stdexcept>
+
+namespace seekable {
+
+// Passes decoded data on to out and keeps a copy.
+class Primer::Keeper : public libzpaq::Writer {
+public:
+    Keeper(std::string& kept, libzpaq::Writer* out) : kept(kept), out(out) {}
+    void put(int c) override {
+        kept.push_back(char(c));
+        out->put(c);
+    }
+    void write(const char* buf, int n) override {
+        kept.append(buf, n);
+        out->write(buf, n);
+    }
+
+private:
+    std::string& kept;
+    libzpaq::Writer* out;
+};
+
+std::string primeNote() {
+    return " prime";
+}
+
+std::string primedNote(uint64_t bytes) {
+    return " primed=" + std::to_string(bytes);
+}
+
+bool isPrime(const std::string& comment) {
+    std::istringstream words(comment);
+    std::string w;
+    while (words >> w) {
+        if (w == "prime") return true;
+    }
+    return false;
+}
+
+uint64_t primedBytes(const std::string& comment) {
+    std::istringstream words(comment);
+    std::string w;
+    while (words >> w) {
+        if (w.compare(0, 7, "primed=") == 0) return std::stoull(w.substr(7));
+    }
+    return 0;
+}
+
+Primer::Primer() = default;
+Primer::~Primer() = default;
+
+libzpaq::Writer* Primer::segment(libzpaq::Decompresser& d, bool named, const std::string& comment,
+                                 libzpaq::Writer* out) {
+    if (named) prime.clear();
+    d.setPrime(0, 0);
+    if (isPrime(comment)) {
+        prime.clear();
+        keeper.reset(new Keeper(prime, out));
+        return keeper.get();
+    }
+    const uint64_t n = primedBytes(comment);
+    if (n > 0) {
+        if (prime.size() < n) {
+            throw std::runtime_error("Primed block without the " + std::to_string(n) + " byte prime of its file");
+        }
+        d.setPrime(prime.data(), n);
+    }
+    return out;
+}
+
+}  // namespace seekable
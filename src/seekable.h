@@ -0,0 +1,64 @@
+/**
+ * @file seekable.h
+ * @brief Seekable archives of small primed blocks (`paqman c --seekable`).
+ *
+ * A random read decodes whole blocks, so seekable archives want small
+ * ones, but a small block starting from empty models loses ratio. With
+ * --seekable, compressFile() writes the first bytes of the file as a
+ * block of their own, the prime, with the comment "<size> prime". Every
+ * later block of the file is at most the block size and is coded by a
+ * model first trained on those bytes (libzpaq::Compressor::setPrime()),
+ * and its comment says so as "<size> primed=<prime bytes>". The prime is
+ * stored once, as the start of the file; each primed block needs only it
+ * to decode, so blocks can be decoded in any order and in parallel.
+ *
+ * Training replays the prime through the model, so decoding a primed
+ * block also costs coding the prime again. Priming helps the context
+ * models of levels 4 and 5; level 3 gains little and levels 0-2 nothing.
+ */
+
+#ifndef PAQMAN_SEEKABLE_H
+#define PAQMAN_SEEKABLE_H
+
+#include "libzpaq.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace seekable {
+
+const size_t kDefaultBlock = 2 << 20;
+const size_t kDefaultPrime = 512 << 10;
+
+// Comment words after the size (and any holes, see sparse.h).
+std::string primeNote();                 // " prime"
+std::string primedNote(uint64_t bytes);  // " primed=<bytes>"
+
+// Whether a segment comment marks a prime, and the prime bytes a primed
+// segment was coded with (0 if it was not).
+bool isPrime(const std::string& comment);
+uint64_t primedBytes(const std::string& comment);
+
+// Primes a Decompresser for the segments of an archive decoded in order.
+// Call segment() after readComment() of every segment; named is true for
+// a segment that starts a file. It sets d's prime for a primed block and
+// clears it otherwise, and returns the writer to decode the segment to:
+// out, or for a prime, a writer that keeps a copy of the data too. Throws
+// if a primed segment comes without a prime of its file, or a larger one.
+class Primer {
+public:
+    Primer();
+    ~Primer();
+    libzpaq::Writer* segment(libzpaq::Decompresser& d, bool named, const std::string& comment,
+                             libzpaq::Writer* out);
+
+private:
+    class Keeper;
+    std::unique_ptr<Keeper> keeper;
+    std::string prime;  // of the current file
+};
+
+}  // namespace seekable
+
+#endif  // PAQMAN_SEEKABLE_H
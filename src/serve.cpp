@@ -0,0 +1,986 @@
+/**
+ * @file serve.cpp
+ * @brief Compression daemon for PAQMan (`paqman serve`, `client`, `loadtest`).
+ *
+ * Each connection has a thread that reads its requests, queues them for
+ * the workers and sends the replies. Streamed bytes are copied into a
+ * memfd as they arrive, so every job reads a file: archives are mapped to
+ * be decompressed, and inputs are compressed through sparse::Reader, which
+ * leaves out holes as `paqman c` does. Results are written to the output
+ * file, or to a new memfd that is sealed before it is sent. Freed model
+ * tables stay in the heap, so a worker's next job reuses memory that is
+ * already mapped.
+ *
+ * The workers make libzpaq errors throw (see throwLibzpaqErrors in
+ * main.cpp), so damaged input fails its job and not the daemon. The
+ * socket is made accessible to its owner only, since the daemon opens
+ * files for its clients.
+ */
+
+#include "serve.h"
+#include "archive.h"
+#include "benchutil.h"
+#include "corpus.h"
+#include "libzpaq.h"
+#include "prune.h"
+#include "seekable.h"
+#include "sparse.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <malloc.h>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace benchutil;
+namespace fs = std::filesystem;
+
+// Defined in main.cpp: makes libzpaq::error() throw in this thread.
+extern thread_local bool throwLibzpaqErrors;
+
+namespace {
+
+const int kBlockSize = (0x100000 << 4) - 4096;  // as paqman c
+const size_t kBufferSize = 1 << 20;            // result bytes written at once
+
+std::string sysError(const std::string& what) {
+    return what + ": " + std::strerror(errno);
+}
+
+std::string defaultSocket() {
+    const char* dir = std::getenv("XDG_RUNTIME_DIR");
+    if (dir && *dir) return std::string(dir) + "/paqman.sock";
+    return "/tmp/paqman-" + std::to_string(getuid()) + ".sock";
+}
+
+sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un a{};
+    a.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(a.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+    std::memcpy(a.sun_path, path.c_str(), path.size() + 1);
+    return a;
+}
+
+// Owns a file descriptor.
+class Fd {
+public:
+    explicit Fd(int fd = -1) : fd(fd) {}
+    ~Fd() { reset(); }
+    Fd(Fd&& o) : fd(o.release()) {}
+    Fd& operator=(Fd&& o) {
+        reset(o.release());
+        return *this;
+    }
+
+    int get() const { return fd; }
+    int release() {
+        const int r = fd;
+        fd = -1;
+        return r;
+    }
+    void reset(int f = -1) {
+        if (fd >= 0) ::close(fd);
+        fd = f;
+    }
+
+private:
+    int fd;
+};
+
+Fd newMemfd(const char* name) {
+    const int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) throw std::runtime_error(sysError("Cannot create memfd"));
+    return Fd(fd);
+}
+
+// Makes a memfd read-only for good, so a client can map it safely.
+void seal(int fd) {
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        throw std::runtime_error(sysError("Cannot seal memfd"));
+    }
+}
+
+uint64_t fileSize(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) throw std::runtime_error(sysError("Cannot stat input"));
+    return uint64_t(st.st_size);
+}
+
+void writeAll(int fd, const char* p, size_t n, uint64_t offset, const std::string& what) {
+    while (n > 0) {
+        const ssize_t r = ::pwrite(fd, p, n, off_t(offset));
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) throw std::runtime_error(sysError("Cannot write " + what));
+        p += r;
+        n -= r;
+        offset += r;
+    }
+}
+
+// Copies n bytes from the start of file from to the file or socket to,
+// in the kernel where it can.
+void copyFile(int from, int to, uint64_t n) {
+    off_t offset = 0;
+    while (uint64_t(offset) < n) {
+        const size_t chunk = size_t(std::min<uint64_t>(n - offset, 1 << 30));
+        ssize_t r = sendfile(to, from, &offset, chunk);
+        if (r < 0 && errno == EINVAL) {  // e.g. a terminal
+            char buf[64 << 10];
+            r = ::pread(from, buf, std::min(sizeof(buf), chunk), offset);
+            if (r > 0) {
+                for (ssize_t done = 0, w; done < r; done += w) {
+                    while ((w = ::write(to, buf + done, r - done)) < 0 && errno == EINTR) {}
+                    if (w < 0) throw std::runtime_error(sysError("Cannot write result"));
+                }
+                offset += r;
+            }
+        }
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) throw std::runtime_error(sysError("Cannot copy result"));
+        if (r == 0) throw std::runtime_error("Result ended early");
+    }
+}
+
+// Copies file from to the start of the new file to, leaving its holes
+// (from a sparse decompressed result) as holes.
+void copySparse(int from, int to, uint64_t n) {
+    for (off_t data = 0; uint64_t(data) < n;) {
+        data = lseek(from, data, SEEK_DATA);
+        if (data < 0) break;  // a hole up to the end
+        const off_t hole = lseek(from, data, SEEK_HOLE);
+        if (hole < 0 || lseek(to, data, SEEK_SET) < 0) {
+            throw std::runtime_error(sysError("Cannot copy result"));
+        }
+        for (off_t offset = data; offset < hole;) {
+            const ssize_t r = sendfile(to, from, &offset, size_t(hole - offset));
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) throw std::runtime_error(sysError("Cannot copy result"));
+        }
+        data = hole;
+    }
+    if (ftruncate(to, off_t(n)) != 0) throw std::runtime_error(sysError("Cannot size result"));
+}
+
+// Replaces the field and line separators of the protocol in a message.
+std::string oneField(std::string s) {
+    for (char& c : s) {
+        if (c == '\t' || c == '\n') c = ' ';
+    }
+    return s;
+}
+
+std::vector<std::string> splitFields(const std::string& line) {
+    std::vector<std::string> f;
+    size_t start = 0;
+    for (size_t tab; (tab = line.find('\t', start)) != std::string::npos; start = tab + 1) {
+        f.push_back(line.substr(start, tab - start));
+    }
+    f.push_back(line.substr(start));
+    return f;
+}
+
+std::string joinFields(const std::vector<std::string>& f) {
+    std::string line;
+    for (size_t i = 0; i < f.size(); ++i) line += (i ? "\t" : "") + f[i];
+    return line + "\n";
+}
+
+uint64_t parseLength(const std::string& s) {
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long n = std::strtoull(s.c_str(), &end, 10);
+    if (s.empty() || *end || errno || s[0] == '-') throw std::runtime_error("Invalid length: " + s);
+    return n;
+}
+
+// --- Socket messages ---
+
+// Lines and bytes over a Unix socket, with the file descriptors that come
+// with them kept in order of arrival.
+class Channel {
+public:
+    explicit Channel(int fd) : fd(fd) {}
+
+    // Reads the next line without its newline. Returns false at the end
+    // of the stream.
+    bool readLine(std::string& line) {
+        for (size_t scanned = 0;;) {  // bytes after pos without a newline
+            const size_t nl = buf.find('\n', pos + scanned);
+            if (nl != std::string::npos) {
+                line.assign(buf, pos, nl - pos);
+                pos = nl + 1;
+                return true;
+            }
+            scanned = buf.size() - pos;
+            if (!receive()) {
+                if (pos < buf.size()) throw std::runtime_error("Connection closed in a line");
+                return false;
+            }
+        }
+    }
+
+    // Copies the next n bytes to the file out.
+    void copyTo(int out, uint64_t n, const std::string& what) {
+        uint64_t done = 0;
+        while (done < n) {
+            if (pos == buf.size() && !receive()) throw std::runtime_error("Connection closed in the data");
+            const size_t take = size_t(std::min<uint64_t>(n - done, buf.size() - pos));
+            writeAll(out, buf.data() + pos, take, done, what);
+            pos += take;
+            done += take;
+        }
+    }
+
+    // The oldest descriptor received and not taken yet, or -1.
+    Fd takeFd() {
+        if (fds.empty()) return Fd();
+        Fd f = std::move(fds.front());
+        fds.pop_front();
+        return f;
+    }
+
+    // Sends line, passing passFd with it if it is not -1.
+    void send(const std::string& line, int passFd = -1) {
+        iovec iov{const_cast<char*>(line.data()), line.size()};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        if (passFd >= 0) {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cmsghdr* c = CMSG_FIRSTHDR(&msg);
+            c->cmsg_level = SOL_SOCKET;
+            c->cmsg_type = SCM_RIGHTS;
+            c->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(c), &passFd, sizeof(int));
+        }
+        ssize_t r;
+        do {
+            r = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        } while (r < 0 && errno == EINTR);
+        if (r < 0) throw std::runtime_error(sysError("Cannot write to socket"));
+        for (size_t done = r; done < line.size();) {
+            r = ::send(fd, line.data() + done, line.size() - done, MSG_NOSIGNAL);
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0) throw std::runtime_error(sysError("Cannot write to socket"));
+            done += r;
+        }
+    }
+
+private:
+    int fd;
+    std::string buf;  // received, consumed up to pos
+    size_t pos = 0;
+    std::deque<Fd> fds;
+
+    bool receive() {
+        if (pos == buf.size()) buf.clear(), pos = 0;
+        char data[64 << 10];
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * 8)];
+        iovec iov{data, sizeof(data)};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t r;
+        do {
+            r = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        } while (r < 0 && errno == EINTR);
+        if (r < 0) throw std::runtime_error(sysError("Cannot read from socket"));
+        for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+            const size_t n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < n; ++i) {
+                int f;
+                std::memcpy(&f, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+                fds.emplace_back(f);
+            }
+        }
+        buf.append(data, r);
+        return r > 0;
+    }
+};
+
+// --- Jobs ---
+
+// Writes to a file through a buffer. The zero runs of the current segment
+// (see sparse.h) are left as holes by skipping over them.
+class FdWriter : public libzpaq::Writer {
+public:
+    FdWriter(int fd, const std::string& what) : fd(fd), what(what) { buf.reserve(kBufferSize); }
+
+    void put(int c) override {
+        char b = char(c);
+        write(&b, 1);
+    }
+
+    void write(const char* p, int n) override {
+        while (n > 0) {
+            skipRuns();
+            int take = n;
+            if (next < runs.size()) take = int(std::min<uint64_t>(take, runs[next].pos - segmentBytes));
+            buf.append(p, take);
+            if (buf.size() >= kBufferSize) flush();
+            segmentBytes += take;
+            p += take;
+            n -= take;
+        }
+    }
+
+    // Starts a segment whose data leaves out runs.
+    void segment(std::vector<sparse::Run> r) {
+        skipRuns();
+        runs.swap(r);
+        next = 0;
+        segmentBytes = 0;
+    }
+
+    // Flushes, and extends the file over a hole at the end. Returns its size.
+    uint64_t finish() {
+        skipRuns();
+        flush();
+        if (ftruncate(fd, off_t(offset)) != 0) throw std::runtime_error(sysError("Cannot size " + what));
+        return offset;
+    }
+
+private:
+    int fd;
+    std::string what;
+    std::string buf;
+    uint64_t offset = 0;  // of buf in the file
+    std::vector<sparse::Run> runs;
+    size_t next = 0;  // first run not skipped yet
+    uint64_t segmentBytes = 0;
+
+    void flush() {
+        writeAll(fd, buf.data(), buf.size(), offset, what);
+        offset += buf.size();
+        buf.clear();
+    }
+
+    void skipRuns() {
+        for (; next < runs.size() && runs[next].pos == segmentBytes; ++next) {
+            flush();
+            offset += runs[next].length;
+        }
+    }
+};
+
+// Compresses the file at path as `paqman c` does, storing name as its
+// file name. Returns the input size.
+uint64_t compressTo(const std::string& path, const std::string& name, const std::string& method, FdWriter& out) {
+    if ((method.size() != 1 || method < "0" || method > "5") && method != "5f") {
+        throw std::runtime_error("Invalid method '" + method + "', use 0-5 or 5f");
+    }
+    sparse::Reader in(path);
+    libzpaq::StringBuffer sb(kBlockSize), archive;
+    sb.write(0, kBlockSize);
+    uint64_t bytes = 0;
+    for (int block = 0;; ++block) {
+        const int n = in.read(reinterpret_cast<char*>(sb.data()), kBlockSize);
+        const std::vector<sparse::Run> runs = in.takeRuns();
+        if (n == 0 && runs.empty()) break;
+        bytes += n;
+        sb.resize(n);
+        const std::string note = sparse::formatRuns(runs);
+        const char* comment = note.empty() ? nullptr : note.c_str() + 1;
+        const char* filename = block == 0 ? name.c_str() : nullptr;
+        if (method == "5f") {
+            prune::compressBlockAdaptive(&sb, &archive, "5", filename, comment, true);
+        } else {
+            libzpaq::compressBlock(&sb, &archive, method.c_str(), filename, comment, true);
+        }
+        out.write(archive.c_str(), static_cast<int>(archive.size()));
+        archive.resize(0);
+        sb.resize(0);
+        if (n == 0) break;
+    }
+    return bytes + in.skipped();
+}
+
+// Decompresses the data of every segment of the archive at path in order.
+// Returns the archive size.
+uint64_t decompressTo(const std::string& path, FdWriter& out) {
+    archive::Mapping m(path);
+    libzpaq::Decompresser d;
+    d.setInput(m.data(), m.data() + m.size());
+    libzpaq::StringBuffer name, comment;
+    seekable::Primer primer;
+    int blocks = 0;
+    for (; d.findBlock(); ++blocks) {
+        while (d.findFilename(&name)) {
+            comment.resize(0);
+            d.readComment(&comment);
+            const std::string text(comment.c_str(), comment.size());
+            out.segment(sparse::parseRuns(text));
+            d.setOutput(primer.segment(d, name.size() > 0, text, &out));
+            name.resize(0);
+            archive::decodeSegment(d, text, "block " + std::to_string(blocks) + " of " + path);
+        }
+    }
+    if (blocks == 0 && m.size() > 0) throw std::runtime_error("No ZPAQ blocks in " + path);
+    return m.size();
+}
+
+struct Reply {
+    std::string line;
+    Fd result;  // for fd and data jobs
+};
+
+Reply errorReply(const std::string& message) {
+    Reply r;
+    r.line = "error\t" + oneField(message) + "\n";
+    return r;
+}
+
+// Runs a request whose fields were checked by the connection, on input
+// for fd and data jobs.
+Reply runJob(const std::vector<std::string>& f, const Fd& input) {
+    const bool paths = f[2] == "path";
+    const std::string in = paths ? f[4] : "/proc/self/fd/" + std::to_string(input.get());
+    const std::string what = paths ? f[5] : "result";
+    Fd out(paths ? ::open(what.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : newMemfd("paqman").release());
+    if (out.get() < 0) throw std::runtime_error("Cannot open output file: " + what);
+    uint64_t inBytes, outBytes;
+    try {
+        FdWriter w(out.get(), what);
+        inBytes = f[0] == "c" ? compressTo(in, f[3], f[1], w) : decompressTo(in, w);
+        outBytes = w.finish();
+    } catch (const std::exception&) {
+        if (paths) ::unlink(what.c_str());
+        throw;
+    }
+    Reply r;
+    r.line = "ok\t" + std::to_string(inBytes) + "\t" + std::to_string(outBytes) + "\n";
+    if (paths) {
+        if (::close(out.release()) != 0) throw std::runtime_error(sysError("Cannot close " + what));
+    } else {
+        seal(out.get());
+        r.result = std::move(out);
+    }
+    return r;
+}
+
+// --- Daemon ---
+
+struct Job {
+    std::vector<std::string> fields;
+    Fd input;
+    std::promise<Reply> done;
+};
+
+// Keeps freed model tables (up to 32 MiB each) in the heap, where the next
+// job finds them mapped instead of faulting in fresh pages. Called before
+// any thread starts, so that every arena keeps them.
+void keepModelMemory() {
+    mallopt(M_MMAP_THRESHOLD, 32 << 20);
+    mallopt(M_TRIM_THRESHOLD, 1 << 30);
+}
+
+int wakeWrite = -1;  // of the running server, for signals
+
+void onSignal(int) {
+    const char c = 'q';
+    if (wakeWrite >= 0 && ::write(wakeWrite, &c, 1) < 0) {
+        // nothing to do in a signal handler
+    }
+}
+
+class Server {
+public:
+    Server(const std::string& path, int threads) : path(path), threads(threads) {
+        const sockaddr_un a = socketAddress(path);
+        {
+            Fd probe(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+            if (probe.get() >= 0 && connect(probe.get(), (const sockaddr*)&a, sizeof(a)) == 0) {
+                throw std::runtime_error("A daemon is already serving " + path);
+            }
+        }
+        ::unlink(path.c_str());  // left by a daemon that was killed
+        listener.reset(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if (listener.get() < 0) throw std::runtime_error(sysError("Cannot create socket"));
+        const mode_t mask = umask(0077);
+        const int bound = bind(listener.get(), (const sockaddr*)&a, sizeof(a));
+        umask(mask);
+        if (bound != 0) throw std::runtime_error(sysError("Cannot bind " + path));
+        if (listen(listener.get(), 64) != 0) throw std::runtime_error(sysError("Cannot listen on " + path));
+        int p[2];
+        if (pipe2(p, O_CLOEXEC | O_NONBLOCK) != 0) throw std::runtime_error(sysError("Cannot create pipe"));
+        wakeRead.reset(p[0]);
+        wake.reset(p[1]);
+    }
+
+    ~Server() { ::unlink(path.c_str()); }
+
+    // Accepts connections until stop(), then waits for them and their jobs.
+    void run() {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) workers.emplace_back([this] { work(); });
+        for (;;) {
+            pollfd p[2] = {{listener.get(), POLLIN, 0}, {wakeRead.get(), POLLIN, 0}};
+            if (poll(p, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(sysError("Cannot poll " + path));
+            }
+            if (p[1].revents) break;
+            const int c = accept4(listener.get(), nullptr, nullptr, SOCK_CLOEXEC);
+            if (c < 0) continue;
+            std::lock_guard<std::mutex> lock(m);
+            open.insert(c);
+            std::thread([this, c] { connection(c); }).detach();
+        }
+        listener.reset();
+        std::unique_lock<std::mutex> lock(m);
+        for (int c : open) shutdown(c, SHUT_RDWR);
+        cv.wait(lock, [&] { return open.empty(); });
+        closing = true;
+        cv.notify_all();
+        lock.unlock();
+        for (std::thread& t : workers) t.join();
+    }
+
+    // Safe to call from any thread.
+    void stop() {
+        const char c = 'q';
+        if (::write(wake.get(), &c, 1) < 0 && errno != EAGAIN) throw std::runtime_error(sysError("Cannot stop"));
+    }
+
+    int wakeFd() const { return wake.get(); }
+    uint64_t jobs() const { return served; }
+    uint64_t failures() const { return failed; }
+
+private:
+    std::string path;
+    int threads;
+    Fd listener, wakeRead, wake;
+    std::mutex m;
+    std::condition_variable cv;  // queue, open or closing changed
+    std::deque<std::shared_ptr<Job>> queue;
+    std::set<int> open;  // connections
+    bool closing = false;
+    uint64_t served = 0, failed = 0;
+
+    void work() {
+        throwLibzpaqErrors = true;
+        for (;;) {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&] { return !queue.empty() || closing; });
+            if (queue.empty()) return;
+            std::shared_ptr<Job> job = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            Reply r;
+            try {
+                r = runJob(job->fields, job->input);
+            } catch (const std::exception& e) {
+                r = errorReply(e.what());
+            }
+            job->input.reset();
+            lock.lock();
+            ++served;
+            failed += r.line.compare(0, 6, "error\t") == 0;
+            lock.unlock();
+            job->done.set_value(std::move(r));
+        }
+    }
+
+    // Checks a request and reads its input. Throws if the stream cannot go on.
+    std::shared_ptr<Job> parse(const std::string& line, Channel& ch) {
+        std::shared_ptr<Job> job(new Job);
+        job->fields = splitFields(line);
+        const std::vector<std::string>& f = job->fields;
+        const size_t n = f.size();
+        const bool known = n >= 4 && (f[0] == "c" || f[0] == "d");
+        if (known && f[2] == "path" && n == 6) {
+            if (f[4].empty() || f[5].empty()) throw std::runtime_error("Empty path");
+        } else if (known && f[2] == "fd" && n == 4) {
+            job->input = ch.takeFd();
+            if (job->input.get() < 0) throw std::runtime_error("No file passed with the request");
+        } else if (known && f[2] == "data" && n == 5) {
+            job->input = newMemfd("paqman-input");
+            ch.copyTo(job->input.get(), parseLength(f[4]), "input");
+        } else {
+            throw std::runtime_error("Invalid request: " + line);
+        }
+        return job;
+    }
+
+    void connection(int c) {
+        Channel ch(c);
+        try {
+            std::string line;
+            while (ch.readLine(line)) {
+                if (line == "q") {
+                    ch.send("ok\t0\t0\n");
+                    stop();
+                    break;
+                }
+                std::shared_ptr<Job> job;
+                try {
+                    job = parse(line, ch);
+                } catch (const std::exception& e) {
+                    ch.send(errorReply(e.what()).line);
+                    break;
+                }
+                std::future<Reply> done = job->done.get_future();
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    queue.push_back(job);
+                    cv.notify_all();
+                }
+                Reply r = done.get();
+                ch.send(r.line, r.result.get());
+            }
+        } catch (const std::exception&) {
+            // the client went away
+        }
+        ::close(c);
+        std::lock_guard<std::mutex> lock(m);
+        open.erase(c);
+        cv.notify_all();
+    }
+};
+
+// --- Client ---
+
+class Connection {
+public:
+    explicit Connection(const std::string& path) : sock(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)), ch(sock.get()) {
+        const sockaddr_un a = socketAddress(path);
+        if (sock.get() < 0 || connect(sock.get(), (const sockaddr*)&a, sizeof(a)) != 0) {
+            throw std::runtime_error(sysError("Cannot connect to paqman serve at " + path));
+        }
+    }
+
+    // Sends a request with input passed as a file (send "fd"), streamed
+    // (send "data") or not at all (send "path"), and waits for the reply.
+    // Throws the daemon's error. Returns the sizes and the result.
+    Reply call(std::vector<std::string> fields, const std::string& send, int input = -1) {
+        if (send == "fd") {
+            ch.send(joinFields(fields), input);
+        } else if (send == "data") {
+            const uint64_t n = fileSize(input);
+            fields.push_back(std::to_string(n));
+            ch.send(joinFields(fields));
+            copyFile(input, sock.get(), n);
+        } else {
+            ch.send(joinFields(fields));
+        }
+        Reply r;
+        if (!ch.readLine(r.line)) throw std::runtime_error("paqman serve closed the connection");
+        const std::vector<std::string> f = splitFields(r.line);
+        if (f[0] == "error" && f.size() == 2) throw std::runtime_error(f[1]);
+        if (f[0] != "ok" || f.size() != 3) throw std::runtime_error("Invalid reply: " + r.line);
+        r.result = ch.takeFd();
+        if (send != "path" && r.result.get() < 0) throw std::runtime_error("No result passed with the reply");
+        return r;
+    }
+
+private:
+    Fd sock;
+    Channel ch;
+};
+
+// A file holding the input: the file at path, or for "-" standard input,
+// copied to a memfd unless it is a regular file.
+Fd openInput(const std::string& path) {
+    if (path != "-") {
+        Fd f(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (f.get() < 0) throw std::runtime_error("Cannot open input file: " + path);
+        return f;
+    }
+    struct stat st;
+    if (fstat(0, &st) == 0 && S_ISREG(st.st_mode) && lseek(0, 0, SEEK_CUR) == 0) return Fd(dup(0));
+    Fd f = newMemfd("paqman-stdin");
+    char buf[64 << 10];
+    uint64_t done = 0;
+    for (;;) {
+        const ssize_t r = ::read(0, buf, sizeof(buf));
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) throw std::runtime_error(sysError("Cannot read standard input"));
+        if (r == 0) break;
+        writeAll(f.get(), buf, r, done, "input");
+        done += r;
+    }
+    return f;
+}
+
+struct ClientOptions {
+    std::string socket = defaultSocket();
+    std::string send;  // path, fd or data; path if both files are named
+    std::string name;
+    std::vector<std::string> args;
+};
+
+ClientOptions parseClientOptions(int argc, char** argv) {
+    ClientOptions o;
+    for (int i = 0; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--socket") {
+            o.socket = optionValue(argc, argv, i);
+        } else if (a == "--send") {
+            o.send = optionValue(argc, argv, i);
+            if (o.send != "path" && o.send != "fd" && o.send != "data") {
+                throw std::runtime_error("Unknown --send '" + o.send + "', use path, fd or data");
+            }
+        } else if (a == "--name") {
+            o.name = optionValue(argc, argv, i);
+        } else if (a.size() > 1 && a[0] == '-') {
+            throw std::runtime_error("Unknown client option: " + a);
+        } else {
+            o.args.push_back(a);
+        }
+    }
+    const size_t n = o.args.size();
+    const bool job = n >= 3 && ((o.args[0] == "c" && n <= 4) || (o.args[0] == "d" && n == 3));
+    if (!job && !(n == 1 && o.args[0] == "stop")) {
+        throw std::runtime_error("Usage: paqman client [options] c <input> <output> [method] | d <input> <output> | stop");
+    }
+    return o;
+}
+
+// --- Load test ---
+
+struct LoadOptions {
+    std::string socket;  // empty: start a daemon in this process
+    int threads = std::max(1, int(std::thread::hardware_concurrency()));
+    int clients = 4;
+    int jobs = 64;
+    size_t size = 256 << 10;  // bytes
+    std::string method = "1";
+    corpus::Kind corpusKind = corpus::MIXED;
+    uint64_t seed = 1;
+    std::string send = "fd";
+    bool json = false;
+};
+
+LoadOptions parseLoadOptions(int argc, char** argv) {
+    LoadOptions o;
+    for (int i = 0; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--socket") {
+            o.socket = optionValue(argc, argv, i);
+        } else if (a == "--threads") {
+            o.threads = parseInt(optionValue(argc, argv, i), 1, 256, "thread count");
+        } else if (a == "--clients") {
+            o.clients = parseInt(optionValue(argc, argv, i), 1, 1024, "client count");
+        } else if (a == "--jobs") {
+            o.jobs = parseInt(optionValue(argc, argv, i), 1, 1 << 24, "job count");
+        } else if (a == "--size") {
+            o.size = size_t(parseInt(optionValue(argc, argv, i), 0, 1 << 20, "size")) << 10;
+        } else if (a == "--method") {
+            o.method = optionValue(argc, argv, i);
+        } else if (a == "--corpus") {
+            std::string kind = optionValue(argc, argv, i);
+            if (!corpus::parseKind(kind, o.corpusKind)) {
+                throw std::runtime_error("Unknown corpus '" + kind + "', use one of " + corpus::kindList());
+            }
+        } else if (a == "--seed") {
+            o.seed = parseInt(optionValue(argc, argv, i), 0, 0x7fffffff, "seed");
+        } else if (a == "--send") {
+            o.send = optionValue(argc, argv, i);
+            if (o.send != "fd" && o.send != "data") throw std::runtime_error("Unknown --send '" + o.send + "', use fd or data");
+        } else if (a == "--json") {
+            o.json = true;
+        } else {
+            throw std::runtime_error("Unknown loadtest option: " + a);
+        }
+    }
+    return o;
+}
+
+// True if file f holds exactly the bytes of s.
+bool sameContent(int f, const std::string& s) {
+    if (fileSize(f) != s.size()) return false;
+    if (s.empty()) return true;
+    void* p = mmap(nullptr, s.size(), PROT_READ, MAP_SHARED, f, 0);
+    if (p == MAP_FAILED) throw std::runtime_error(sysError("Cannot map result"));
+    const bool same = std::memcmp(p, s.data(), s.size()) == 0;
+    munmap(p, s.size());
+    return same;
+}
+
+}  // namespace
+
+// --- Entry Points ---
+
+int runServe(int argc, char** argv) {
+    std::string path = defaultSocket();
+    int threads = std::max(1, int(std::thread::hardware_concurrency()));
+    for (int i = 0; i < argc; ++i) {
+        const std::string a = argv[i];
+        if (a == "--socket") {
+            path = optionValue(argc, argv, i);
+        } else if (a == "--threads") {
+            threads = parseInt(optionValue(argc, argv, i), 1, 256, "thread count");
+        } else {
+            throw std::runtime_error("Unknown serve option: " + a);
+        }
+    }
+    keepModelMemory();
+    Server server(path, threads);
+    wakeWrite = server.wakeFd();
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    std::cout << "Serving on " << path << " with " << threads << " worker threads\n" << std::flush;
+    server.run();
+    wakeWrite = -1;
+    std::cout << "Stopped: " << server.jobs() << " jobs served, " << server.failures() << " failed\n";
+    return 0;
+}
+
+int runClient(int argc, char** argv) {
+    ClientOptions o = parseClientOptions(argc, argv);
+    Connection conn(o.socket);
+    const std::vector<std::string>& a = o.args;
+    if (a[0] == "stop") {
+        conn.call({"q"}, "path");
+        std::cout << "Stopped paqman serve on " << o.socket << "\n";
+        return 0;
+    }
+    const std::string &input = a[1], &output = a[2];
+    const bool compress = a[0] == "c";
+    const std::string method = compress ? (a.size() > 3 ? a[3] : "5") : "-";
+    std::string name = !compress ? "-" : !o.name.empty() ? o.name : input == "-" ? "stdin" : input;
+    std::string send = o.send.empty() ? (input == "-" || output == "-" ? "fd" : "path") : o.send;
+    if (send == "path" && (input == "-" || output == "-")) throw std::runtime_error("--send path needs two file names");
+
+    Reply r;
+    if (send == "path") {
+        r = conn.call({a[0], method, "path", name, fs::absolute(input).string(), fs::absolute(output).string()}, send);
+    } else {
+        Fd in = openInput(input);
+        r = conn.call({a[0], method, send, name}, send, in.get());
+        const uint64_t n = fileSize(r.result.get());
+        if (output == "-") {
+            copyFile(r.result.get(), 1, n);
+        } else {
+            Fd out(::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+            if (out.get() < 0) throw std::runtime_error("Cannot open output file: " + output);
+            copySparse(r.result.get(), out.get(), n);
+            if (::close(out.release()) != 0) throw std::runtime_error(sysError("Cannot close " + output));
+        }
+    }
+    const std::vector<std::string> f = splitFields(r.line);
+    (output == "-" ? std::cerr : std::cout) << (compress ? "Compressed: " : "Decompressed: ") << input << " -> "
+                                            << output << " (" << f[1] << " -> " << f[2] << " bytes, sent as "
+                                            << send << ")\n";
+    return 0;
+}
+
+int runLoadTest(int argc, char** argv) {
+    LoadOptions o = parseLoadOptions(argc, argv);
+    keepModelMemory();
+
+    std::unique_ptr<Server> server;
+    std::thread serving;
+    std::string path = o.socket;
+    if (path.empty()) {
+        path = fs::temp_directory_path().string() + "/paqman-loadtest-" + std::to_string(getpid()) + ".sock";
+        server.reset(new Server(path, o.threads));
+        serving = std::thread([&] { server->run(); });
+    }
+
+    // One input per client, in a sealed memfd so that fd jobs pass it as is
+    std::vector<std::string> inputs;
+    std::vector<Fd> files;
+    for (int c = 0; c < o.clients; ++c) {
+        inputs.push_back(corpus::generate(o.corpusKind, o.size, o.seed + c));
+        files.push_back(newMemfd("paqman-loadtest"));
+        writeAll(files.back().get(), inputs.back().data(), inputs.back().size(), 0, "input");
+        seal(files.back().get());
+    }
+
+    std::vector<std::vector<double>> compLatency(o.clients), decompLatency(o.clients);
+    std::atomic<int> next(0), failed(0);
+    std::atomic<uint64_t> archiveBytes(0);
+    std::mutex print;
+    std::string firstError;
+    const Clock::time_point t0 = Clock::now();
+    parallelFor(size_t(o.clients), o.clients, [&](size_t c) {
+        try {
+            Connection conn(path);
+            while (next++ < o.jobs) {
+                Clock::time_point t = Clock::now();
+                Reply archive = conn.call({"c", o.method, o.send, "loadtest"}, o.send, files[c].get());
+                compLatency[c].push_back(secondsSince(t));
+                archiveBytes += fileSize(archive.result.get());
+                t = Clock::now();
+                Reply back = conn.call({"d", "-", o.send, "-"}, o.send, archive.result.get());
+                decompLatency[c].push_back(secondsSince(t));
+                if (!sameContent(back.result.get(), inputs[c])) throw std::runtime_error("Round trip differs from input");
+            }
+        } catch (const std::exception& e) {
+            ++failed;
+            std::lock_guard<std::mutex> lock(print);
+            if (firstError.empty()) firstError = e.what();
+        }
+    });
+    const double seconds = secondsSince(t0);
+    if (server) {
+        server->stop();
+        serving.join();
+    }
+
+    std::vector<double> comp, decomp;
+    for (int c = 0; c < o.clients; ++c) {
+        comp.insert(comp.end(), compLatency[c].begin(), compLatency[c].end());
+        decomp.insert(decomp.end(), decompLatency[c].begin(), decompLatency[c].end());
+    }
+    std::sort(comp.begin(), comp.end());
+    std::sort(decomp.begin(), decomp.end());
+    const size_t trips = decomp.size();
+    const uint64_t inBytes = uint64_t(comp.size()) * o.size;
+    const double ratio = inBytes ? double(archiveBytes) / inBytes : 0.0;
+    const std::string corpus = std::string(corpus::kindName(o.corpusKind)) + ":seed=" + std::to_string(o.seed);
+    const std::string workers = server ? std::to_string(o.threads) : "external";
+    if (o.json) {
+        std::printf("{\n  \"corpus\": \"%s\",\n  \"job_bytes\": %zu,\n  \"method\": \"%s\",\n  \"send\": \"%s\",\n"
+                    "  \"clients\": %d,\n  \"workers\": \"%s\",\n  \"round_trips\": %zu,\n  \"failed_clients\": %d,\n"
+                    "  \"seconds\": %.6f,\n  \"round_trips_per_second\": %.3f,\n  \"mbps\": %.3f,\n"
+                    "  \"ratio\": %.6f,\n  \"compress_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+                    "\"max\": %.3f},\n  \"decompress_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+                    "\"max\": %.3f}\n}\n",
+                    jsonEscape(corpus).c_str(), o.size, jsonEscape(o.method).c_str(), o.send.c_str(), o.clients,
+                    workers.c_str(), trips, failed.load(), seconds, trips / seconds, inBytes / seconds / 1e6, ratio,
+                    percentile(comp, 50), percentile(comp, 90), percentile(comp, 99), percentile(comp, 100),
+                    percentile(decomp, 50), percentile(decomp, 90), percentile(decomp, 99), percentile(decomp, 100));
+    } else {
+        std::printf("Load test: %zu round trips of %zu bytes (%s, method %s, sent as %s), %d clients, %s workers\n",
+                    trips, o.size, corpus.c_str(), o.method.c_str(), o.send.c_str(), o.clients, workers.c_str());
+        std::printf("%9s %8s %8s %8s %8s %8s %8s %8s %8s\n", "trips/s", "MB/s", "ratio", "c_p50ms", "c_p90ms",
+                    "c_p99ms", "d_p50ms", "d_p90ms", "d_p99ms");
+        std::printf("%9.1f %8.3f %8.4f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n", trips / seconds,
+                    inBytes / seconds / 1e6, ratio, percentile(comp, 50), percentile(comp, 90), percentile(comp, 99),
+                    percentile(decomp, 50), percentile(decomp, 90), percentile(decomp, 99));
+    }
+    if (failed > 0) {
+        std::cerr << "\33[31mError: \33[0m" << failed << " of " << o.clients << " clients failed: " << firstError << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+/**
+ * @file serve.h
+ * @brief Compression daemon for PAQMan (`paqman serve`, `client`, `loadtest`).
+ *
+ * `paqman serve` listens on a Unix socket and runs compress and decompress
+ * jobs on a pool of worker threads that lives as long as the daemon, so a
+ * pipeline that would start a paqman per file pays for the process start
+ * only once. Jobs from all connections share the pool; a connection has
+ * one job at a time.
+ *
+ * A request is one line of tab-separated fields:
+ *
+ *   c <method> path <name> <input> <output>   compress file input to output
+ *   c <method> fd <name>                      compress the file passed along
+ *   c <method> data <name> <length>           compress the length bytes after the line
+ *   d - path - <input> <output>               decompress archive input to file output
+ *   d - fd -                                  decompress the archive passed along
+ *   d - data - <length>                       decompress the length bytes after the line
+ *   q                                         stop the daemon after the running jobs
+ *
+ * The method is 0-5 or 5f; name is stored as the file name, as by
+ * `paqman c`, which writes the same archive for a file. Files are passed
+ * (SCM_RIGHTS) as regular files or memfds, and paths are opened by the
+ * daemon, so they should be absolute. A decompressed result is the data
+ * of all segments in order: the file of a one-file archive.
+ *
+ * The reply is "ok\t<input bytes>\t<output bytes>" or "error\t<message>".
+ * For fd and data jobs a sealed memfd holding the result comes with it,
+ * which the client can map instead of reading it through the socket.
+ */
+
+#ifndef PAQMAN_SERVE_H
+#define PAQMAN_SERVE_H
+
+// Entry point for `paqman serve [--socket <path>] [--threads <n>]`.
+// argv[0] is the first argument after "serve". Returns a process exit code.
+int runServe(int argc, char** argv);
+
+// Entry point for `paqman client [--socket <path>] c|d|stop ...`.
+int runClient(int argc, char** argv);
+
+// Entry point for `paqman loadtest [options]`. Returns 1 if any job failed
+// or any round trip did not give back its input.
+int runLoadTest(int argc, char** argv);
+
+#endif  // PAQMAN_SERVE_H
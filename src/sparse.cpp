@@ -0,0 +1,162 @@
+/**
+ * @file sparse.cpp
+ * @brief Hole-skipping input for PAQMan (sparse files, VM images).
+ *
+ * Data regions are read in 1 MiB pieces that end at 64 KiB file offsets,
+ * so every aligned 64 KiB unit can be checked for zeros as a whole. File
+ * systems without SEEK_DATA report the whole file as one data region.
+ */
+
+#include "sparse.h"
+#include "trace.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sparse {
+
+namespace {
+
+const size_t kUnit = 64 << 10;  // zero runs are skipped in aligned units of this size
+const size_t kBuf = 1 << 20;    // bytes read at once, a multiple of kUnit
+
+bool isZero(const char* p, size_t n) {
+    static const char zeros[kUnit] = {};
+    return std::memcmp(p, zeros, n) == 0;
+}
+
+}  // namespace
+
+Reader::Reader(const std::string& path_) : path(path_), buf(kBuf) {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) throw std::runtime_error("Cannot open input file: " + path);
+    size = st.st_size;
+}
+
+Reader::~Reader() {
+    if (fd >= 0) ::close(fd);
+}
+
+void Reader::skip(uint64_t length) {
+    if (!runs.empty() && runs.back().pos == returned) runs.back().length += length;
+    else runs.push_back({returned, length});
+    skippedBytes += length;
+}
+
+// Buffers the next piece of data, skipping a hole before it. Returns false
+// at the end of the file.
+bool Reader::fill() {
+    if (pos >= size) return false;
+    if (pos >= dataEnd) {
+        dataEnd = size;
+#ifdef SEEK_DATA
+        off_t data = lseek(fd, pos, SEEK_DATA);
+        if (data < 0 && errno == ENXIO) {  // hole to the end
+            skip(size - pos);
+            pos = size;
+            return false;
+        }
+        if (data >= 0) {
+            if (uint64_t(data) > pos) skip(data - pos);
+            pos = data;
+            off_t hole = lseek(fd, pos, SEEK_HOLE);
+            if (hole >= 0) dataEnd = std::min<uint64_t>(hole, size);
+        }
+#endif
+    }
+    trace::Scope stage("read");
+    const size_t len = size_t(std::min<uint64_t>(kBuf - pos % kUnit, dataEnd - pos));
+    ssize_t r;
+    do {
+        r = ::pread(fd, buf.data(), len, pos);
+    } while (r < 0 && errno == EINTR);
+    if (r < 0) throw std::runtime_error("Cannot read " + path + ": " + std::strerror(errno));
+    if (r == 0) {  // truncated while reading
+        size = pos;
+        return false;
+    }
+    bufStart = pos;
+    bufPos = 0;
+    bufLen = r;
+    pos += r;
+    return true;
+}
+
+int Reader::get() {
+    char c;
+    return read(&c, 1) == 1 ? (unsigned char)c : -1;
+}
+
+int Reader::read(char* out, int n) {
+    int got = 0;
+    while (got < n) {
+        if (bufPos == bufLen && !fill()) break;
+        const uint64_t at = bufStart + bufPos;
+        const size_t unit = std::min<size_t>(kUnit - at % kUnit, bufLen - bufPos);
+        if (unit == kUnit && isZero(&buf[bufPos], kUnit)) {
+            skip(kUnit);
+            bufPos += kUnit;
+            continue;
+        }
+        const size_t take = std::min<size_t>(unit, n - got);
+        std::memcpy(out + got, &buf[bufPos], take);
+        got += int(take);
+        bufPos += take;
+        returned += take;
+    }
+    // Report a hole at the end of the file with the data before it
+    if (got > 0 && bufPos == bufLen) fill();
+    return got;
+}
+
+std::vector<Run> Reader::takeRuns() {
+    std::vector<Run> r;
+    r.swap(runs);
+    returned = 0;
+    return r;
+}
+
+std::string formatRuns(const std::vector<Run>& runs) {
+    std::string s;
+    for (const Run& r : runs) {
+        s += s.empty() ? " holes=" : ",";
+        s += std::to_string(r.pos) + "+" + std::to_string(r.length);
+    }
+    return s;
+}
+
+std::vector<Run> parseRuns(const std::string& comment) {
+    std::vector<Run> runs;
+    std::istringstream words(comment);
+    std::string w;
+    while (words >> w) {
+        if (w.compare(0, 6, "holes=") != 0) continue;
+        std::istringstream list(w.substr(6));
+        std::string item;
+        while (std::getline(list, item, ',')) {
+            const size_t plus = item.find('+');
+            if (plus == std::string::npos) throw std::runtime_error("Invalid hole list in comment: " + comment);
+            runs.push_back({std::stoull(item.substr(0, plus)), std::stoull(item.substr(plus + 1))});
+        }
+    }
+    // Runs lie in order within the segment's data, whose size starts a
+    // stored comment; a list that does not was not written for this segment
+    if (!comment.empty() && std::isdigit(static_cast<unsigned char>(comment[0]))) {
+        uint64_t last = 0;
+        const uint64_t size = std::stoull(comment);
+        for (const Run& r : runs) {
+            if (r.pos < last || r.pos > size) throw std::runtime_error("Invalid hole list in comment: " + comment);
+            last = r.pos;
+        }
+    }
+    return runs;
+}
+
+}  // namespace sparse
@@ -0,0 +1,71 @@
+/**
+ * @file sparse.h
+ * @brief Hole-skipping input for PAQMan (sparse files, VM images).
+ *
+ * sparse::Reader returns only the data of a file. It skips the holes that
+ * SEEK_DATA/SEEK_HOLE report, and also aligned 64 KiB runs of zero bytes
+ * in the data, so the models never see them. The skipped runs are
+ * recorded in the segment comment after the size, as
+ * "<size> holes=<pos>+<length>,...", where pos counts the segment's data
+ * bytes before the run. Extraction (extract::Sink::holes()) puts them back
+ * as holes.
+ */
+
+#ifndef PAQMAN_SPARSE_H
+#define PAQMAN_SPARSE_H
+
+#include "libzpaq.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace sparse {
+
+// length zero bytes after pos data bytes.
+struct Run {
+    uint64_t pos;
+    uint64_t length;
+};
+
+class Reader : public libzpaq::Reader {
+public:
+    explicit Reader(const std::string& path);  // throws if it cannot be opened
+    ~Reader() override;
+    int get() override;
+    int read(char* buf, int n) override;
+
+    // Runs skipped since the last call, with pos relative to the data
+    // returned since then. A run at the end of the file is reported by the
+    // read() that reaches it.
+    std::vector<Run> takeRuns();
+
+    uint64_t skipped() const { return skippedBytes; }
+
+private:
+    int fd = -1;
+    std::string path;
+    uint64_t size = 0;
+    uint64_t pos = 0;       // file offset of the next byte to buffer
+    uint64_t dataEnd = 0;   // end of the data region containing pos
+    std::vector<char> buf;  // file bytes [bufStart, bufStart + bufLen)
+    uint64_t bufStart = 0;
+    size_t bufPos = 0, bufLen = 0;
+    uint64_t returned = 0;  // data bytes returned since takeRuns()
+    uint64_t skippedBytes = 0;
+    std::vector<Run> runs;
+
+    void skip(uint64_t length);
+    bool fill();
+};
+
+// Appends " holes=..." for runs to a segment comment, if there are any.
+std::string formatRuns(const std::vector<Run>& runs);
+
+// Parses the runs of a segment comment. Returns an empty list if none.
+// Throws if the list is malformed, or if the comment starts with the
+// segment's size and the runs are out of order or past its data.
+std::vector<Run> parseRuns(const std::string& comment);
+
+}  // namespace sparse
+
+#endif  // PAQMAN_SPARSE_H
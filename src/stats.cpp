@@ -0,0 +1,224 @@
+/**
+ * @file stats.cpp
+ * @brief Model telemetry report for PAQMan (`paqman stats`).
+ *
+ * Statistics are collected while decoding, because the decoder replays
+ * exactly the model the encoder used. Plain files are compressed in memory
+ * with the requested method first. Costs are per coded byte, i.e. after
+ * any LZ77 or BWT preprocessing of the block.
+ */
+
+#include "stats.h"
+#include "benchutil.h"
+#include "corpus.h"
+#include "libzpaq.h"
+#include "seekable.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace benchutil;
+
+namespace {
+
+const char* const kTypes[] = {"none", "const", "cm", "icm", "match", "avg", "mix2", "mix", "isse", "sse"};
+const char* const kLengths[] = {"0", "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64-127", "128-255"};
+
+// Discards decoded data, counting it.
+class CountWriter : public libzpaq::Writer {
+public:
+    uint64_t n = 0;
+    void put(int) override { ++n; }
+    void write(const char*, int len) override { n += len; }
+};
+
+// --- Options ---
+
+struct StatsOptions {
+    std::string method = "5";
+    size_t size = 4u << 20;
+    corpus::Kind corpusKind = corpus::MIXED;
+    uint64_t seed = 1;
+    bool json = false;
+    std::string file;
+};
+
+StatsOptions parseOptions(int argc, char** argv) {
+    StatsOptions o;
+    for (int i = 0; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--method") {
+            o.method = optionValue(argc, argv, i);
+        } else if (a == "--size") {
+            o.size = size_t(parseInt(optionValue(argc, argv, i), 1, 4096, "size")) << 20;
+        } else if (a == "--corpus") {
+            std::string kind = optionValue(argc, argv, i);
+            if (!corpus::parseKind(kind, o.corpusKind)) {
+                throw std::runtime_error("Unknown corpus '" + kind + "', use one of " + corpus::kindList());
+            }
+        } else if (a == "--seed") {
+            o.seed = parseInt(optionValue(argc, argv, i), 0, 0x7fffffff, "seed");
+        } else if (a == "--json") {
+            o.json = true;
+        } else if (a.size() > 1 && a[0] == '-') {
+            throw std::runtime_error("Unknown stats option: " + a);
+        } else if (o.file.empty()) {
+            o.file = a;
+        } else {
+            throw std::runtime_error("stats takes at most one input file");
+        }
+    }
+    return o;
+}
+
+// True if data starts with a ZPAQ block (with or without locator tag).
+bool isArchive(const std::string& data) {
+    return data.compare(0, 4, "7kSt") == 0 || data.compare(0, 3, "zPQ") == 0;
+}
+
+// --- Report ---
+
+struct BlockStats {
+    uint64_t bytes = 0;  // decoded bytes
+    std::vector<libzpaq::ComponentStats> comps;
+};
+
+double percent(uint64_t n, uint64_t total) {
+    return total ? 100.0 * n / total : 0.0;
+}
+
+void printBlock(int index, const BlockStats& b) {
+    if (b.comps.empty()) {
+        std::printf("Block %d: %llu bytes, not modeled (stored)\n\n", index, (unsigned long long)b.bytes);
+        return;
+    }
+    const libzpaq::ComponentStats& out = b.comps.back();
+    const double bytes = out.bits / 8.0;
+    std::printf("Block %d: %llu bytes, %.0f coded bytes, %zu components, %.4f bpc\n", index,
+                (unsigned long long)b.bytes, bytes, b.comps.size(), bytes ? out.cost / bytes : 0.0);
+    std::printf("  %3s %-6s %8s %8s %7s %7s %7s %7s\n", "#", "type", "bpc", "saved", "weight", "hit%",
+                "miss%", "repl%");
+    for (size_t i = 0; i < b.comps.size(); ++i) {
+        const libzpaq::ComponentStats& s = b.comps[i];
+        std::printf("  %3zu %-6s %8.4f", i, kTypes[s.type < 10 ? s.type : 0], bytes ? s.cost / bytes : 0.0);
+        if (s.mixed) {
+            std::printf(" %8.4f %7.3f", s.saved / bytes, s.weight / s.mixed);
+        } else {
+            std::printf(" %8s %7s", "-", "-");
+        }
+        const uint64_t finds = s.hits + s.misses + s.replaced;
+        if (finds) {
+            std::printf(" %7.2f %7.2f %7.2f", percent(s.hits, finds), percent(s.misses, finds),
+                        percent(s.replaced, finds));
+        }
+        std::printf("\n");
+        if (s.type == 4) {  // MATCH
+            const uint64_t predicted = s.bits - s.len[0];
+            std::printf("      match: %.1f%% of bits predicted, %.2f%% correct; length:", percent(predicted, s.bits),
+                        percent(s.right, predicted));
+            for (int k = 1; k < 9; ++k) std::printf(" %s=%.1f%%", kLengths[k], percent(s.len[k], s.bits));
+            std::printf("\n");
+        }
+    }
+    std::printf("\n");
+}
+
+void printJson(const std::string& name, const std::string& method, const std::vector<BlockStats>& blocks) {
+    std::printf("{\n  \"input\": \"%s\",\n  \"method\": \"%s\",\n  \"blocks\": [", jsonEscape(name).c_str(),
+                jsonEscape(method).c_str());
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        std::printf("%s\n    {\"bytes\": %llu, \"components\": [", b ? "," : "",
+                    (unsigned long long)blocks[b].bytes);
+        const std::vector<libzpaq::ComponentStats>& comps = blocks[b].comps;
+        for (size_t i = 0; i < comps.size(); ++i) {
+            const libzpaq::ComponentStats& s = comps[i];
+            std::printf("%s\n      {\"type\": \"%s\", \"bits\": %llu, \"cost\": %.1f, \"saved\": %.1f, "
+                        "\"weight\": %.1f, \"mixed\": %llu, \"hits\": %llu, \"misses\": %llu, \"replaced\": %llu, "
+                        "\"right\": %llu, \"length\": [",
+                        i ? "," : "", kTypes[s.type < 10 ? s.type : 0], (unsigned long long)s.bits, s.cost,
+                        s.saved, s.weight, (unsigned long long)s.mixed, (unsigned long long)s.hits,
+                        (unsigned long long)s.misses, (unsigned long long)s.replaced,
+                        (unsigned long long)s.right);
+            for (int k = 0; k < 9; ++k) std::printf("%s%llu", k ? ", " : "", (unsigned long long)s.len[k]);
+            std::printf("]}");
+        }
+        std::printf("%s]}", comps.empty() ? "" : "\n    ");
+    }
+    std::printf("\n  ]\n}\n");
+}
+
+}  // namespace
+
+// --- Entry Point ---
+
+int runStats(int argc, char** argv) {
+    StatsOptions o = parseOptions(argc, argv);
+
+    std::string data, name = o.file;
+    if (o.file.empty()) {
+        data = corpus::generate(o.corpusKind, o.size, o.seed);
+        name = std::string(corpus::kindName(o.corpusKind)) + ":seed=" + std::to_string(o.seed);
+    } else {
+        std::ifstream in(o.file, std::ios::binary);
+        if (!in.is_open()) throw std::runtime_error("Cannot open input file: " + o.file);
+        std::ostringstream ss;
+        ss << in.rdbuf();
+        data = ss.str();
+    }
+    if (data.empty()) throw std::runtime_error("Input is empty");
+
+    // Compress plain input in blocks as compressFile() does
+    libzpaq::StringBuffer archive;
+    const bool packed = isArchive(data);
+    if (packed) {
+        o.method = "archive";
+        archive.write(data.data(), int(data.size()));
+    } else {
+        const size_t bs = (0x100000 << 4) - 4096;
+        for (size_t off = 0; off < data.size(); off += bs) {
+            const size_t len = std::min(bs, data.size() - off);
+            libzpaq::StringBuffer in(len);
+            in.write(data.data() + off, int(len));
+            libzpaq::compressBlock(&in, &archive, o.method.c_str());
+        }
+    }
+    std::string().swap(data);
+
+    libzpaq::Decompresser d;
+    d.setInput(&archive);
+    d.enableStats();
+    seekable::Primer primer;
+    std::vector<BlockStats> blocks;
+    while (d.findBlock()) {
+        BlockStats b;
+        CountWriter out;
+        libzpaq::StringBuffer name, comment;
+        while (d.findFilename(&name)) {
+            d.readComment(&comment);
+            d.setOutput(primer.segment(d, name.size() > 0, std::string(comment.c_str(), comment.size()), &out));
+            name.resize(0);
+            comment.resize(0);
+            d.decompress();
+            d.readSegmentEnd();
+        }
+        b.bytes = out.n;
+        for (int i = 0; d.stat(i); ++i) b.comps.push_back(*d.stat(i));
+        blocks.push_back(b);
+    }
+    if (blocks.empty()) throw std::runtime_error("No ZPAQ block found in " + name);
+
+    if (o.json) {
+        printJson(name, o.method, blocks);
+    } else {
+        std::printf("Model statistics for %s (method %s)\n", name.c_str(), o.method.c_str());
+        std::printf("bpc: cost per coded byte using this component's prediction alone\n"
+                    "saved: bpc lost if the consuming mixer dropped this input; weight: mean |mixer weight|\n\n");
+        for (size_t i = 0; i < blocks.size(); ++i) printBlock(int(i), blocks[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+/**
+ * @file stats.h
+ * @brief Model telemetry report for PAQMan (`paqman stats`).
+ *
+ * Decodes an archive (or compresses a file or synthetic corpus in memory
+ * first) with libzpaq::Decompresser::enableStats() and reports, for every
+ * component of every block, its coding cost, the bits it saves in the
+ * mixer that consumes it, its mean mixer weight, ICM/ISSE hash table
+ * hit/miss/replacement rates and the MATCH length distribution. These
+ * show which components are dead weight and which tables are undersized.
+ */
+
+#ifndef PAQMAN_STATS_H
+#define PAQMAN_STATS_H
+
+// Entry point for `paqman stats [options] [file]`.
+// argv[0] is the first argument after "stats". Returns a process exit code.
+int runStats(int argc, char** argv);
+
+#endif  // PAQMAN_STATS_H
@@ -0,0 +1,381 @@
+/**
+ * @file tarstream.cpp
+ * @brief Tar and pax streams for PAQMan (`paqman c --tar`, `d --tar`).
+ */
+
+#include "tarstream.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace tarstream {
+
+namespace {
+
+const size_t kRecord = 512;
+
+// Field offsets and lengths of a ustar header.
+enum {
+    NAME = 0, MODE = 100, UID = 108, GID = 116, SIZE = 124, MTIME = 136, CHKSUM = 148, TYPE = 156,
+    LINK = 157, MAGIC = 257, VERSION = 263, UNAME = 265, GNAME = 297, DEVMAJOR = 329, DEVMINOR = 337, PREFIX = 345
+};
+
+std::string field(const char* h, int at, int len) {
+    const char* end = static_cast<const char*>(std::memchr(h + at, 0, len));
+    return std::string(h + at, end ? end : h + at + len);
+}
+
+// Octal, or GNU base-256 if the first byte has its high bit set.
+uint64_t number(const char* h, int at, int len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(h + at);
+    uint64_t v = 0;
+    if (p[0] & 0x80) {
+        if (p[0] & 0x40) throw std::runtime_error("Negative number in tar header");
+        v = p[0] & 0x3f;
+        for (int i = 1; i < len; ++i) v = v << 8 | p[i];
+        return v;
+    }
+    int i = 0;
+    while (i < len && p[i] == ' ') ++i;
+    for (; i < len && p[i] >= '0' && p[i] <= '7'; ++i) v = v << 3 | (p[i] - '0');
+    return v;
+}
+
+bool zero(const char* h) {
+    for (size_t i = 0; i < kRecord; ++i) {
+        if (h[i]) return false;
+    }
+    return true;
+}
+
+void checksum(const char* h) {
+    uint64_t u = 0;
+    int64_t s = 0;
+    for (size_t i = 0; i < kRecord; ++i) {
+        const char c = i >= CHKSUM && i < CHKSUM + 8 ? ' ' : h[i];
+        u += static_cast<unsigned char>(c);
+        s += static_cast<signed char>(c);
+    }
+    const uint64_t want = number(h, CHKSUM, 8);
+    if (want != u && int64_t(want) != s) throw std::runtime_error("Bad tar header checksum");
+}
+
+// Removes leading "./" and trailing "/". Throws for an absolute name or one
+// with a ".." component, which would be extracted outside the target
+// directory.
+std::string relative(std::string name) {
+    while (name.compare(0, 2, "./") == 0) name.erase(0, 2);
+    while (name.size() > 1 && name.back() == '/') name.pop_back();
+    if (name.empty() || name == ".") return std::string();
+    if (!meta::isBelow(name)) throw std::runtime_error("Unsafe tar member name: " + name);
+    return name;
+}
+
+// Reads "sec[.frac]" of a pax time.
+void paxTime(const std::string& v, meta::Record& r) {
+    const size_t dot = v.find('.');
+    r.mtime = std::stoll(v.substr(0, dot));
+    r.mtimeNsec = 0;
+    if (dot != std::string::npos) {
+        std::string frac = v.substr(dot + 1, 9);
+        frac.resize(9, '0');
+        r.mtimeNsec = uint32_t(std::stoul(frac));
+        if (v[0] == '-' && r.mtimeNsec > 0) --r.mtime, r.mtimeNsec = 1000000000 - r.mtimeNsec;
+    }
+}
+
+void octal(char* h, int at, int len, uint64_t v) {
+    std::memset(h + at, '0', len - 1);
+    for (int i = len - 2; i >= 0 && v > 0; --i, v >>= 3) h[at + i] = char('0' + (v & 7));
+    h[at + len - 1] = 0;
+}
+
+bool fits(uint64_t v, int len) {
+    return v < uint64_t(1) << (3 * (len - 1));
+}
+
+void paxRecord(std::string& out, const std::string& key, const std::string& value) {
+    const size_t body = key.size() + value.size() + 3;  // " ", "=", "\n"
+    size_t n = body + 1;
+    while (std::to_string(n).size() + body != n) ++n;
+    out += std::to_string(n) + " " + key + "=" + value + "\n";
+}
+
+}  // namespace
+
+Reader::Reader(int fd) : fd(fd), buf(1 << 20) {}
+
+size_t Reader::fill(char* out, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        if (pos == len) {
+            ssize_t r;
+            do r = ::read(fd, buf.data(), buf.size());
+            while (r < 0 && errno == EINTR);
+            if (r < 0) throw std::runtime_error(std::string("Cannot read tar stream: ") + std::strerror(errno));
+            if (r == 0) break;
+            pos = 0;
+            len = size_t(r);
+        }
+        const size_t take = std::min(n - got, len - pos);
+        std::memcpy(out + got, buf.data() + pos, take);
+        pos += take;
+        got += take;
+    }
+    consumed += got;
+    return got;
+}
+
+void Reader::readFully(char* out, size_t n) {
+    if (fill(out, n) != n) throw std::runtime_error("Tar stream ends inside a member");
+}
+
+void Reader::skip(uint64_t n) {
+    char tmp[1 << 14];
+    while (n > 0) {
+        const size_t k = size_t(std::min<uint64_t>(n, sizeof(tmp)));
+        readFully(tmp, k);
+        n -= k;
+    }
+}
+
+std::string Reader::readData(uint64_t n) {
+    if (n > (64 << 20)) throw std::runtime_error("Tar extended header too large");
+    std::string s(size_t(n), '\0');
+    readFully(&s[0], s.size());
+    skip((kRecord - n % kRecord) % kRecord);
+    return s;
+}
+
+bool Reader::next(Member& m) {
+    skip(left + padding);
+    left = padding = 0;
+    std::string longName, longLink;
+    bool hasName = false, hasLink = false, hasUser = false, hasGroup = false;
+    meta::Record pax;
+    bool paxSize = false, paxUid = false, paxGid = false, paxMtime = false;
+    uint64_t size = 0;
+    for (;;) {
+        char h[kRecord];
+        const size_t got = fill(h, kRecord);
+        if (got == 0) return false;  // no end records
+        if (got != kRecord) throw std::runtime_error("Tar stream ends inside a header");
+        if (zero(h)) return false;
+        checksum(h);
+        const char type = h[TYPE];
+        const uint64_t n = number(h, SIZE, 12);
+        if (type == 'x' || type == 'g') {
+            const std::string data = readData(n);
+            if (type == 'g') continue;
+            for (size_t at = 0; at < data.size();) {
+                const size_t space = data.find(' ', at);
+                const size_t len = space == std::string::npos ? 0 : std::stoul(data.substr(at, space - at));
+                if (len == 0 || at + len > data.size()) throw std::runtime_error("Damaged pax header");
+                const std::string rec = data.substr(space + 1, at + len - space - 2);
+                at += len;
+                const size_t eq = rec.find('=');
+                if (eq == std::string::npos) throw std::runtime_error("Damaged pax header");
+                const std::string key = rec.substr(0, eq), value = rec.substr(eq + 1);
+                if (key == "path") {
+                    longName = value, hasName = true;
+                } else if (key == "linkpath") {
+                    longLink = value, hasLink = true;
+                } else if (key == "size") {
+                    size = std::stoull(value), paxSize = true;
+                } else if (key == "uid") {
+                    pax.uid = std::stoull(value), paxUid = true;
+                } else if (key == "gid") {
+                    pax.gid = std::stoull(value), paxGid = true;
+                } else if (key == "uname") {
+                    pax.user = value, hasUser = true;
+                } else if (key == "gname") {
+                    pax.group = value, hasGroup = true;
+                } else if (key == "mtime") {
+                    paxTime(value, pax), paxMtime = true;
+                } else if (key.compare(0, 11, "GNU.sparse.") == 0) {
+                    throw std::runtime_error("Sparse tar members are not supported");
+                }
+            }
+            continue;
+        }
+        if (type == 'L' || type == 'K') {
+            std::string data = readData(n);
+            data.resize(std::strlen(data.c_str()));
+            (type == 'L' ? longName : longLink) = data;
+            (type == 'L' ? hasName : hasLink) = true;
+            continue;
+        }
+        if (type == 'S') throw std::runtime_error("Sparse tar members are not supported");
+
+        std::string name = field(h, NAME, 100);
+        if (std::memcmp(h + MAGIC, "ustar", 6) == 0) {
+            const std::string prefix = field(h, PREFIX, 155);
+            if (!prefix.empty()) name = prefix + "/" + name;
+        }
+        if (hasName) name = longName;
+        m = Member();
+        m.meta.mode = uint32_t(number(h, MODE, 8) & 07777);
+        m.meta.uid = paxUid ? pax.uid : number(h, UID, 8);
+        m.meta.gid = paxGid ? pax.gid : number(h, GID, 8);
+        if (paxMtime) {
+            m.meta.mtime = pax.mtime, m.meta.mtimeNsec = pax.mtimeNsec;
+        } else {
+            m.meta.mtime = int64_t(number(h, MTIME, 12));
+        }
+        m.meta.link = hasLink ? longLink : field(h, LINK, 100);
+        m.meta.user = hasUser ? pax.user : field(h, UNAME, 32);
+        m.meta.group = hasGroup ? pax.group : field(h, GNAME, 32);
+        const uint64_t bytes = paxSize ? size : n;
+        switch (type) {
+        case '0': case '\0': case '7':
+            m.meta.type = !name.empty() && name.back() == '/' ? meta::DIR : meta::FILE;
+            break;
+        case '1':
+            m.meta.type = meta::HARDLINK;
+            m.meta.link = relative(m.meta.link);
+            if (m.meta.link.empty()) throw std::runtime_error("Tar hard link without a target: " + name);
+            break;
+        case '2': m.meta.type = meta::SYMLINK; break;
+        case '3': m.meta.type = meta::CHAR; break;
+        case '4': m.meta.type = meta::BLOCK; break;
+        case '5': m.meta.type = meta::DIR; break;
+        case '6': m.meta.type = meta::FIFO; break;
+        default:  // volume labels and other extensions
+            skip(bytes + (kRecord - bytes % kRecord) % kRecord);
+            hasName = hasLink = hasUser = hasGroup = paxSize = paxUid = paxGid = paxMtime = false;
+            continue;
+        }
+        if (m.meta.type == meta::CHAR || m.meta.type == meta::BLOCK) {
+            m.meta.major = uint32_t(number(h, DEVMAJOR, 8));
+            m.meta.minor = uint32_t(number(h, DEVMINOR, 8));
+        }
+        if (m.meta.type != meta::SYMLINK && m.meta.type != meta::HARDLINK) m.meta.link.clear();
+        m.name = relative(name);
+        m.size = m.meta.type == meta::FILE ? bytes : 0;
+        left = bytes;
+        padding = (kRecord - bytes % kRecord) % kRecord;
+        if (m.meta.type != meta::FILE) skip(left), left = 0;
+        return true;
+    }
+}
+
+size_t Reader::read(char* out, size_t n) {
+    n = size_t(std::min<uint64_t>(n, left));
+    if (n == 0) return 0;
+    readFully(out, n);
+    left -= n;
+    return n;
+}
+
+Writer::Writer(int fd) : fd(fd) {}
+
+void Writer::put(const char* p, size_t n) {
+    buf.append(p, n);
+    written += n;
+    if (buf.size() >= (1 << 20)) flush();
+}
+
+void Writer::flush() {
+    for (size_t at = 0; at < buf.size();) {
+        const ssize_t r = ::write(fd, buf.data() + at, buf.size() - at);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) throw std::runtime_error(std::string("Cannot write tar stream: ") + std::strerror(errno));
+        at += size_t(r);
+    }
+    buf.clear();
+}
+
+void Writer::begin(const Member& m) {
+    if (left > 0) throw std::runtime_error("Tar member " + m.name + " started before the last one ended");
+    const meta::Record& r = m.meta;
+    std::string name = m.name + (r.type == meta::DIR ? "/" : "");
+    std::string prefix, pax;
+    if (name.size() > 100) {
+        const size_t slash = name.rfind('/', std::min<size_t>(name.size() - 1, 155));
+        if (slash != std::string::npos && slash > 0 && name.size() - slash - 1 <= 100 && name.size() - slash > 1) {
+            prefix = name.substr(0, slash);
+            name = name.substr(slash + 1);
+        } else {
+            paxRecord(pax, "path", name);
+            name = name.substr(0, 100);
+        }
+    }
+    if (r.link.size() > 100) paxRecord(pax, "linkpath", r.link);
+    const uint64_t size = r.type == meta::FILE ? m.size : 0;
+    if (!fits(size, 12)) paxRecord(pax, "size", std::to_string(size));
+    if (!fits(r.uid, 8)) paxRecord(pax, "uid", std::to_string(r.uid));
+    if (!fits(r.gid, 8)) paxRecord(pax, "gid", std::to_string(r.gid));
+    if (r.user.size() > 31) paxRecord(pax, "uname", r.user);
+    if (r.group.size() > 31) paxRecord(pax, "gname", r.group);
+    if (r.mtimeNsec != 0 || r.mtime < 0 || !fits(uint64_t(r.mtime), 12)) {
+        // pax times are signed decimals, so -6 s + 0.7 s is written -5.3
+        const bool negative = r.mtime < 0 && r.mtimeNsec > 0;
+        const uint32_t nsec = negative ? 1000000000u - r.mtimeNsec : r.mtimeNsec;
+        std::string ns = std::to_string(nsec + 1000000000u).substr(1);
+        while (ns.size() > 1 && ns.back() == '0') ns.pop_back();
+        const std::string secs = negative ? "-" + std::to_string(-(r.mtime + 1)) : std::to_string(r.mtime);
+        paxRecord(pax, "mtime", secs + "." + ns);
+    }
+
+    auto header = [&](const std::string& n, char type, uint64_t bytes, const std::string& pre) {
+        char h[kRecord] = {};
+        std::memcpy(h + NAME, n.data(), std::min<size_t>(n.size(), 100));
+        octal(h, MODE, 8, r.mode & 07777);
+        octal(h, UID, 8, fits(r.uid, 8) ? r.uid : 0);
+        octal(h, GID, 8, fits(r.gid, 8) ? r.gid : 0);
+        octal(h, SIZE, 12, fits(bytes, 12) ? bytes : 0);
+        octal(h, MTIME, 12, r.mtime >= 0 && fits(uint64_t(r.mtime), 12) ? uint64_t(r.mtime) : 0);
+        h[TYPE] = type;
+        if (type != 'x') std::memcpy(h + LINK, r.link.data(), std::min<size_t>(r.link.size(), 100));
+        std::memcpy(h + MAGIC, "ustar", 6);
+        std::memcpy(h + VERSION, "00", 2);
+        std::memcpy(h + UNAME, r.user.data(), std::min<size_t>(r.user.size(), 31));
+        std::memcpy(h + GNAME, r.group.data(), std::min<size_t>(r.group.size(), 31));
+        octal(h, DEVMAJOR, 8, r.major);
+        octal(h, DEVMINOR, 8, r.minor);
+        std::memcpy(h + PREFIX, pre.data(), std::min<size_t>(pre.size(), 155));
+        std::memset(h + CHKSUM, ' ', 8);
+        uint64_t sum = 0;
+        for (size_t i = 0; i < kRecord; ++i) sum += static_cast<unsigned char>(h[i]);
+        octal(h, CHKSUM, 7, sum);
+        put(h, kRecord);
+    };
+    if (!pax.empty()) {
+        const size_t slash = m.name.rfind('/');
+        header("PaxHeaders/" + m.name.substr(slash == std::string::npos ? 0 : slash + 1), 'x', pax.size(), "");
+        put(pax.data(), pax.size());
+        const char zeros[kRecord] = {};
+        put(zeros, (kRecord - pax.size() % kRecord) % kRecord);
+    }
+    static const char types[] = {meta::FILE, '0', meta::DIR, '5', meta::SYMLINK, '2', meta::HARDLINK, '1',
+                                 meta::CHAR, '3', meta::BLOCK, '4', meta::FIFO, '6'};
+    char type = '0';
+    for (size_t i = 0; i < sizeof(types); i += 2) {
+        if (types[i] == r.type) type = types[i + 1];
+    }
+    header(name, type, size, prefix);
+    left = this->size = size;
+}
+
+void Writer::write(const char* p, size_t n) {
+    if (n > left) throw std::runtime_error("Tar member longer than its size");
+    put(p, n);
+    left -= n;
+}
+
+void Writer::end() {
+    if (left > 0) throw std::runtime_error("Tar member shorter than its size");
+    const char zeros[kRecord] = {};
+    put(zeros, (kRecord - size % kRecord) % kRecord);
+    size = 0;
+}
+
+void Writer::finish() {
+    const char zeros[2 * kRecord] = {};
+    put(zeros, sizeof(zeros));
+    flush();
+}
+
+}  // namespace tarstream
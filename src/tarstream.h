@@ -0,0 +1,88 @@
+/**
+ * @file tarstream.h
+ * @brief Tar and pax streams for PAQMan (`paqman c --tar`, `d --tar`).
+ *
+ * Reader parses a tar stream from a file descriptor as it arrives, so a
+ * pipe works: POSIX ustar headers, pax extended headers ('x', for long
+ * names, link targets, sizes, ids and subsecond times) and GNU long name
+ * and long link headers ('L', 'K'). Global pax headers ('g') are skipped.
+ * Numbers may be octal or GNU base-256. GNU sparse members are refused.
+ *
+ * Writer emits ustar headers, with a pax header before a member whose
+ * name, link, size, ids or time do not fit them.
+ *
+ * Member names lose a leading "./" and a directory's trailing "/". A
+ * member whose name or hard link target is absolute or has a ".."
+ * component is refused, as it would be extracted outside the target
+ * directory.
+ */
+
+#ifndef PAQMAN_TARSTREAM_H
+#define PAQMAN_TARSTREAM_H
+
+#include "meta.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tarstream {
+
+struct Member {
+    std::string name;
+    meta::Record meta;
+    uint64_t size = 0;  // data bytes, 0 unless a regular file
+};
+
+class Reader {
+public:
+    explicit Reader(int fd);  // does not take ownership
+
+    // Reads the header of the next member, skipping the rest of the
+    // current one. Returns false at the end of the archive. Throws on a
+    // damaged header, an unsafe name or a stream that ends inside a member.
+    bool next(Member& m);
+
+    // Up to n data bytes of the current member; 0 at its end.
+    size_t read(char* buf, size_t n);
+
+    uint64_t bytes() const { return consumed; }  // of the stream so far
+
+private:
+    int fd;
+    std::vector<char> buf;
+    size_t pos = 0, len = 0;
+    uint64_t consumed = 0;
+    uint64_t left = 0, padding = 0;  // of the current member
+
+    size_t fill(char* out, size_t n);  // up to n bytes, 0 at the end of the stream
+    void readFully(char* out, size_t n);
+    void skip(uint64_t n);
+    std::string readData(uint64_t n);  // of an extended header
+};
+
+class Writer {
+public:
+    explicit Writer(int fd);  // does not take ownership
+
+    // Starts a member; for a regular file, m.size data bytes must follow.
+    void begin(const Member& m);
+    void write(const char* p, size_t n);
+    void end();     // throws if the member got fewer or more bytes than its size
+    void finish();  // writes the end of the archive and flushes
+
+    uint64_t bytes() const { return written; }
+
+private:
+    int fd;
+    std::string buf;
+    uint64_t written = 0;
+    uint64_t left = 0, size = 0;
+
+    void put(const char* p, size_t n);
+    void flush();
+};
+
+}  // namespace tarstream
+
+#endif  // PAQMAN_TARSTREAM_H
@@ -0,0 +1,261 @@
+/**
+ * @file trace.cpp
+ * @brief Per-stage timing for PAQMan with Chrome trace export.
+ *
+ * Each thread appends to its own event log, so recording takes no lock
+ * after a thread's first event. Logs are kept until exit and are only read
+ * by writeChromeTrace() and printSummary() once the worker threads have
+ * been joined.
+ */
+
+#include "trace.h"
+#include "libzpaq.h"
+#include "perfctr.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Event {
+    const char* name;
+    int64_t start;  // ns since enable()
+    int64_t dur;    // ns
+    int64_t self;   // ns, dur minus nested stages
+    int block;
+    perfctr::Counts counts;  // self counts, if counters are enabled
+};
+
+struct OpenStage {
+    const char* name;
+    int64_t start;
+    int64_t child;  // ns spent in nested stages
+    perfctr::Counts counts;  // counters at begin
+    perfctr::Counts childCounts;  // counted in nested stages
+};
+
+struct ThreadLog {
+    int tid = 0;
+    int block = -1;
+    std::vector<OpenStage> stack;
+    std::vector<Event> events;
+};
+
+std::atomic<bool> active(false);
+bool counters = false;  // read perfctr at stage boundaries
+Clock::time_point epoch;
+std::mutex logsMutex;
+std::vector<std::unique_ptr<ThreadLog>> logs;  // every thread that recorded
+
+int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+}
+
+ThreadLog& localLog() {
+    thread_local ThreadLog* log = nullptr;
+    if (!log) {
+        std::lock_guard<std::mutex> lock(logsMutex);
+        logs.emplace_back(new ThreadLog);
+        log = logs.back().get();
+        log->tid = int(logs.size());
+    }
+    return *log;
+}
+
+// Forwards libzpaq stages to the trace
+class ZpaqProfiler : public libzpaq::Profiler {
+public:
+    void begin(const char* stage) override { trace::begin(stage); }
+    void end(const char* stage) override { trace::end(stage); }
+} zpaqProfiler;
+
+// Self time in ns by stage name
+typedef std::map<std::string, int64_t> StageTotals;
+
+void printTotals(std::ostream& out, const std::string& label, const StageTotals& totals) {
+    char buf[64];
+    out << label << ":";
+    for (const auto& t : totals) {
+        std::snprintf(buf, sizeof(buf), " %s=%.1f", t.first.c_str(), t.second / 1e6);
+        out << buf;
+    }
+    out << " (ms)\n";
+}
+
+void addCounts(perfctr::Counts& to, const perfctr::Counts& c) {
+    for (int i = 0; i < perfctr::NCOUNTERS; ++i) to.v[i] += c.v[i];
+}
+
+// One row of the counter table: values, IPC and misses per 1000 instructions
+void printCounts(std::ostream& out, const std::string& block, const std::string& stage, const perfctr::Counts& c) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "  %-6s %-12s", block.c_str(), stage.c_str());
+    out << buf;
+    for (int i = 0; i < perfctr::NCOUNTERS; ++i) {
+        if (perfctr::available(i)) std::snprintf(buf, sizeof(buf), " %14llu", (unsigned long long)c.v[i]);
+        else std::snprintf(buf, sizeof(buf), " %14s", "n/a");
+        out << buf;
+    }
+    const uint64_t cycles = c.v[perfctr::CYCLES], instructions = c.v[perfctr::INSTRUCTIONS];
+    if (perfctr::available(perfctr::CYCLES) && perfctr::available(perfctr::INSTRUCTIONS) && cycles) {
+        std::snprintf(buf, sizeof(buf), " %6.2f", double(instructions) / cycles);
+        out << buf;
+    }
+    out << "\n";
+}
+
+}  // namespace
+
+// --- Recording ---
+
+void enable() {
+    if (active) return;
+    epoch = Clock::now();
+    libzpaq::setProfiler(&zpaqProfiler);
+    active = true;
+}
+
+bool enableCounters(std::string& why) {
+    if (!perfctr::probe(why)) return false;
+    counters = true;
+    enable();
+    return true;
+}
+
+bool enabled() {
+    return active;
+}
+
+void setBlock(int block) {
+    if (active) localLog().block = block;
+}
+
+void begin(const char* stage) {
+    ThreadLog& log = localLog();
+    log.stack.push_back(OpenStage());
+    OpenStage& open = log.stack.back();
+    open.name = stage;
+    open.child = 0;
+    std::memset(&open.childCounts, 0, sizeof(open.childCounts));
+    open.start = now();
+    if (counters) perfctr::read(open.counts);
+}
+
+void end(const char* stage) {
+    perfctr::Counts at;
+    if (counters) perfctr::read(at);
+    ThreadLog& log = localLog();
+    if (log.stack.empty()) return;
+    const OpenStage open = log.stack.back();
+    log.stack.pop_back();
+    const int64_t dur = now() - open.start;
+    Event e = {stage, open.start, dur, dur - open.child, log.block, perfctr::Counts()};
+    if (counters) {
+        for (int i = 0; i < perfctr::NCOUNTERS; ++i) {
+            const uint64_t d = at.v[i] - open.counts.v[i];
+            e.counts.v[i] = d - open.childCounts.v[i];
+            if (!log.stack.empty()) log.stack.back().childCounts.v[i] += d;
+        }
+    }
+    if (!log.stack.empty()) log.stack.back().child += dur;
+    log.events.push_back(e);
+}
+
+Scope::Scope(const char* stage) : name(active ? stage : nullptr) {
+    if (name) begin(name);
+}
+
+Scope::~Scope() {
+    if (name) end(name);
+}
+
+// --- Reporting ---
+
+void writeChromeTrace(const std::string& filename) {
+    std::FILE* f = std::fopen(filename.c_str(), "w");
+    if (!f) throw std::runtime_error("Cannot open trace file: " + filename);
+    std::fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    std::lock_guard<std::mutex> lock(logsMutex);
+    for (const auto& log : logs) {
+        std::fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                        "\"args\": {\"name\": \"thread %d\"}}",
+                     first ? "" : ",\n", log->tid, log->tid);
+        first = false;
+        for (const Event& e : log->events) {
+            std::fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"paqman\", \"ph\": \"X\", \"pid\": 1, "
+                            "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"block\": %d",
+                         e.name, log->tid, e.start / 1e3, e.dur / 1e3, e.block);
+            for (int i = 0; counters && i < perfctr::NCOUNTERS; ++i) {
+                if (perfctr::available(i)) {
+                    std::fprintf(f, ", \"%s\": %llu", perfctr::name(i), (unsigned long long)e.counts.v[i]);
+                }
+            }
+            std::fprintf(f, "}}");
+        }
+    }
+    std::fprintf(f, "\n]}\n");
+    if (std::fclose(f) != 0) throw std::runtime_error("Error writing trace file: " + filename);
+}
+
+void printSummary(std::ostream& out) {
+    StageTotals total;
+    std::map<int, StageTotals> byBlock;
+    std::vector<std::pair<int, StageTotals>> byThread;
+    int64_t sum = 0;
+
+    std::lock_guard<std::mutex> lock(logsMutex);
+    for (const auto& log : logs) {
+        StageTotals thread;
+        for (const Event& e : log->events) {
+            total[e.name] += e.self;
+            thread[e.name] += e.self;
+            if (e.block >= 0) byBlock[e.block][e.name] += e.self;
+            sum += e.self;
+        }
+        if (!thread.empty()) byThread.push_back({log->tid, thread});
+    }
+
+    char buf[96];
+    out << "Stage timing (self time):\n";
+    for (const auto& t : total) {
+        std::snprintf(buf, sizeof(buf), "  %-12s %10.1f ms %6.1f%%\n", t.first.c_str(), t.second / 1e6,
+                      sum ? 100.0 * t.second / sum : 0.0);
+        out << buf;
+    }
+    for (const auto& t : byThread) printTotals(out, "  thread " + std::to_string(t.first), t.second);
+    for (const auto& b : byBlock) printTotals(out, "  block " + std::to_string(b.first), b.second);
+    if (!counters) return;
+
+    std::map<std::string, perfctr::Counts> stageCounts;
+    std::map<std::pair<int, std::string>, perfctr::Counts> blockCounts;
+    for (const auto& log : logs) {
+        for (const Event& e : log->events) {
+            addCounts(stageCounts[e.name], e.counts);
+            if (e.block >= 0) addCounts(blockCounts[{e.block, e.name}], e.counts);
+        }
+    }
+    out << "Hardware counters (self):\n";
+    std::snprintf(buf, sizeof(buf), "  %-6s %-12s", "block", "stage");
+    out << buf;
+    for (int i = 0; i < perfctr::NCOUNTERS; ++i) {
+        std::snprintf(buf, sizeof(buf), " %14s", perfctr::name(i));
+        out << buf;
+    }
+    out << "    IPC\n";
+    for (const auto& c : stageCounts) printCounts(out, "all", c.first, c.second);
+    for (const auto& c : blockCounts) printCounts(out, std::to_string(c.first.first), c.first.second, c.second);
+}
+
+}  // namespace trace
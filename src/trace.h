@@ -0,0 +1,66 @@
+/**
+ * @file trace.h
+ * @brief Per-stage timing for PAQMan with Chrome trace export (`--trace file.json`).
+ *
+ * When enabled, trace installs a libzpaq::Profiler so the stages inside
+ * libzpaq (sha1, e8e9, sort, lz77, encode, verify, decode, postprocess) are
+ * recorded together with PAQMan's own stages (read, write) via Scope.
+ * Every event carries its thread and the block that thread is working on.
+ *
+ * The recording can be written as Chrome trace JSON (chrome://tracing,
+ * Perfetto) to show pipeline stalls and thread utilisation, and summarised
+ * as self time per stage, per thread and per block.
+ *
+ * With enableCounters() (`--perfctr`) every stage also records the
+ * hardware counters of perfctr.h, reported per stage and per block.
+ *
+ * When disabled, a Scope costs one branch and libzpaq one null check.
+ */
+
+#ifndef PAQMAN_TRACE_H
+#define PAQMAN_TRACE_H
+
+#include <ostream>
+#include <string>
+
+namespace trace {
+
+// Starts recording and installs the libzpaq profiler hook.
+void enable();
+
+// Starts recording with hardware counters at every stage boundary. Returns
+// false and sets why if the counters are unavailable (nothing is enabled).
+bool enableCounters(std::string& why);
+
+// True if recording.
+bool enabled();
+
+// Sets the block number attached to events recorded by the calling thread
+// (-1 for none).
+void setBlock(int block);
+
+// Records its lifetime as a stage of the calling thread.
+class Scope {
+    const char* name;
+
+public:
+    explicit Scope(const char* stage);
+    ~Scope();
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+};
+
+// Writes all recorded events as Chrome trace JSON. Throws on I/O errors.
+void writeChromeTrace(const std::string& filename);
+
+// Prints self time per stage in total, per thread and per block, and the
+// counters per stage and per block if enabled.
+void printSummary(std::ostream& out);
+
+// Low level hooks used by Scope and the libzpaq profiler.
+void begin(const char* stage);
+void end(const char* stage);
+
+}  // namespace trace
+
+#endif  // PAQMAN_TRACE_H
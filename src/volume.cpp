@@ -0,0 +1,232 @@
+/**
+ * @file volume.cpp
+ * @brief Multi-volume archives for PAQMan (`paqman c --volume-size`).
+ *
+ * Blocks are collected whole before they are placed, as a part must not
+ * grow past the size. Every part has a queue of blocks and a thread that
+ * writes them; the blocks queued in all parts are limited to 64 MiB, and
+ * the coder waits when the parts fall behind by that much.
+ */
+
+#include "volume.h"
+#include "prefetch.h"
+#include "trace.h"
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace volume {
+
+namespace {
+
+const size_t kMaxQueued = 64 << 20;  // bytes of blocks waiting to be written
+const int kReadAhead = 2;            // parts opened after the current one
+
+std::string partName(const std::string& path, int i) {
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), ".%03d", i + 1);
+    return path + suffix;
+}
+
+struct Part {
+    std::string path;
+    int fd = -1;
+    std::deque<std::string> queue;
+    bool closed = false;  // no more blocks
+    std::thread thread;
+};
+
+}  // namespace
+
+struct Writer::Impl {
+    std::string path;
+    uint64_t size = 0;
+    std::string block;         // being collected
+    uint64_t partBytes = 0;    // given to the current part
+    std::vector<std::unique_ptr<Part>> parts;
+    bool finished = false;
+
+    std::mutex m;
+    std::condition_variable cv;  // queues, queued or error changed
+    size_t queued = 0;
+    std::string error;
+
+    void fail(const std::string& what) {
+        std::lock_guard<std::mutex> lock(m);
+        if (error.empty()) error = what;
+        cv.notify_all();
+    }
+
+    void run(Part* p) {
+        for (;;) {
+            std::string b;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return !p->queue.empty() || p->closed; });
+                if (p->queue.empty()) break;
+                b.swap(p->queue.front());
+                p->queue.pop_front();
+            }
+            {
+                trace::Scope stage("write");
+                for (size_t done = 0; done < b.size();) {
+                    const ssize_t r = ::write(p->fd, b.data() + done, b.size() - done);
+                    if (r < 0 && errno == EINTR) continue;
+                    if (r < 0) {
+                        fail("Cannot write " + p->path + ": " + std::strerror(errno));
+                        break;
+                    }
+                    done += r;
+                }
+            }
+            std::lock_guard<std::mutex> lock(m);
+            queued -= b.size();
+            cv.notify_all();
+        }
+        if (size > 0 && fsync(p->fd) != 0) fail("Cannot sync " + p->path + ": " + std::strerror(errno));
+        if (::close(p->fd) != 0) fail("Cannot close " + p->path + ": " + std::strerror(errno));
+        p->fd = -1;
+    }
+
+    // Creates the next part and starts its thread.
+    void open() {
+        std::unique_ptr<Part> p(new Part);
+        p->path = size > 0 ? partName(path, int(parts.size())) : path;
+        p->fd = ::open(p->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (p->fd < 0) throw std::runtime_error("Cannot open output file: " + p->path);
+        Part* raw = p.get();
+        p->thread = std::thread([this, raw] { run(raw); });
+        parts.push_back(std::move(p));
+        partBytes = 0;
+    }
+
+    void closeCurrent() {
+        std::lock_guard<std::mutex> lock(m);
+        parts.back()->closed = true;
+        cv.notify_all();
+    }
+
+    void join() {
+        if (!parts.empty()) closeCurrent();
+        for (auto& p : parts) {
+            if (p->thread.joinable()) p->thread.join();
+        }
+    }
+};
+
+Writer::Writer(const std::string& path, uint64_t size) : impl(new Impl) {
+    impl->path = path;
+    impl->size = size;
+    impl->open();
+}
+
+Writer::~Writer() {
+    impl->join();
+}
+
+void Writer::put(int c) {
+    impl->block.push_back(char(c));
+}
+
+void Writer::write(const char* buf, int n) {
+    impl->block.append(buf, n);
+}
+
+void Writer::endBlock() {
+    Impl& w = *impl;
+    if (w.block.empty()) return;
+    if (w.size > 0 && w.partBytes > 0 && w.partBytes + w.block.size() > w.size) {
+        w.closeCurrent();
+        w.open();
+    }
+    std::unique_lock<std::mutex> lock(w.m);
+    w.cv.wait(lock, [&] { return w.queued == 0 || w.queued + w.block.size() <= kMaxQueued || !w.error.empty(); });
+    if (!w.error.empty()) throw std::runtime_error(w.error);
+    w.partBytes += w.block.size();
+    w.queued += w.block.size();
+    w.parts.back()->queue.push_back(std::move(w.block));
+    w.block = std::string();
+    w.cv.notify_all();
+}
+
+int Writer::finish() {
+    Impl& w = *impl;
+    if (!w.finished) {
+        endBlock();
+        w.join();
+        w.finished = true;
+    }
+    if (!w.error.empty()) throw std::runtime_error(w.error);
+    const int n = int(w.parts.size());
+    if (w.size > 0) {
+        std::error_code ec;
+        for (int i = n; fs::exists(partName(w.path, i), ec); ++i) fs::remove(partName(w.path, i), ec);
+    }
+    return n;
+}
+
+std::vector<std::string> parts(const std::string& path) {
+    std::error_code ec;
+    std::string base = path;
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".001") == 0) {
+        base = path.substr(0, path.size() - 4);
+    } else if (fs::exists(path, ec)) {
+        return {path};
+    }
+    std::vector<std::string> list;
+    for (int i = 0; fs::exists(partName(base, i), ec); ++i) list.push_back(partName(base, i));
+    return list;
+}
+
+struct Reader::Impl {
+    std::vector<std::string> parts;
+    bool direct = false;
+    size_t next = 0;  // first part not opened yet
+    std::deque<std::unique_ptr<prefetch::Reader>> open;
+
+    void openMore() {
+        while (next < parts.size() && open.size() < size_t(1 + kReadAhead)) {
+            open.emplace_back(new prefetch::Reader(parts[next++], direct));
+        }
+    }
+};
+
+Reader::Reader(const std::vector<std::string>& parts, bool direct) : impl(new Impl) {
+    if (parts.empty()) throw std::runtime_error("No archive parts to read");
+    impl->parts = parts;
+    impl->direct = direct;
+    impl->openMore();
+}
+
+Reader::~Reader() = default;
+
+int Reader::get() {
+    char c;
+    return read(&c, 1) == 1 ? (unsigned char)c : -1;
+}
+
+int Reader::read(char* buf, int n) {
+    int got = 0;
+    while (got < n && !impl->open.empty()) {
+        const int r = impl->open.front()->read(buf + got, n - got);
+        if (r > 0) {
+            got += r;
+            continue;
+        }
+        impl->open.pop_front();
+        impl->openMore();
+    }
+    return got;
+}
+
+}  // namespace volume
@@ -0,0 +1,76 @@
+/**
+ * @file volume.h
+ * @brief Multi-volume archives for PAQMan (`paqman c --volume-size`).
+ *
+ * volume::Writer splits an archive into parts path.001, path.002, ... of
+ * at most a given size, cut only between blocks, so every part is a ZPAQ
+ * stream of its own that can be listed, uploaded or checked alone. A
+ * block larger than the size gets a part of its own. Each part is written
+ * and fsync'd by its own thread while the next one fills, so a finished
+ * part can be uploaded at once. volume::Reader reads the parts back as one
+ * stream, with the next parts already being read ahead.
+ */
+
+#ifndef PAQMAN_VOLUME_H
+#define PAQMAN_VOLUME_H
+
+#include "libzpaq.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace volume {
+
+class Writer : public libzpaq::Writer {
+public:
+    // Writes path itself if size is 0. Throws if the first part cannot be
+    // created.
+    Writer(const std::string& path, uint64_t size);
+    ~Writer() override;  // waits for the parts, ignoring errors
+
+    // Append to the current block.
+    void put(int c) override;
+    void write(const char* buf, int n) override;
+
+    // The bytes since the last call form a block; it goes to the current
+    // part, or starts the next one if it does not fit. Throws the first
+    // write error.
+    void endBlock();
+
+    // Ends the last block, waits until every part is written and closed,
+    // and removes parts left over from an earlier, longer archive. Throws
+    // the first error. Returns the number of parts.
+    int finish();
+
+    struct Impl;
+
+private:
+    std::unique_ptr<Impl> impl;
+};
+
+// The files of the archive at path: path itself if it exists, else
+// path.001, path.002, ... as long as they exist. path may also name the
+// first part. Returns an empty list if there are none.
+std::vector<std::string> parts(const std::string& path);
+
+// Reads parts in order as one stream, each with a prefetch::Reader
+// (see prefetch.h); the two parts after the current one are opened, and
+// read ahead, before it ends.
+class Reader : public libzpaq::Reader {
+public:
+    // Throws if there are no parts or one cannot be opened.
+    explicit Reader(const std::vector<std::string>& parts, bool direct = false);
+    ~Reader() override;
+    int get() override;
+    int read(char* buf, int n) override;
+
+    struct Impl;
+
+private:
+    std::unique_ptr<Impl> impl;
+};
+
+}  // namespace volume
+
+#endif  // PAQMAN_VOLUME_H